@@ -10,8 +10,16 @@
 #include <assimp/scene.h>           // Output data structure
 #include <assimp/postprocess.h>     // Post processing flags
 
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include <glm/gtc/packing.hpp>
+
 #include "agl_ext.hpp"
 #include "maths.hpp"
+#include "optimizer.hpp"
 
 using namespace std;
 
@@ -111,22 +119,28 @@ VkDevice agl::GetDevice()
 
 u32 agl::SurfaceDetails::GetNextImageIndex()
 {
-	vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	timeline->Wait(frameTimelineValues[currentFrame]);
+
+	aglDeletionQueue::Collect();
+	aglRenderQueue::ResetFrameBuffers(currentFrame);
 
 	u32 imageIndex;
-	VkResult resultkhr = vkAcquireNextImageKHR(device, baseSurface->swapchain->swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
+	VkResult resultkhr = vkAcquireNextImageKHR(device, swapchain->swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
 		&imageIndex);
 
-	if (resultkhr == VK_ERROR_OUT_OF_DATE_KHR) {
-		baseSurface->Recreate();
-		return 0;
+	while (resultkhr == VK_ERROR_OUT_OF_DATE_KHR) {
+		Recreate();
+
+		resultkhr = vkAcquireNextImageKHR(device, swapchain->swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
+			&imageIndex);
 	}
-	else if (resultkhr != VK_SUCCESS && resultkhr != VK_SUBOPTIMAL_KHR) {
+
+	if (resultkhr != VK_SUCCESS && resultkhr != VK_SUBOPTIMAL_KHR) {
 		throw std::runtime_error("failed to acquire swap chain image!");
 	}
 
-
-	vkResetFences(device, 1, &inFlightFences[currentFrame]);
+	// The image may still be rendered to by an older frame slot
+	timeline->Wait(imageTimelineValues[imageIndex]);
 
 	currentImage = imageIndex;
 
@@ -135,8 +149,11 @@ u32 agl::SurfaceDetails::GetNextImageIndex()
 
 void agl::SurfaceDetails::Recreate()
 {
-	Destroy();
-	Create();
+	// Only the size-dependent resources are rebuilt. The command pool and the render pass,
+	// and with it every pipeline created against it, stay alive.
+	swapchain->Recreate();
+
+	imageTimelineValues.assign(framebuffer->images.size(), 0);
 }
 
 agl::SurfaceDetails::SurfaceDetails()
@@ -169,6 +186,7 @@ void agl::SurfaceDetails::Create()
 
 	framebuffer->GetRenderPass()->AttachToCommandBuffer(commandBuffer);
 
+	imageTimelineValues.assign(framebuffer->images.size(), 0);
 }
 
 agl::SurfaceDetails* agl::GetSurfaceDetails()
@@ -181,6 +199,11 @@ u32 agl::GetCurrentImage()
 	return currentFrame;
 }
 
+u32 agl::GetFramesInFlight()
+{
+	return framesInFlight;
+}
+
 void agl::CreateInstance()
 {
 	if (validationLayersEnabled && !CheckValidationLayerSupport())
@@ -195,7 +218,7 @@ void agl::CreateInstance()
 	application_info.applicationVersion = details->applicationVersion;
 	application_info.pEngineName = details->engineName.c_str();
 	application_info.engineVersion = details->engineVersion;
-	application_info.apiVersion = VK_API_VERSION_1_0;
+	application_info.apiVersion = VK_API_VERSION_1_2;
 
 	VkInstanceCreateInfo create_info{};
 	create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -231,7 +254,7 @@ void agl::CreateInstance()
 }
 
 void agl::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer,
-                       VkDeviceMemory& bufferMemory)
+                       aglAllocation& bufferMemory, aglMemoryCategory category, const void* owner)
 {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -243,36 +266,39 @@ void agl::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryProp
 		throw std::runtime_error("failed to create buffer!");
 	}
 
-	VkMemoryRequirements memRequirements;
-	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate buffer memory!");
-	}
-
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);
+	bufferMemory = aglAllocator::AllocateForBuffer(buffer, properties, category, owner);
 }
 
 void agl::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 {
 	VkCommandBuffer commandBuffer = baseSurface->commandBuffer->BeginSingleTimeCommands();
 
-	VkBufferCopy copyRegion{};
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+	RecordCopyBuffer(commandBuffer, srcBuffer, dstBuffer, size);
 
 	baseSurface->commandBuffer->EndSingleTimeCommands(commandBuffer);
 }
 
+void agl::RecordCopyBuffer(VkCommandBuffer cmdBuf, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(cmdBuf, srcBuffer, dstBuffer, 1, &copyRegion);
+}
+
 void agl::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, bool endCmd, u32 mipCount)
 {
 	VkCommandBuffer vkCommandBuffer = baseSurface->commandBuffer->BeginSingleTimeCommands();
 
+	RecordTransitionImageLayout(vkCommandBuffer, image, format, oldLayout, newLayout, layerCount, mipCount);
+
+	if (endCmd)
+		baseSurface->commandBuffer->EndSingleTimeCommands(vkCommandBuffer);
+}
+
+void agl::RecordTransitionImageLayout(VkCommandBuffer cmdBuf, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, u32 mipCount)
+{
 	VkImageMemoryBarrier barrier{};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	barrier.oldLayout = oldLayout;
@@ -349,22 +375,27 @@ void agl::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout ol
 		throw std::invalid_argument("unsupported layout transition!");
 	}
 
-	vkCmdPipelineBarrier(vkCommandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	if (endCmd)
-		baseSurface->commandBuffer->EndSingleTimeCommands(vkCommandBuffer);
+	vkCmdPipelineBarrier(cmdBuf, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 void agl::CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 height, u32 regionCount, VkBufferImageCopy* regions)
 {
 	VkCommandBuffer vkCommandBuffer = baseSurface->commandBuffer->BeginSingleTimeCommands();
 
+	RecordCopyBufferToImage(vkCommandBuffer, buffer, image, width, height, regionCount, regions);
+
+	baseSurface->commandBuffer->EndSingleTimeCommands(vkCommandBuffer);
+}
+
+void agl::RecordCopyBufferToImage(VkCommandBuffer cmdBuf, VkBuffer buffer, VkImage image, u32 width, u32 height, u32 regionCount, VkBufferImageCopy* regions)
+{
 	VkBufferImageCopy* bfrs = regions;
 	u32 regCt = regionCount;
 
+	VkBufferImageCopy region{};
+
 	if (regionCount == 0) {
 
-		VkBufferImageCopy region{};
 		region.bufferOffset = 0;
 		region.bufferRowLength = 0;
 		region.bufferImageHeight = 0;
@@ -381,18 +412,12 @@ void agl::CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 heigh
 			1
 		};
 
-		VkBufferImageCopy dreg[1];
-
-		dreg[0] = region;
-
-		bfrs = dreg;
+		bfrs = &region;
 		regCt = 1;
 
 	}
 
-	vkCmdCopyBufferToImage(vkCommandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regCt, bfrs);
-
-	baseSurface->commandBuffer->EndSingleTimeCommands(vkCommandBuffer);
+	vkCmdCopyBufferToImage(cmdBuf, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regCt, bfrs);
 }
 
 void agl::CopyImageToImage(VkImage base, VkImage sub, int layer, int layerCount, int width, int height, bool endCmd, int srcMip, int dstMip)
@@ -400,6 +425,14 @@ void agl::CopyImageToImage(VkImage base, VkImage sub, int layer, int layerCount,
 
 	VkCommandBuffer cmdBuf = baseSurface->commandBuffer->BeginSingleTimeCommands();
 
+	RecordCopyImageToImage(cmdBuf, base, sub, layer, layerCount, width, height, srcMip, dstMip);
+
+	if (endCmd)
+		baseSurface->commandBuffer->EndSingleTimeCommands(cmdBuf);
+}
+
+void agl::RecordCopyImageToImage(VkCommandBuffer cmdBuf, VkImage base, VkImage sub, int layer, int layerCount, int width, int height, int srcMip, int dstMip)
+{
 	// Copy region for transfer from framebuffer to cube face
 	VkImageCopy copyRegion = {};
 
@@ -427,9 +460,6 @@ void agl::CopyImageToImage(VkImage base, VkImage sub, int layer, int layerCount,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		1,
 		&copyRegion);
-
-	if (endCmd)
-		baseSurface->commandBuffer->EndSingleTimeCommands(cmdBuf);
 }
 
 VkFormat agl::FindSupportedFormat(const vector<VkFormat>& candidates, VkImageTiling tiling,
@@ -479,33 +509,73 @@ void agl::PresentFrame(u32 imageIndex)
 	VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
 
 	vector<VkSemaphore> waitSemaphores = { imageAvailableSemaphores[currentFrame] };
+	vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	vector<uint64_t> waitValues = { 0 };
+
+	if (aglComputeShader::pendingTimelineValue != 0)
+	{
+		waitSemaphores.push_back(timeline->semaphore);
+		waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+		waitValues.push_back(aglComputeShader::pendingTimelineValue);
+
+		aglComputeShader::pendingTimelineValue = 0;
+	}
 
-	if (aglComputeShader::AreComputeShadersUsed)
+	if (aglGpuCuller::pendingTimelineValue != 0)
 	{
-		waitSemaphores.push_back(aglComputeShader::computeFinishedSemaphores[currentFrame]);
+		// Covers the indirect reads and the depth buffer the pyramid was built from
+		waitSemaphores.push_back(timeline->semaphore);
+		waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		waitValues.push_back(aglGpuCuller::pendingTimelineValue);
+
+		aglGpuCuller::pendingTimelineValue = 0;
 	}
 
+	if (pendingTransferValue != 0)
+	{
+		waitSemaphores.push_back(transferTimeline->semaphore);
+		waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		waitValues.push_back(pendingTransferValue);
+
+		pendingTransferValue = 0;
+	}
 
-	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
 	submitInfo.waitSemaphoreCount = waitSemaphores.size();
 	submitInfo.pWaitSemaphores = waitSemaphores.data();
-	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.pWaitDstStageMask = waitStages.data();
 	submitInfo.commandBufferCount = 1;
 
 
 	submitInfo.pCommandBuffers = &baseSurface->commandBuffer->commandBuffers[currentFrame];
 
-	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-	submitInfo.signalSemaphoreCount = 1;
+	std::unique_lock<std::mutex> queueLock(queueMutex);
+
+	uint64_t frameValue = timeline->Next();
+
+	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame], timeline->semaphore };
+	uint64_t signalValues[] = { 0, frameValue };
+	submitInfo.signalSemaphoreCount = 2;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	VkResult queueResult = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
+	VkTimelineSemaphoreSubmitInfo timelineInfo{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.waitSemaphoreValueCount = static_cast<u32>(waitValues.size());
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = 2;
+	timelineInfo.pSignalSemaphoreValues = signalValues;
+	submitInfo.pNext = &timelineInfo;
+
+	VkResult queueResult = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
 
 	if (queueResult != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to submit draw command buffer.");
 	}
 
+	frameTimelineValues[currentFrame] = frameValue;
+	imageTimelineValues[imageIndex] = frameValue;
+
+	aglDeletionQueue::OnFrameSubmitted(frameValue);
+
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -520,8 +590,12 @@ void agl::PresentFrame(u32 imageIndex)
 
 	VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || baseSurface->framebuffer->IsResized()) {
-		baseSurface->framebuffer->Resized = false;
+	queueLock.unlock();
+
+	// Taken in one step, a resize reported while this recreates is kept for the next present
+	bool resized = baseSurface->framebuffer->Resized.exchange(false);
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || resized) {
 		baseSurface->Recreate();
 
 		cout << "Recreated Swapchain" << endl;
@@ -530,32 +604,118 @@ void agl::PresentFrame(u32 imageIndex)
 	else if (result != VK_SUCCESS) {
 		throw std::runtime_error("failed to present swap chain image!");
 	}
-
-	vkDeviceWaitIdle(device);
 }
 
 void agl::CreateSyncObjects()
 {
-	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+	imageAvailableSemaphores.resize(framesInFlight);
+	renderFinishedSemaphores.resize(framesInFlight);
+	frameTimelineValues.assign(framesInFlight, 0);
 
 	VkSemaphoreCreateInfo semaphoreInfo{};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	VkFenceCreateInfo fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	// Swapchain acquire and present only accept binary semaphores
+	for (u32 i = 0; i < framesInFlight; i++)
 	{
 		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS)
 		{
 			throw std::runtime_error("failed to create synchronization objects for a frame!");
 		}
 	}
+
+	timeline = new aglTimeline;
+
+	if (HasTransferQueue())
+	{
+		transferTimeline = new aglTimeline;
+	}
+}
+
+agl::aglTimeline::aglTimeline()
+{
+	VkSemaphoreTypeCreateInfo typeInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphoreInfo.pNext = &typeInfo;
+
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create timeline semaphore!");
+	}
+}
+
+uint64_t agl::aglTimeline::GetCompletedValue()
+{
+	uint64_t value;
+	vkGetSemaphoreCounterValue(device, semaphore, &value);
+
+	lastCompleted = value;
+
+	return value;
+}
+
+bool agl::aglTimeline::IsComplete(uint64_t value)
+{
+	if (value <= lastCompleted)
+	{
+		return true;
+	}
+
+	return value <= GetCompletedValue();
+}
+
+void agl::aglTimeline::Wait(uint64_t value)
+{
+	if (IsComplete(value))
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &semaphore;
+	waitInfo.pValues = &value;
+
+	if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to wait for timeline semaphore!");
+	}
+
+	lastCompleted = value;
+}
+
+uint64_t agl::aglTimeline::Submit(VkQueue queue, VkCommandBuffer commandBuffer)
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+
+	uint64_t value = Next();
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &value;
+
+	VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &semaphore;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to submit command buffer!");
+	}
+
+	return value;
+}
+
+void agl::aglTimeline::Destroy()
+{
+	vkDestroySemaphore(device, semaphore, nullptr);
 }
 
 void agl::FramebufferResizeCallback(SDL_Window* window, int width, int height)
@@ -577,2613 +737,5544 @@ uint32_t agl::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properti
 	throw std::runtime_error("failed to find suitable memory type!");
 }
 
-VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo,
-	const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
+void agl::aglAllocator::Create(VkDeviceSize blockSize)
 {
-	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-	if (func != nullptr)
-	{
-		return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
-	}
-	return VK_ERROR_EXTENSION_NOT_PRESENT;
+	aglAllocator::blockSize = blockSize;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	heapBlockBytes.assign(memoryProperties.memoryHeapCount, 0);
+	heapAllocatedBytes.assign(memoryProperties.memoryHeapCount, 0);
 }
 
-void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger,
-	const VkAllocationCallbacks* pAllocator)
+bool agl::aglFreeList::TryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
 {
-	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-	if (func != nullptr)
+	for (auto range = freeRanges.begin(); range != freeRanges.end(); ++range)
 	{
-		func(instance, debugMessenger, pAllocator);
-	}
-}
+		VkDeviceSize begin = range->first;
+		VkDeviceSize end = range->first + range->second;
+		VkDeviceSize aligned = (begin + alignment - 1) / alignment * alignment;
 
+		if (aligned + size > end)
+		{
+			continue;
+		}
 
-void agl::SetupDebugMessenger()
-{
-	if (!validationLayersEnabled) return;
+		freeRanges.erase(range);
 
-	VkDebugUtilsMessengerCreateInfoEXT create_info{};
-	PopulateDebugMessengerCreateInfo(create_info);
+		if (aligned > begin)
+		{
+			freeRanges[begin] = aligned - begin;
+		}
 
-	VkResult result = CreateDebugUtilsMessengerEXT(instance, &create_info, nullptr, &DebugMessenger);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to set up debug messenger!");
+		if (aligned + size < end)
+		{
+			freeRanges[aligned + size] = end - (aligned + size);
+		}
+
+		offset = aligned;
+		return true;
 	}
+
+	return false;
 }
 
-void agl::PickPhysicalDevice()
+void agl::aglFreeList::Release(VkDeviceSize offset, VkDeviceSize size)
 {
-	u32 deviceCount = 0;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+	auto next = freeRanges.lower_bound(offset);
 
-	if (deviceCount == 0)
+	if (next != freeRanges.end() && offset + size == next->first)
 	{
-		throw std::runtime_error("Failed to find GPUs with Vulkan support.");
+		size += next->second;
+		next = freeRanges.erase(next);
 	}
 
-	vector<VkPhysicalDevice> devices(deviceCount);
-	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-	for (VkPhysicalDevice device : devices)
+	if (next != freeRanges.begin())
 	{
-		if (IsDeviceSuitable(device))
-		{
-			physicalDevice = device;
-
-			//std::cout << "Physical Device Selected: " << physical_device. << endl ;
+		auto previous = std::prev(next);
 
-			break;
+		if (previous->first + previous->second == offset)
+		{
+			previous->second += size;
+			return;
 		}
 	}
 
-	if (physicalDevice == VK_NULL_HANDLE)
-	{
-		throw std::runtime_error("Failed to find a suitable GPU.");
-	}
+	freeRanges[offset] = size;
+}
 
-	VkPhysicalDeviceProperties properties = {};
+void agl::aglFreeList::Reset(VkDeviceSize size)
+{
+	this->size = size;
 
-	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	freeRanges.clear();
+	freeRanges[0] = size;
+}
 
-	std::cout << "Found a GPU! Listing properties now." << endl;
+bool agl::aglFreeList::IsEmpty() const
+{
+	return freeRanges.size() == 1 && freeRanges.begin()->second == size;
+}
 
-	string dimensions[3] = {
-		"X","Y","Z"
-	};
+VkDeviceMemory agl::aglAllocator::AllocateMemory(VkDeviceSize size, u32 memoryType, VkBuffer buffer, VkImage image, char** mapped)
+{
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
 
-	std::cout << "\tMax Compute Work Group Count " << endl;
-	for (int i = 0; i < 3; ++i)
-	{
-		std::cout << "\t[" << dimensions[i] << "]: " << properties.limits.maxComputeWorkGroupCount[i] << endl;
-	}
-	std::cout << "\tMax Compute Work Group Invocations " << properties.limits.maxComputeWorkGroupInvocations << endl;
-	std::cout << "\tMax Compute Work Group Size " << endl;
-	for (int i = 0; i < 3; ++i)
+	VkMemoryDedicatedAllocateInfo dedicatedInfo{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO };
+	if (buffer != VK_NULL_HANDLE || image != VK_NULL_HANDLE)
 	{
-		std::cout << "\t[" << dimensions[i] << "]: " << properties.limits.maxComputeWorkGroupSize[i] << endl;
+		dedicatedInfo.buffer = buffer;
+		dedicatedInfo.image = image;
+		allocInfo.pNext = &dedicatedInfo;
 	}
-}
-
-bool agl::IsDeviceSuitable(const VkPhysicalDevice device)
-{
-	QueueFamilyIndices indices = FindQueueFamilies(device);
 
-	bool extensionsSupported = CheckDeviceExtensionSupport(device);
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate device memory!");
+	}
 
+	heapBlockBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += size;
 
-	bool swapChainAdequate = false;
-	if (extensionsSupported)
+	*mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
 	{
-		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+		void* data;
+		vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data);
+		*mapped = static_cast<char*>(data);
 	}
 
-	return indices.isComplete() && extensionsSupported && swapChainAdequate;
+	return memory;
 }
 
-bool agl::CheckDeviceExtensionSupport(VkPhysicalDevice device)
+agl::aglAllocation agl::aglAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+	bool linear, bool dedicated, VkBuffer buffer, VkImage image, aglMemoryCategory category, const void* owner)
 {
-	uint32_t extensionCount;
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	u32 memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
 
-	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+	aglAllocation allocation;
+	allocation.size = requirements.size;
+	allocation.pool = memoryType * 2 + (linear ? 1 : 0);
+	allocation.heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+	allocation.category = category;
+	allocation.owner = owner;
 
-	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	std::lock_guard<std::mutex> lock(mutex);
 
-	for (const auto& extension : availableExtensions)
+	if (dedicated || requirements.size > blockSize / 2)
 	{
-		requiredExtensions.erase(extension.extensionName);
-	}
-
-	return requiredExtensions.empty();
-}
+		char* mapped;
+		allocation.memory = AllocateMemory(requirements.size, memoryType, buffer, image, &mapped);
+		allocation.mapped = mapped;
+		allocation.dedicated = true;
 
-agl::QueueFamilyIndices agl::FindQueueFamilies(VkPhysicalDevice device)
-{
-	QueueFamilyIndices indices;
+		Track(allocation, true);
+		return allocation;
+	}
 
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	std::vector<Block>& blocks = pools[allocation.pool];
 
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+	VkDeviceSize offset = 0;
+	u32 blockIndex = 0;
 
-	int i = 0;
-	for (const auto& queueFamily : queueFamilies)
+	for (; blockIndex < blocks.size(); ++blockIndex)
 	{
-		if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
+		if (blocks[blockIndex].memory != VK_NULL_HANDLE && blocks[blockIndex].ranges.TryAllocate(requirements.size, requirements.alignment, offset))
 		{
-			indices.graphicsFamily = i;
+			break;
 		}
+	}
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-
-		if (presentSupport)
+	if (blockIndex == blocks.size())
+	{
+		// Reuse the slot of a block that was given back
+		for (blockIndex = 0; blockIndex < blocks.size(); ++blockIndex)
 		{
-			indices.presentFamily = i;
+			if (blocks[blockIndex].memory == VK_NULL_HANDLE)
+			{
+				break;
+			}
 		}
 
-		if (indices.isComplete())
+		if (blockIndex == blocks.size())
 		{
-			break;
+			blocks.emplace_back();
 		}
 
-		i++;
+		Block& block = blocks[blockIndex];
+		block.memory = AllocateMemory(blockSize, memoryType, VK_NULL_HANDLE, VK_NULL_HANDLE, &block.mapped);
+		block.ranges.Reset(blockSize);
+
+		block.ranges.TryAllocate(requirements.size, requirements.alignment, offset);
 	}
 
-	return indices;
+	Block& block = blocks[blockIndex];
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+	allocation.block = blockIndex;
+
+	Track(allocation, true);
+	return allocation;
 }
 
-void agl::CreateLogicalDevice()
+void agl::aglAllocator::Track(const aglAllocation& allocation, bool add)
 {
-	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
-
-	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
-
-	float queuePriority = 1.0f;
-	for (uint32_t queueFamily : uniqueQueueFamilies)
-	{
-		VkDeviceQueueCreateInfo queueCreateInfo{};
-		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queueCreateInfo.queueFamilyIndex = queueFamily;
-		queueCreateInfo.queueCount = 1;
-		queueCreateInfo.pQueuePriorities = &queuePriority;
-		queueCreateInfos.push_back(queueCreateInfo);
-	}
-
-	VkPhysicalDeviceFeatures device_features{};
-
-	VkDeviceCreateInfo create_info{};
-	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-
-	create_info.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-	create_info.pQueueCreateInfos = queueCreateInfos.data();
-
-	create_info.pEnabledFeatures = &device_features;
-
-	create_info.enabledExtensionCount = static_cast<u32>(deviceExtensions.size());
-	create_info.ppEnabledExtensionNames = deviceExtensions.data();
-
-	if (validationLayersEnabled)
-	{
-		create_info.enabledLayerCount = static_cast<u32>(validationLayers.size());
-		create_info.ppEnabledLayerNames = validationLayers.data();
-	}
-	else
+	if (add)
 	{
-		create_info.enabledLayerCount = 0;
-	}
-
-	VkResult result = vkCreateDevice(physicalDevice, &create_info, nullptr, &device);
+		categoryBytes[allocation.category] += allocation.size;
+		categoryAllocations[allocation.category]++;
+		heapAllocatedBytes[allocation.heap] += allocation.size;
 
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create logical device.");
+		if (allocation.owner)
+		{
+			ownerBytes[allocation.owner] += allocation.size;
+		}
+		return;
 	}
 
-	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &aglComputeShader::computeQueue);
-	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
-}
+	categoryBytes[allocation.category] -= allocation.size;
+	categoryAllocations[allocation.category]--;
+	heapAllocatedBytes[allocation.heap] -= allocation.size;
 
-void agl::CreateSurface()
-{
-	if (SDL_Vulkan_CreateSurface(window, instance, &surface) == 0)
+	if (allocation.owner)
 	{
-		cout << SDL_GetError() << endl;
-		throw std::runtime_error("Failed to create window surface!");
+		auto owner = ownerBytes.find(allocation.owner);
+		if (owner != ownerBytes.end())
+		{
+			owner->second -= allocation.size;
+			if (owner->second == 0)
+			{
+				ownerBytes.erase(owner);
+			}
+		}
 	}
 }
 
-agl::SwapChainSupportDetails agl::querySwapChainSupport(VkPhysicalDevice device)
+agl::aglMemoryStats agl::aglAllocator::GetMemoryStats()
 {
-	SwapChainSupportDetails details;
-
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+	aglMemoryStats stats;
 
-	u32 formatCount;
-	u32 presentModeCount;
-
-	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+	std::lock_guard<std::mutex> lock(mutex);
 
-	if (formatCount != 0)
+	for (u32 i = 0; i < AGL_MEMORY_CATEGORY_COUNT; ++i)
 	{
-		details.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+		stats.categoryBytes[i] = categoryBytes[i];
+		stats.categoryAllocations[i] = categoryAllocations[i];
 	}
 
-	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+	VkPhysicalDeviceMemoryProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
 
-	if (presentModeCount != 0)
+	if (memoryBudgetSupported)
 	{
-		details.presentModes.resize(presentModeCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+		properties.pNext = &budget;
+		vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+		stats.budgetFromDriver = true;
 	}
 
-	return details;
-}
-
-VkSurfaceFormatKHR agl::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
-{
-	for (VkSurfaceFormatKHR availableFormat : availableFormats)
+	for (u32 i = 0; i < memoryProperties.memoryHeapCount; ++i)
 	{
-		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace ==
-			VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+		aglMemoryHeapStats heap;
+		heap.size = memoryProperties.memoryHeaps[i].size;
+		heap.deviceLocal = memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+		heap.blockBytes = heapBlockBytes[i];
+		heap.allocatedBytes = heapAllocatedBytes[i];
+
+		if (memoryBudgetSupported)
 		{
-			return availableFormat;
+			heap.budget = budget.heapBudget[i];
+			heap.usage = budget.heapUsage[i];
+		}
+		else
+		{
+			heap.budget = heap.size;
+			heap.usage = heap.blockBytes;
 		}
+
+		stats.heaps.push_back(heap);
 	}
 
-	return availableFormats[0];
+	return stats;
 }
 
-VkPresentModeKHR agl::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+VkDeviceSize agl::aglAllocator::GetOwnerUsage(const void* owner)
 {
-	for (const auto& availablePresentMode : availablePresentModes)
-	{
-		if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-		{
-			return availablePresentMode;
-		}
-	}
+	std::lock_guard<std::mutex> lock(mutex);
 
-	return VK_PRESENT_MODE_FIFO_KHR;
+	auto usage = ownerBytes.find(owner);
+	return usage == ownerBytes.end() ? 0 : usage->second;
 }
 
-VkExtent2D agl::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+const char* agl::aglAllocator::GetCategoryName(aglMemoryCategory category)
 {
-	if (capabilities.currentExtent.width != std::numeric_limits<u32>::max())
+	switch (category)
 	{
-		return capabilities.currentExtent;
+	case AGL_MEMORY_MESH: return "Meshes";
+	case AGL_MEMORY_TEXTURE: return "Textures";
+	case AGL_MEMORY_CUBEMAP: return "Cubemaps";
+	case AGL_MEMORY_UNIFORM_BUFFER: return "Uniform buffers";
+	case AGL_MEMORY_STORAGE_BUFFER: return "Storage buffers";
+	case AGL_MEMORY_FRAMEBUFFER: return "Framebuffers";
+	case AGL_MEMORY_STAGING: return "Staging";
+	default: return "Other";
 	}
-	int width, height;
-	SDL_GetWindowSize(window, &width, &height);
-
-	VkExtent2D actualExtent = {
-		static_cast<uint32_t>(width),
-		static_cast<uint32_t>(height)
-	};
-
-	actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width,
-		capabilities.maxImageExtent.width);
-	actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height,
-		capabilities.maxImageExtent.height);
-
-	return actualExtent;
 }
 
-void agl::record_command_buffer(u32 imageIndex)
+agl::aglAllocation agl::aglAllocator::AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties,
+	aglMemoryCategory category, const void* owner)
 {
+	VkBufferMemoryRequirementsInfo2 info{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2 };
+	info.buffer = buffer;
 
+	VkMemoryDedicatedRequirements dedicated{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+	VkMemoryRequirements2 requirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+	requirements.pNext = &dedicated;
 
-	baseSurface->commandBuffer->Begin(imageIndex);
-
-	baseSurface->framebuffer->Bind(imageIndex,baseSurface->commandBuffer->GetCommandBuffer(imageIndex));
-
-	baseSurface->framebuffer->renderPass->PushRenderQueue();
-}
+	vkGetBufferMemoryRequirements2(device, &info, &requirements);
 
-void agl::FinishRecordingCommandBuffer(u32 imageIndex)
-{
-	GetSurfaceDetails()->framebuffer->renderPass->End(GetSurfaceDetails()->commandBuffer->GetCommandBuffer(imageIndex));
-	baseSurface->commandBuffer->End(imageIndex);
-}
+	bool wantsDedicated = dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation;
 
-void agl::DrawFrame()
-{
-	u32 imageIndex = baseSurface->GetNextImageIndex();
+	aglAllocation allocation = Allocate(requirements.memoryRequirements, properties, true, wantsDedicated, buffer, VK_NULL_HANDLE, category, owner);
 
-	PresentFrame(imageIndex);
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
 
-	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	return allocation;
 }
 
-void agl::PollEvent(SDL_Event event)
+agl::aglAllocation agl::aglAllocator::AllocateForImage(VkImage image, VkMemoryPropertyFlags properties,
+	aglMemoryCategory category, const void* owner, bool linear)
 {
-	if (event.type == SDL_QUIT)
-		closeWindow = true;
-	if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(agl::window))
-		closeWindow = true;
-}
+	VkImageMemoryRequirementsInfo2 info{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2 };
+	info.image = image;
 
+	VkMemoryDedicatedRequirements dedicated{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+	VkMemoryRequirements2 requirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+	requirements.pNext = &dedicated;
 
-agl::aglShaderLevel::aglShaderLevel(string code, aglShaderType type, aglShader* parent)
-{
-	this->parent = parent;
+	vkGetImageMemoryRequirements2(device, &info, &requirements);
 
-	VkShaderModuleCreateInfo createInfo{};
+	bool wantsDedicated = dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation;
 
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const u32*>(code.data());
+	aglAllocation allocation = Allocate(requirements.memoryRequirements, properties, linear, wantsDedicated, VK_NULL_HANDLE, image, category, owner);
 
-	VkResult result = vkCreateShaderModule(device, &createInfo, nullptr, &module);
+	vkBindImageMemory(device, image, allocation.memory, allocation.offset);
 
-	if (result != VK_SUCCESS)
+	return allocation;
+}
+
+void agl::aglAllocator::Free(aglAllocation& allocation)
+{
+	if (!allocation.IsValid())
 	{
-		throw std::runtime_error("Failed to create shader module.");
+		return;
 	}
 
-	SpvReflectShaderModule reflectModule;
-
-	SpvReflectResult reflectResult = spvReflectCreateShaderModule(code.size(), code.data(), &reflectModule);
-
-	assert(reflectResult == SPV_REFLECT_RESULT_SUCCESS);
+	std::lock_guard<std::mutex> lock(mutex);
 
-	u32 descriptorSet_count = 0;
+	Track(allocation, false);
 
-	spvReflectEnumerateDescriptorSets(&reflectModule, &descriptorSet_count, NULL);
+	if (allocation.dedicated)
+	{
+		vkFreeMemory(device, allocation.memory, nullptr);
+		heapBlockBytes[allocation.heap] -= allocation.size;
+		allocation = aglAllocation();
+		return;
+	}
 
-	SpvReflectDescriptorSet** descriptor_sets = (SpvReflectDescriptorSet**)malloc(descriptorSet_count * sizeof(SpvReflectDescriptorSet*));
+	std::vector<Block>& blocks = pools[allocation.pool];
+	Block& block = blocks[allocation.block];
 
-	spvReflectEnumerateDescriptorSets(&reflectModule, &descriptorSet_count, descriptor_sets);
+	block.ranges.Release(allocation.offset, allocation.size);
 
-	for (int i = 0; i < descriptorSet_count; ++i)
+	// Keep one block per pool around so alternating create/destroy doesn't thrash
+	if (block.ranges.IsEmpty())
 	{
-		SpvReflectDescriptorSet* input_var = descriptor_sets[i];
-
-		for (int j = 0; j < input_var->binding_count; ++j)
+		u32 liveBlocks = 0;
+		for (const Block& other : blocks)
 		{
-			SpvReflectDescriptorBinding* binding = input_var->bindings[j];
-
-			aglDescriptorPort* port = new aglDescriptorPort;
-
-			if (binding->descriptor_type == SPV_REFLECT_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+			if (other.memory != VK_NULL_HANDLE)
 			{
-				port->texture = nullptr;
+				++liveBlocks;
 			}
-
-			port->type = static_cast<aglDescriptorType>(binding->descriptor_type);
-			port->name = binding->name;
-			port->binding = binding->binding;
-			port->set = binding->set;
-			port->count = binding->count;
-
-			parent->ports.push_back(port);
-
-			cout << "Descriptor binding found: " << binding->name << " found at " << binding->binding << endl;
 		}
 
-
+		if (liveBlocks > 1)
+		{
+			vkFreeMemory(device, block.memory, nullptr);
+			heapBlockBytes[allocation.heap] -= block.ranges.size;
+			block.memory = VK_NULL_HANDLE;
+			block.mapped = nullptr;
+			block.ranges.Reset(0);
+		}
 	}
 
-	spvReflectDestroyShaderModule(&reflectModule);
-
-	VkPipelineShaderStageCreateInfo shaderStageInfo{};
-	shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	shaderStageInfo.stage = (VkShaderStageFlagBits)(type);
-
-	shaderStageInfo.module = module;
-	shaderStageInfo.pName = "main";
-
-	stageInfo = shaderStageInfo;
+	allocation = aglAllocation();
 }
 
-void agl::aglShaderLevel::Destroy()
+void agl::aglAllocator::Destroy()
 {
-	vkDestroyShaderModule(device, module, nullptr);
+	for (auto& pool : pools)
+	{
+		for (Block& block : pool.second)
+		{
+			if (block.memory != VK_NULL_HANDLE)
+			{
+				vkFreeMemory(device, block.memory, nullptr);
+			}
+		}
+	}
+
+	pools.clear();
+	ownerBytes.clear();
 }
 
-agl::aglCommandBuffer::aglCommandBuffer()
+VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo,
+	const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
 {
-	// Command Pool
-	CreateCommandPool();
+	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+	if (func != nullptr)
+	{
+		return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
+	}
+	return VK_ERROR_EXTENSION_NOT_PRESENT;
 }
 
-void agl::aglCommandBuffer::Begin(u32 currentImage)
+void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger,
+	const VkAllocationCallbacks* pAllocator)
 {
-
-	vkResetCommandBuffer(commandBuffers[currentImage], 0);
-
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = 0;
-	beginInfo.pInheritanceInfo = nullptr;
-
-	if (vkBeginCommandBuffer(commandBuffers[currentImage], &beginInfo) != VK_SUCCESS)
+	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+	if (func != nullptr)
 	{
-		throw std::runtime_error("Failed to begin recording command buffer.");
+		func(instance, debugMessenger, pAllocator);
 	}
 }
 
-void agl::aglCommandBuffer::End(u32 currentImage)
+
+void agl::SetupDebugMessenger()
 {
-	VkResult result = vkEndCommandBuffer(commandBuffers[currentImage]);
+	if (!validationLayersEnabled) return;
+
+	VkDebugUtilsMessengerCreateInfoEXT create_info{};
+	PopulateDebugMessengerCreateInfo(create_info);
 
+	VkResult result = CreateDebugUtilsMessengerEXT(instance, &create_info, nullptr, &DebugMessenger);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to record command buffer.");
+		throw std::runtime_error("failed to set up debug messenger!");
 	}
 }
 
-VkCommandBuffer agl::aglCommandBuffer::BeginSingleTimeCommands()
+void agl::PickPhysicalDevice()
 {
-	if (currentBufferUsed == VK_NULL_HANDLE) {
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = commandPool;
-		allocInfo.commandBufferCount = 1;
+	u32 deviceCount = 0;
+	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 
-		VkCommandBuffer vkCommandBuffer;
-		vkAllocateCommandBuffers(agl::device, &allocInfo, &vkCommandBuffer);
+	if (deviceCount == 0)
+	{
+		throw std::runtime_error("Failed to find GPUs with Vulkan support.");
+	}
 
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vector<VkPhysicalDevice> devices(deviceCount);
+	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-		vkBeginCommandBuffer(vkCommandBuffer, &beginInfo);
+	for (VkPhysicalDevice device : devices)
+	{
+		if (IsDeviceSuitable(device))
+		{
+			physicalDevice = device;
 
-		currentBufferUsed = vkCommandBuffer;
+			//std::cout << "Physical Device Selected: " << physical_device. << endl ;
 
-		return vkCommandBuffer;
-	} else
+			break;
+		}
+	}
+
+	if (physicalDevice == VK_NULL_HANDLE)
 	{
-		return currentBufferUsed;
+		throw std::runtime_error("Failed to find a suitable GPU.");
 	}
-}
 
-void agl::aglCommandBuffer::EndSingleTimeCommands(VkCommandBuffer vkCommandBuffer)
-{
-	vkEndCommandBuffer(vkCommandBuffer);
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &vkCommandBuffer;
+	VkPhysicalDeviceProperties properties = {};
 
-	vkQueueSubmit(agl::graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(agl::graphicsQueue);
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-	vkFreeCommandBuffers(agl::device, commandPool, 1, &vkCommandBuffer);
+	std::cout << "Found a GPU! Listing properties now." << endl;
 
-	currentBufferUsed = VK_NULL_HANDLE;
+	string dimensions[3] = {
+		"X","Y","Z"
+	};
 
+	std::cout << "\tMax Compute Work Group Count " << endl;
+	for (int i = 0; i < 3; ++i)
+	{
+		std::cout << "\t[" << dimensions[i] << "]: " << properties.limits.maxComputeWorkGroupCount[i] << endl;
+	}
+	std::cout << "\tMax Compute Work Group Invocations " << properties.limits.maxComputeWorkGroupInvocations << endl;
+	std::cout << "\tMax Compute Work Group Size " << endl;
+	for (int i = 0; i < 3; ++i)
+	{
+		std::cout << "\t[" << dimensions[i] << "]: " << properties.limits.maxComputeWorkGroupSize[i] << endl;
+	}
 }
 
-void agl::aglCommandBuffer::CreateCommandPool()
+bool agl::IsDeviceSuitable(const VkPhysicalDevice device)
 {
-	QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(physicalDevice);
+	QueueFamilyIndices indices = FindQueueFamilies(device);
 
-	commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	bool extensionsSupported = CheckDeviceExtensionSupport(device);
 
-	VkCommandPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
-	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	bool swapChainAdequate = false;
+	if (extensionsSupported)
 	{
-		throw std::runtime_error("Failed to create command pool.");
+		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
+		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
-}
 
-void agl::aglCommandBuffer::CreateCommandBuffers()
-{
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = commandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = static_cast<u32>(commandBuffers.size());
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(device, &properties);
 
-	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+	VkPhysicalDeviceVulkan12Features features12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	VkPhysicalDeviceFeatures2 features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.pNext = &features12;
+
+	bool timelineSupported = false;
+	if (properties.apiVersion >= VK_API_VERSION_1_2)
 	{
-		throw std::runtime_error("Failed to allocate command buffers.");
+		vkGetPhysicalDeviceFeatures2(device, &features);
+		timelineSupported = features12.timelineSemaphore == VK_TRUE;
 	}
-}
 
-void agl::aglCommandBuffer::Destroy()
-{
-	vkDestroyCommandPool(device, commandPool, nullptr);
+	return indices.isComplete() && extensionsSupported && swapChainAdequate && timelineSupported;
 }
 
-agl::aglRenderQueue::aglRenderQueue(aglRenderPass* pass)
+bool agl::CheckDeviceExtensionSupport(VkPhysicalDevice device)
 {
-	this->pass = pass;
-}
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
-void agl::aglRenderQueue::Push()
-{
-	if (!disabled) {
-		for (aglRenderQueueEntry queue_entry : queueEntries)
-		{
-			queue_entry.shader->BindGraphicsPipeline(pass->commandBuffer->GetCommandBuffer(agl::currentFrame));
-			queue_entry.mesh->Draw(pass->commandBuffer->GetCommandBuffer(agl::currentFrame), agl::currentFrame);
-		}
-	}
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-	queueEntries.clear();
-}
+	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
-agl::aglRenderPass::aglRenderPass(aglFramebuffer* framebuffer, aglRenderPassSettings settings)
-{
-	this->framebuffer = framebuffer;
-	this->renderQueue = new aglRenderQueue(this);
+	for (const auto& extension : availableExtensions)
+	{
+		requiredExtensions.erase(extension.extensionName);
+	}
 
-	CreateRenderPass(settings);
+	return requiredExtensions.empty();
 }
 
-void agl::aglRenderPass::AttachToCommandBuffer(aglCommandBuffer* buffer)
+agl::QueueFamilyIndices agl::FindQueueFamilies(VkPhysicalDevice device)
 {
-	commandBuffer = buffer;
-}
+	QueueFamilyIndices indices;
 
-void agl::aglRenderPass::Begin(u32 imageIndex, VkCommandBuffer cmdBuf)
-{
-	VkRenderPassBeginInfo renderPassInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-	renderPassInfo.renderPass = renderPass;
-	renderPassInfo.framebuffer = framebuffer->framebuffers[imageIndex];
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = framebuffer->extent;
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
 
-	array<VkClearValue, 2> clearValues{};
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-	clearValues[0].color = { 0.2f,0.3f,0.3f,1.0f };
-	clearValues[1].depthStencil = { 1.0f,0 };
+	int i = 0;
+	for (const auto& queueFamily : queueFamilies)
+	{
+		if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
+		{
+			indices.graphicsFamily = i;
+		}
 
-	renderPassInfo.clearValueCount = cast(clearValues.size(), u32);
-	renderPassInfo.pClearValues = clearValues.data();
+		VkBool32 presentSupport = false;
+		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 
-	vkCmdBeginRenderPass(cmdBuf, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		if (presentSupport)
+		{
+			indices.presentFamily = i;
+		}
 
+		if (indices.isComplete())
+		{
+			break;
+		}
 
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(framebuffer->extent.width);
-	viewport.height = static_cast<float>(framebuffer->extent.height);
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
+		i++;
+	}
 
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = framebuffer->extent;
-	vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
-}
+	for (u32 family = 0; family < queueFamilyCount; ++family)
+	{
+		VkQueueFlags flags = queueFamilies[family].queueFlags;
 
-void agl::aglRenderPass::PushRenderQueue()
-{
-	renderQueue->Push();
-}
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !(flags & VK_QUEUE_COMPUTE_BIT))
+		{
+			indices.transferFamily = family;
+			break;
+		}
+	}
 
-void agl::aglRenderPass::End(VkCommandBuffer cmdBuf)
-{
-	vkCmdEndRenderPass(cmdBuf);
+	return indices;
 }
 
-void agl::aglRenderPass::CreateRenderPass(aglRenderPassSettings settings)
+void agl::CreateLogicalDevice()
 {
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = framebuffer->imageFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = settings.colorAttachmentLayout;
-
-	VkAttachmentDescription depthAttachment{};
-	depthAttachment.format = FindDepthFormat();
-	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference depthAttachmentRef{ 1,VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
-	VkAttachmentReference colorAttachmentRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-	VkSubpassDescription subpass{};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRef;
-	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
 
-	array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
-	VkRenderPassCreateInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = cast(attachments.size(), u32);
-	renderPassInfo.pAttachments = attachments.data();
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = settings.dependencies.size();
-	renderPassInfo.pDependencies = settings.dependencies.data();
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
 
-	VkResult result = vkCreateRenderPass(GetDevice(), &renderPassInfo, nullptr, &renderPass);
+	bool useTransferQueue = details->useTransferQueue && indices.transferFamily.has_value();
+	if (useTransferQueue)
+	{
+		uniqueQueueFamilies.insert(indices.transferFamily.value());
+	}
 
-	if (result != VK_SUCCESS)
+	float queuePriority = 1.0f;
+	for (uint32_t queueFamily : uniqueQueueFamilies)
 	{
-		throw std::runtime_error("Failed to create render pass.");
+		VkDeviceQueueCreateInfo queueCreateInfo{};
+		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueCreateInfo.queueFamilyIndex = queueFamily;
+		queueCreateInfo.queueCount = 1;
+		queueCreateInfo.pQueuePriorities = &queuePriority;
+		queueCreateInfos.push_back(queueCreateInfo);
 	}
-}
 
-void agl::DisableRenderQueue()
-{
-	baseSurface->framebuffer->renderPass->renderQueue->disabled = true;
-}
+	VkPhysicalDeviceVulkan12Features supported12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	VkPhysicalDeviceFeatures2 supported{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	supported.pNext = &supported12;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
 
-agl::aglSwapchain::aglSwapchain()
-{
-	fbo = new aglFramebuffer();
-	CreateSwapChain();
-	fbo->CreateFramebuffers({VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
-}
+	multiDrawIndirectSupported = supported.features.multiDrawIndirect == VK_TRUE;
+	drawIndirectFirstInstanceSupported = supported.features.drawIndirectFirstInstance == VK_TRUE;
+	drawIndirectCountSupported = supported12.drawIndirectCount == VK_TRUE;
+	storageImageArrayDynamicIndexingSupported = supported.features.shaderStorageImageArrayDynamicIndexing == VK_TRUE;
 
-void agl::aglSwapchain::CreateSwapChain()
-{
-	SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+	VkPhysicalDeviceFeatures device_features{};
+	device_features.multiDrawIndirect = supported.features.multiDrawIndirect;
+	device_features.drawIndirectFirstInstance = supported.features.drawIndirectFirstInstance;
+	device_features.shaderStorageImageArrayDynamicIndexing = supported.features.shaderStorageImageArrayDynamicIndexing;
 
-	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-	VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
+	VkPhysicalDeviceVulkan12Features features12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	features12.timelineSemaphore = VK_TRUE;
+	features12.drawIndirectCount = supported12.drawIndirectCount;
 
-	u32 imageCount = swapChainSupport.capabilities.minImageCount + 1;
+	VkDeviceCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	create_info.pNext = &features12;
 
-	if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
-	{
-		imageCount = swapChainSupport.capabilities.maxImageCount;
-	}
+	create_info.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+	create_info.pQueueCreateInfos = queueCreateInfos.data();
 
-	VkSwapchainCreateInfoKHR createInfo{};
+	create_info.pEnabledFeatures = &device_features;
 
-	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	createInfo.surface = surface;
+	std::vector<const char*> enabledExtensions = deviceExtensions;
 
-	createInfo.minImageCount = imageCount;
-	createInfo.imageFormat = surfaceFormat.format;
-	createInfo.imageColorSpace = surfaceFormat.colorSpace;
-	createInfo.imageExtent = extent;
-	createInfo.imageArrayLayers = 1;
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
 
-	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
-	uint32_t queueFamilyIndices[ ] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
 
-	if (indices.graphicsFamily != indices.presentFamily)
+	for (const auto& extension : availableExtensions)
 	{
-		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-		createInfo.queueFamilyIndexCount = 2;
-		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+		{
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+			memoryBudgetSupported = true;
+		}
+	}
+
+	create_info.enabledExtensionCount = static_cast<u32>(enabledExtensions.size());
+	create_info.ppEnabledExtensionNames = enabledExtensions.data();
+
+	if (validationLayersEnabled)
+	{
+		create_info.enabledLayerCount = static_cast<u32>(validationLayers.size());
+		create_info.ppEnabledLayerNames = validationLayers.data();
 	}
 	else
 	{
-		createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		createInfo.queueFamilyIndexCount = 0; // Optional
-		createInfo.pQueueFamilyIndices = nullptr; // Optional
+		create_info.enabledLayerCount = 0;
 	}
 
-	createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-
-	createInfo.presentMode = presentMode;
-	createInfo.clipped = VK_TRUE;
-
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
-
-	VkResult result = vkCreateSwapchainKHR(GetDevice(), &createInfo, nullptr, &swapChain);
+	VkResult result = vkCreateDevice(physicalDevice, &create_info, nullptr, &device);
 
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create swapchain.");
+		throw std::runtime_error("Failed to create logical device.");
 	}
 
-	vkGetSwapchainImagesKHR(GetDevice(), swapChain, &imageCount, nullptr);
-	fbo->images.resize(imageCount);
-	vkGetSwapchainImagesKHR(GetDevice(), swapChain, &imageCount, fbo->images.data());
+	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &aglComputeShader::computeQueue);
+	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
 
-	fbo->extent = extent;
-	fbo->imageFormat = surfaceFormat.format;
+	if (useTransferQueue)
+	{
+		vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+	}
 }
 
-void agl::aglSwapchain::Destroy()
+void agl::CreateSurface()
 {
-	fbo->Destroy();
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
+	if (SDL_Vulkan_CreateSurface(window, instance, &surface) == 0)
+	{
+		cout << SDL_GetError() << endl;
+		throw std::runtime_error("Failed to create window surface!");
+	}
 }
 
-void agl::aglSwapchain::Recreate()
+agl::SwapChainSupportDetails agl::querySwapChainSupport(VkPhysicalDevice device)
 {
-	Destroy();
-	CreateSwapChain();
-	fbo->Recreate();
-}
+	SwapChainSupportDetails details;
 
-agl::aglFramebuffer::aglFramebuffer()
-{
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+
+	u32 formatCount;
+	u32 presentModeCount;
+
+	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+
+	if (formatCount != 0)
+	{
+		details.formats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+	}
+
+	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
 
+	if (presentModeCount != 0)
+	{
+		details.presentModes.resize(presentModeCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+	}
+
+	return details;
 }
 
-agl::aglFramebuffer::aglFramebuffer(int width, int height, aglFramebufferCreationSettings settings)
+VkSurfaceFormatKHR agl::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
 {
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	for (VkSurfaceFormatKHR availableFormat : availableFormats)
 	{
-		VkImage image;
-		VkDeviceMemory memory;
-		aglTexture::CreateVulkanImage(width, height, settings.format, VK_IMAGE_TILING_OPTIMAL, settings.usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory,false);
-		images.push_back(image);
+		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace ==
+			VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+		{
+			return availableFormat;
+		}
 	}
-	imageFormat = settings.format;
+
+	return availableFormats[0];
 }
 
-void agl::aglFramebuffer::Destroy()
+VkPresentModeKHR agl::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
+	auto isAvailable = [&](VkPresentModeKHR mode)
+	{
+		return std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end();
+	};
 
-	for (auto framebuffer : framebuffers)
+	std::vector<VkPresentModeKHR> candidates = { details->presentMode };
+
+	// Tearing modes fall back to the lowest latency vsync mode
+	if (details->presentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
 	{
-		vkDestroyFramebuffer(device, framebuffer, nullptr);
+		candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+	}
+	if (details->presentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+	{
+		candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
 	}
 
-	for (auto image_view : imageViews)
+	for (VkPresentModeKHR mode : candidates)
 	{
-		vkDestroyImageView(device, image_view, nullptr);
+		if (isAvailable(mode))
+		{
+			return mode;
+		}
 	}
 
+	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-void agl::aglFramebuffer::Recreate()
+VkExtent2D agl::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
 {
-	int width = 0, height = 0;
-	SDL_GetWindowSize(window, &width, &height);
-	while (width == 0 || height == 0)
+	if (capabilities.currentExtent.width != std::numeric_limits<u32>::max())
 	{
-		SDL_GetWindowSize(window, &width, &height);
-		SDL_WaitEvent(event);
+		return capabilities.currentExtent;
 	}
+	VkExtent2D actualExtent = aglRenderThread::GetWindowExtent();
 
-	vkDeviceWaitIdle(device);
+	if (!aglRenderThread::IsRenderThread())
+	{
+		int width, height;
+		SDL_GetWindowSize(window, &width, &height);
 
-	Destroy();
+		actualExtent = {
+			static_cast<uint32_t>(width),
+			static_cast<uint32_t>(height)
+		};
+	}
 
-	CreateFramebuffers({VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
+	actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width,
+		capabilities.maxImageExtent.width);
+	actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height,
+		capabilities.maxImageExtent.height);
+
+	return actualExtent;
 }
 
-void agl::aglFramebuffer::CreateFramebuffers(aglRenderPassSettings settings)
+u32 agl::BeginFrame()
 {
-	CreateDepthResources();
-	CreateImageViews();
+	PaceFrame();
 
-	renderPass = new aglRenderPass(this,settings);
-	framebuffers.resize(imageViews.size());
+	// Loads turn resident before the application draws, so it never sees meshes change mid-frame
+	aglStreamingLoader::Update();
 
-	for (size_t i = 0; i < imageViews.size(); i++)
+	if (aglRenderThread::IsActive())
 	{
-		array<VkImageView, 2> attachments = {
-			imageViews[i],
-			depthImageView
-		};
+		aglRenderThread::UpdateWindowExtent();
+		return 0;
+	}
 
-		VkFramebufferCreateInfo framebufferInfo{};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = renderPass->renderPass;
-		framebufferInfo.attachmentCount = cast(attachments.size(), u32);
-		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = extent.width;
-		framebufferInfo.height = extent.height;
-		framebufferInfo.layers = 1;
+	u32 imageIndex = baseSurface->GetNextImageIndex();
 
-		if (vkCreateFramebuffer(GetDevice(), &framebufferInfo, nullptr, &framebuffers[i]) != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to create framebuffer.");
-		}
-	}
+	aglStreamingLoader::RefreshFrame();
+
+	record_command_buffer(imageIndex);
+
+	return imageIndex;
 }
 
-void agl::aglFramebuffer::CreateImageViews()
+void agl::EndFrame()
 {
-	imageViews.resize(images.size());
-
-	for (int i = 0; i < images.size(); ++i)
+	if (aglRenderThread::IsActive())
 	{
-		imageViews[i] = aglTexture::CreateImageView(images[i], imageFormat, VK_IMAGE_ASPECT_COLOR_BIT, false);
+		aglRenderThread::Publish();
+
+		UpdateFrame();
+		return;
 	}
-}
 
-void agl::aglFramebuffer::CreateDepthResources()
-{
-	VkFormat depthFormat = FindDepthFormat();
+	FinishRecordingCommandBuffer(currentImage);
 
-	aglTexture::CreateVulkanImage(extent.width, extent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory, false);
+	PresentFrame(currentImage);
 
-	depthImageView = aglTexture::CreateImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, false);
-	//TransitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	currentFrame = (currentFrame + 1) % framesInFlight;
 
+	UpdateFrame();
 }
 
-void agl::aglShaderFactory::ReloadAllShaders()
+void agl::Record(std::function<void(VkCommandBuffer)> command)
 {
-	for (auto loaded_shader : loadedShaders)
+	if (aglRenderThread::IsCapturing())
 	{
-		loaded_shader->Recreate();
+		aglRenderThread::GetWriteSnapshot()->recordCommands.push_back(std::move(command));
+		return;
 	}
+
+	command(baseSurface->commandBuffer->GetCommandBuffer(currentFrame));
 }
 
-void agl::aglShaderFactory::ReloadShader(u32 id)
+void agl::aglFrameSnapshot::WriteBuffer(const std::vector<void*>& mapped, void* data, size_t dataSize)
 {
-	loadedShaders[id]->Recreate();
+	BufferWrite write;
+	std::copy(mapped.begin(), mapped.begin() + framesInFlight, write.mapped);
+	write.data.assign(static_cast<char*>(data), static_cast<char*>(data) + dataSize);
+
+	bufferWrites.push_back(std::move(write));
 }
 
-void agl::aglShaderFactory::SetupAllShaders()
+void agl::aglFrameSnapshot::Clear()
 {
-	for (auto loaded_shader : loadedShaders)
+	// Keeps the per-queue lists around so their capacity is reused
+	for (auto& [queue, entries] : queueEntries)
 	{
-		loaded_shader->Setup();
+		entries.clear();
 	}
+
+	bufferWrites.clear();
+	recordCommands.clear();
 }
 
-void agl::aglShaderFactory::InsertShader(aglShader* shader, u32 desiredId)
+void agl::aglRenderThread::Start()
 {
-	u32 id = desiredId;
-
-	if (id == -1)
+	if (running)
 	{
-		id = loadedShaders.size();
-		loadedShaders.resize(loadedShaders.size() + 1);
+		return;
 	}
 
-	shader->id = id;
-	loadedShaders[id] = (shader);
+	UpdateWindowExtent();
+
+	running = true;
+	thread = std::thread(Run);
 }
 
-agl::aglShader* agl::aglShaderFactory::GetShader(u32 id)
+void agl::aglRenderThread::Stop()
 {
-
-	if (loadedShaders.size() <= id || loadedShaders[id] == nullptr)
+	if (!running)
 	{
-		agl::aglShaderSettings shaderSettings = {
-			{
-				data["LoadedShaders"]["Settings"]["VertexPath"],
-				data["LoadedShaders"]["Settings"]["FragmentPath"],
-				data["LoadedShaders"]["Settings"]["GeometryPath"],
-				data["LoadedShaders"]["Settings"]["ComputePath"],
-			},
-			data["LoadedShaders"]["Settings"]["CullFlags"],
-			data["LoadedShaders"]["Settings"]["FrontFace"],
-			data["LoadedShaders"]["Settings"]["DepthCompare"],
-			data["LoadedShaders"]["Id"]
-		};
-		aglShader* shader = new aglShader(shaderSettings);
-
-		shader->Load(data["LoadedShaders"]);
+		return;
+	}
 
-		return shader;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
 	}
+	condition.notify_all();
 
-	return loadedShaders[id];
+	thread.join();
+
+	snapshots[0].Clear();
+	snapshots[1].Clear();
 }
 
-nlohmann::json agl::aglShaderFactory::Serialize()
+void agl::aglRenderThread::Publish()
 {
+	std::unique_lock<std::mutex> lock(mutex);
 
-	nlohmann::json j = json::object();
-
-	for (auto loaded_shader : loadedShaders)
+	// A render thread stuck on a minimized window needs this thread to keep the events coming
+	while (!condition.wait_for(lock, std::chrono::milliseconds(10), [] { return (!pending && !busy) || error; }))
 	{
-
-		if (loaded_shader->type == COMPUTE_FULL)
+		if (waitingForWindow)
 		{
-			continue;
+			lock.unlock();
+			SDL_PumpEvents();
+			UpdateWindowExtent();
+			lock.lock();
 		}
+	}
 
-		j["LoadedShaders"][loaded_shader->id] = loaded_shader->Serialize();
+	if (error)
+	{
+		std::rethrow_exception(error);
 	}
 
-	return j;
+	readIndex = writeIndex;
+	writeIndex ^= 1;
+	snapshots[writeIndex].Clear();
+	snapshots[writeIndex].viewProjection = snapshots[readIndex].viewProjection;
+	pending = true;
+
+	lock.unlock();
+	condition.notify_all();
 }
 
-void agl::aglShaderFactory::Load(nlohmann::json j)
+void agl::aglRenderThread::UpdateWindowExtent()
 {
-	data = j;
+	int width = 0, height = 0;
+	SDL_GetWindowSize(window, &width, &height);
 
-	loadedShaders.resize(j["LoadedShaders"].size());
+	windowWidth = static_cast<u32>(width);
+	windowHeight = static_cast<u32>(height);
 
-	for (auto s : j["LoadedShaders"])
+	if (width > 0 && height > 0)
 	{
-		if (loadedShaders[s["Id"]] == nullptr)
 		{
-			agl::aglShaderSettings shaderSettings = {
-				{
-					s["Settings"]["VertexPath"],
-					s["Settings"]["FragmentPath"],
-					s["Settings"]["GeometryPath"],
-					s["Settings"]["ComputePath"],
-				},
-				s["Settings"]["CullFlags"],
-				s["Settings"]["FrontFace"],
-				s["Settings"]["DepthCompare"],
-				s["Id"]
-			};
-			aglShader* shader = new aglShader(shaderSettings);
-
-			shader->Load(s);
+			std::lock_guard<std::mutex> lock(mutex);
+			waitingForWindow = false;
 		}
+		condition.notify_all();
 	}
 }
 
-void agl::aglShaderFactory::SetData(nlohmann::json j)
+bool agl::aglRenderThread::WaitForWindow()
 {
-	data = j;
+	std::unique_lock<std::mutex> lock(mutex);
+	waitingForWindow = true;
+	condition.wait(lock, [] { return !waitingForWindow || !running; });
+
+	return running;
 }
 
-void agl::aglShader::Setup()
+void agl::aglRenderThread::Run()
 {
+	while (true)
+	{
+		aglFrameSnapshot* snapshot;
 
-	ppBuffer = new aglUniformBuffer(this, { VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(PostProcessingSettings)});
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [] { return pending || !running; });
 
-	if (GetBindingByName("postProcessingSettings") != -1) {
-		ppBuffer->AttachToShader(this, GetBindingByName("postProcessingSettings"));
-	}
+			// Stopping still drains the last published frame
+			if (!pending)
+			{
+				return;
+			}
 
-	CreateDescriptorSetLayout();
+			snapshot = &snapshots[readIndex];
+			pending = false;
+			busy = true;
+		}
 
-	CreateDescriptorPool();
+		try
+		{
+			Consume(snapshot);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			error = std::current_exception();
+		}
 
-	// Graphics Pipeline
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy = false;
+		}
+		condition.notify_all();
 
-	if (compModule == nullptr) {
-		CreateGraphicsPipeline();
-	} else
-	{
-		CreateComputePipeline();
+		if (error)
+		{
+			return;
+		}
 	}
-
-	CreateDescriptorSet();
-
-	setup = true;
 }
 
-void agl::aglShader::Create()
+void agl::aglRenderThread::Consume(aglFrameSnapshot* snapshot)
 {
+	u32 imageIndex = baseSurface->GetNextImageIndex();
 
-	shaderStages.clear();
+	// The slot is free now, so its mapped buffers can take this frame's contents
+	for (auto& write : snapshot->bufferWrites)
+	{
+		memcpy(write.mapped[currentFrame], write.data.data(), write.data.size());
+	}
 
-	if (settings.paths.vertexPath != "") {
-		string path = settings.paths.vertexPath;
-		vertexCode = ReadString(path);
+	aglStreamingLoader::RefreshFrame();
 
-		if (ustring::hasEnding(path, "vert"))
-		{
-			vertexCode = CompileGLSLToSpirV(path);
-		}
+	// The queues are pushed as soon as recording starts
+	for (auto& [queue, entries] : snapshot->queueEntries)
+	{
+		queue->queueEntries.swap(entries);
+	}
+	aglRenderQueue::cullViewProjection = snapshot->viewProjection;
 
-		vertModule = new aglShaderLevel(vertexCode, VERTEX, this);
+	record_command_buffer(imageIndex);
 
-		shaderStages.push_back(vertModule->stageInfo);
-		type = VISUAL_FULL;
+	VkCommandBuffer cmdBuf = baseSurface->commandBuffer->GetCommandBuffer(currentFrame);
+
+	for (auto& command : snapshot->recordCommands)
+	{
+		command(cmdBuf);
 	}
 
-	if (settings.paths.fragmentPath != "") {
-		string path = settings.paths.fragmentPath;
-		fragmentCode = ReadString(path);
+	FinishRecordingCommandBuffer(imageIndex);
 
-		if (ustring::hasEnding(path, "frag"))
-		{
-			fragmentCode = CompileGLSLToSpirV(path);
-		}
+	PresentFrame(imageIndex);
 
-		fragModule = new aglShaderLevel(fragmentCode, FRAGMENT, this);
+	currentFrame = (currentFrame + 1) % framesInFlight;
+}
 
-		shaderStages.push_back(fragModule->stageInfo);
-		type = VISUAL_FULL;
-	}
+void agl::SetPresentMode(VkPresentModeKHR mode)
+{
+	details->presentMode = mode;
+	baseSurface->framebuffer->Resized = true;
+}
 
-	if (settings.paths.computePath != "") {
-		string path = settings.paths.computePath;
-		computeCode = ReadString(path);
+void agl::SetSwapchainImageCount(u32 count)
+{
+	details->swapchainImageCount = count;
+	baseSurface->framebuffer->Resized = true;
+}
 
-		if (ustring::hasEnding(path, "comp"))
-		{
-			computeCode = CompileGLSLToSpirV(path);
-		}
+void agl::SetFrameRateLimit(float framesPerSecond)
+{
+	details->targetFrameRate = framesPerSecond;
+	nextFrameDeadline = 0;
+}
 
-		compModule = new aglShaderLevel(computeCode, COMPUTE, this);
+VkPresentModeKHR agl::GetPresentMode()
+{
+	return activePresentMode;
+}
 
-		shaderStages.push_back(compModule->stageInfo);
-		type = COMPUTE_FULL;
+void agl::PaceFrame()
+{
+	if (details->targetFrameRate <= 0)
+	{
+		return;
 	}
 
+	const uint64_t frequency = SDL_GetPerformanceFrequency();
+	const uint64_t period = static_cast<uint64_t>(frequency / details->targetFrameRate);
+	// OS sleeps overshoot by up to a scheduler tick, the last stretch is spent yielding instead
+	const uint64_t spinWindow = frequency / 500;
 
-	for (int i = 0; i < descriptorWrites.size(); ++i)
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	// Resync instead of bursting frames to catch up after a hitch
+	if (nextFrameDeadline == 0 || now > nextFrameDeadline + period)
 	{
-		if (descriptorWrites[i].size() != ports.size()) {
-			descriptorWrites[i].resize(ports.size());
-		}
+		nextFrameDeadline = now;
+	}
+
+	while (now + spinWindow < nextFrameDeadline)
+	{
+		u32 ms = static_cast<u32>((nextFrameDeadline - now - spinWindow) * 1000 / frequency);
+		SDL_Delay(std::max(ms, 1u));
+		now = SDL_GetPerformanceCounter();
+	}
+
+	while (now < nextFrameDeadline)
+	{
+		std::this_thread::yield();
+		now = SDL_GetPerformanceCounter();
 	}
 
+	nextFrameDeadline += period;
 }
 
-agl::aglShader::aglShader(aglShaderSettings settings)
+void agl::record_command_buffer(u32 imageIndex)
 {
-	descriptorWrites.resize(MAX_FRAMES_IN_FLIGHT);
-	this->settings = settings;
+	baseSurface->commandBuffer->Begin(currentFrame);
 
-	aglShaderFactory::InsertShader(this, settings.desiredID);
+	// Acquires have to happen outside the render pass
+	FlushPendingAcquires(baseSurface->commandBuffer->GetCommandBuffer(currentFrame));
 
-	Create();
+	baseSurface->framebuffer->Bind(imageIndex, baseSurface->commandBuffer->GetCommandBuffer(currentFrame));
+
+	// Queued geometry goes first, so anything drawn directly during the frame (UI) ends up on top
+	baseSurface->framebuffer->renderPass->PushRenderQueue();
 }
 
-std::string agl::aglShader::CompileGLSLToSpirV(std::string path)
+void agl::FinishRecordingCommandBuffer(u32 imageIndex)
 {
+	VkCommandBuffer cmdBuf = baseSurface->commandBuffer->GetCommandBuffer(currentFrame);
 
-	static vector<string> compiledShaders;
+	baseSurface->framebuffer->renderPass->End(cmdBuf);
+	baseSurface->commandBuffer->End(currentFrame);
+}
 
-	string elevPath = ustring::substring(path, "resources/shaders/");
+void agl::PollEvent(SDL_Event event)
+{
+	if (event.type == SDL_QUIT)
+		closeWindow = true;
+	if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(agl::window))
+		closeWindow = true;
+}
 
-	if (ustring::hasEnding(elevPath, ".vert")) {
-		elevPath = ustring::substring(elevPath, ".vert");
-		elevPath += ".vert-spv";
-	}
 
-	if (ustring::hasEnding(elevPath, ".frag")) {
-		elevPath = ustring::substring(elevPath, ".frag");
-		elevPath += ".frag-spv";
-	}
+agl::aglShaderLevel::aglShaderLevel(string code, aglShaderType type, aglShader* parent)
+{
+	this->parent = parent;
 
-	if (ustring::hasEnding(elevPath, ".comp")) {
-		elevPath = ustring::substring(elevPath, ".comp");
-		elevPath += ".comp-spv";
-	}
+	VkShaderModuleCreateInfo createInfo{};
 
-	string spvPath = "compiled/shaders/" + elevPath;
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const u32*>(code.data());
 
-	if (std::find(compiledShaders.begin(), compiledShaders.end(), spvPath) == compiledShaders.end()) {
+	VkResult result = vkCreateShaderModule(device, &createInfo, nullptr, &module);
 
-		compiledShaders.push_back(spvPath);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shader module.");
+	}
 
-		filesystem::remove(spvPath);
+	SpvReflectShaderModule reflectModule;
 
-		filesystem::create_directory("compiled/");
-		filesystem::create_directory("compiled/shaders/");
+	SpvReflectResult reflectResult = spvReflectCreateShaderModule(code.size(), code.data(), &reflectModule);
 
-		filesystem::path fpath(spvPath);
+	assert(reflectResult == SPV_REFLECT_RESULT_SUCCESS);
 
-		filesystem::path parent = fpath.parent_path();
+	u32 descriptorSet_count = 0;
 
-		filesystem::create_directory(fpath.parent_path());
+	spvReflectEnumerateDescriptorSets(&reflectModule, &descriptorSet_count, NULL);
 
-		string sysCmd = "cd " + filesystem::current_path().string() + " && ";
+	SpvReflectDescriptorSet** descriptor_sets = (SpvReflectDescriptorSet**)malloc(descriptorSet_count * sizeof(SpvReflectDescriptorSet*));
 
-		sysCmd += "C:/VulkanSDK/1.3.250.0/Bin/glslc ";
+	spvReflectEnumerateDescriptorSets(&reflectModule, &descriptorSet_count, descriptor_sets);
 
-		sysCmd += path;
+	for (int i = 0; i < descriptorSet_count; ++i)
+	{
+		SpvReflectDescriptorSet* input_var = descriptor_sets[i];
 
-		sysCmd += " -o ";
+		for (int j = 0; j < input_var->binding_count; ++j)
+		{
+			SpvReflectDescriptorBinding* binding = input_var->bindings[j];
 
-		sysCmd += spvPath;
+			aglDescriptorPort* port = new aglDescriptorPort;
 
-		int retcode = system(sysCmd.c_str());
+			if (binding->descriptor_type == SPV_REFLECT_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+			{
+				port->texture = nullptr;
+			}
 
-		cout << "Compiled shader: " << spvPath << " Returned: " << retcode << endl;
+			port->type = static_cast<aglDescriptorType>(binding->descriptor_type);
+			port->name = binding->name;
+			port->binding = binding->binding;
+			port->set = binding->set;
+			port->count = binding->count;
 
-		if (retcode != 0) {
-			return "";
+			parent->ports.push_back(port);
+
+			cout << "Descriptor binding found: " << binding->name << " found at " << binding->binding << endl;
 		}
 
+
 	}
 
-	return ReadString(spvPath);
-}
+	spvReflectDestroyShaderModule(&reflectModule);
 
-u32 agl::aglShader::GetBindingByName(string n)
-{
-	for (aglDescriptorPort* port : ports)
-	{
-		if (port->name == n)
-		{
-			return port->binding;
-		}
-	}
+	VkPipelineShaderStageCreateInfo shaderStageInfo{};
+	shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStageInfo.stage = (VkShaderStageFlagBits)(type);
 
-	//throw new std::exception(("No binding found with name: " + n).c_str());
+	shaderStageInfo.module = module;
+	shaderStageInfo.pName = "main";
 
-	return -1;
+	stageInfo = shaderStageInfo;
 }
 
-void agl::aglShader::Destroy()
+void agl::aglShaderLevel::Destroy()
 {
-	if (fragModule) {
-		fragModule->Destroy();
-	}
-	if (vertModule) {
-		vertModule->Destroy();
-	}
-	if (compModule)
-	{
-		compModule->Destroy();
-		compModule = nullptr;
-	}
-
-	vkDestroyDescriptorSetLayout(GetDevice(), descriptorSetLayout, nullptr);
-	vkDestroyPipeline(GetDevice(), mainPipeline, nullptr);
+	vkDestroyShaderModule(device, module, nullptr);
 }
 
-void agl::aglShader::Recreate()
+agl::aglCommandBuffer::aglCommandBuffer()
 {
-	Destroy();
-	Create();
-	Setup();
+	// Command Pool
+	CreateCommandPool();
 }
 
-VkWriteDescriptorSet* agl::aglShader::CreateDescriptorSetWrite(int frame, int binding)
+void agl::aglCommandBuffer::Begin(u32 currentImage)
 {
-	auto write = new VkWriteDescriptorSet();
-	write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	write->dstBinding = binding;
-	write->dstArrayElement = 0;
-	write->descriptorCount = 1;
-	return write;
-}
 
-VkDescriptorSetLayout agl::aglShader::GetDescriptorSetLayout()
-{ return descriptorSetLayout; }
+	vkResetCommandBuffer(commandBuffers[currentImage], 0);
 
-VkDescriptorPool agl::aglShader::GetDescriptorPool()
-{ return descriptorPool; }
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = 0;
+	beginInfo.pInheritanceInfo = nullptr;
 
-void agl::aglShader::AttachDescriptorSetLayout(VkDescriptorSetLayoutBinding binding, int b)
-{
-	if (bindings.size() <= b)
+	if (vkBeginCommandBuffer(commandBuffers[currentImage], &beginInfo) != VK_SUCCESS)
 	{
-		bindings.resize(b + 1);
+		throw std::runtime_error("Failed to begin recording command buffer.");
 	}
-	bindings[b] = binding;
 }
 
-void agl::aglShader::AttachDescriptorPool(VkDescriptorPoolSize pool, int b)
+void agl::aglCommandBuffer::End(u32 currentImage)
 {
-	if (poolSizes.size() <= b)
+	VkResult result = vkEndCommandBuffer(commandBuffers[currentImage]);
+
+	if (result != VK_SUCCESS)
 	{
-		poolSizes.resize(b+1);
+		throw std::runtime_error("Failed to record command buffer.");
 	}
-	poolSizes[b] = pool;
 }
 
-void agl::aglShader::AttachDescriptorWrite(VkWriteDescriptorSet* write, int frame, int binding)
-{
-	descriptorWrites[frame][binding] = (*write);
-}
-
-void agl::aglShader::AttachDescriptorWrites(std::vector<VkWriteDescriptorSet*> writes, int frame)
+VkCommandBuffer agl::aglCommandBuffer::BeginSingleTimeCommands()
 {
-	int ctr = 0;
-	for (auto write : writes)
+	if (currentBufferUsed == VK_NULL_HANDLE) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = singleTimePool;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer vkCommandBuffer;
+		vkAllocateCommandBuffers(agl::device, &allocInfo, &vkCommandBuffer);
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		vkBeginCommandBuffer(vkCommandBuffer, &beginInfo);
+
+		currentBufferUsed = vkCommandBuffer;
+
+		return vkCommandBuffer;
+	} else
 	{
-		AttachDescriptorWrite(write, frame, ctr);
-		ctr++;
+		return currentBufferUsed;
 	}
 }
 
-void agl::aglShader::BindGraphicsPipeline(VkCommandBuffer commandBuffer)
+void agl::aglCommandBuffer::EndSingleTimeCommands(VkCommandBuffer vkCommandBuffer)
 {
-	if (pushConstant) {
-		vkCmdPushConstants(commandBuffer, GetPipelineLayout(), pushConstant->flags, 0, pushConstant->size, pushConstant->data);
-	}
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mainPipeline);
+	vkEndCommandBuffer(vkCommandBuffer);
 
-	ppBuffer->Update(&postProcessing, sizeof(postProcessing));
+	// Only wait for this submission rather than draining the whole queue
+	uint64_t value = timeline->Submit(agl::graphicsQueue, vkCommandBuffer);
+	timeline->Wait(value);
 
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GetPipelineLayout(), 0, 1, &descriptorSets[currentImage], 0, nullptr);
-}
+	vkFreeCommandBuffers(agl::device, singleTimePool, 1, &vkCommandBuffer);
+
+	currentBufferUsed = VK_NULL_HANDLE;
 
-VkPipelineLayout agl::aglShader::GetPipelineLayout()
-{
-	return pipelineLayout;
 }
 
-void agl::aglShader::CreateGraphicsPipeline()
+void agl::aglCommandBuffer::CreateCommandPool()
 {
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+	QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(physicalDevice);
 
-	auto bindingDesc = aglVertex::GetBindingDescription();
-	auto attributeDesc = aglVertex::GetAttributeDescriptions();
+	commandBuffers.resize(framesInFlight);
 
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<u32>(attributeDesc.size());
+	VkCommandPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDesc;
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDesc.data();
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create command pool.");
+	}
 
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.scissorCount = 1;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &singleTimePool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create command pool.");
+	}
+}
 
-	VkPipelineRasterizationStateCreateInfo rasterizer{};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = settings.cullFlags;
-	rasterizer.frontFace = settings.frontFace;
-	rasterizer.depthBiasEnable = VK_FALSE;
+void agl::aglCommandBuffer::CreateCommandBuffers()
+{
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = static_cast<u32>(commandBuffers.size());
 
-	VkPipelineMultisampleStateCreateInfo multisampling{};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate command buffers.");
+	}
+}
 
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_FALSE;
+void agl::aglCommandBuffer::Destroy()
+{
+	VkCommandPool pools[] = { commandPool, singleTimePool };
 
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
+	aglDeletionQueue::Push([pools]
+	{
+		vkDestroyCommandPool(device, pools[0], nullptr);
+		vkDestroyCommandPool(device, pools[1], nullptr);
+	});
 
-	VkPipelineDepthStencilStateCreateInfo depthStencil{};
-	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-	depthStencil.depthTestEnable = VK_TRUE;
-	depthStencil.depthWriteEnable = VK_TRUE;
-	depthStencil.depthCompareOp = settings.depthCompare;
-	depthStencil.depthBoundsTestEnable = VK_FALSE;
-	depthStencil.minDepthBounds = 0.0f;
-	depthStencil.maxDepthBounds = 1.f;
-	depthStencil.stencilTestEnable = VK_FALSE;
+	commandPool = VK_NULL_HANDLE;
+	singleTimePool = VK_NULL_HANDLE;
+	commandBuffers.clear();
+}
 
-	std::vector<VkDynamicState> dynamicStates = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_SCISSOR
-	};
-	VkPipelineDynamicStateCreateInfo dynamicState{};
-	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-	dynamicState.pDynamicStates = dynamicStates.data();
+void agl::aglStagingRing::Create(VkDeviceSize size)
+{
+	AddBlock(size);
+}
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+void agl::aglStagingRing::AddBlock(VkDeviceSize size)
+{
+	Block block;
+	block.size = size;
 
-	if (pushConstant) {
-		//setup push constants
-		VkPushConstantRange push_constant;
-		//this push constant range starts at the beginning
-		push_constant.offset = 0;
-		//this push constant range takes up the size of a MeshPushConstants struct
-		push_constant.size = pushConstant->size;
-		//this push constant range is accessible only in the vertex shader
-		push_constant.stageFlags = pushConstant->flags;
+	CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, block.buffer, block.memory, AGL_MEMORY_STAGING);
 
-		pipelineLayoutInfo.pPushConstantRanges = &push_constant;
-		pipelineLayoutInfo.pushConstantRangeCount = 1;
-	}
+	block.mapped = static_cast<char*>(block.memory.mapped);
 
-	if (vkCreatePipelineLayout(GetDevice(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	blocks.push_back(std::move(block));
+}
+
+void agl::aglStagingRing::Block::Reclaim()
+{
+	while (!regions.empty())
 	{
-		throw std::runtime_error("failed to create pipeline layout!");
-	}
+		Region& region = regions.front();
 
-	VkGraphicsPipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = shaderStages.size();
-	pipelineInfo.pStages = shaderStages.data();
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = &depthStencil; // Optional
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = &dynamicState;
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = settings.renderPass->renderPass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineInfo.basePipelineIndex = -1;
+		if (region.timeline == nullptr || !region.timeline->IsComplete(region.value))
+		{
+			break;
+		}
 
-	if (vkCreateGraphicsPipelines(GetDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mainPipeline) !=
-		VK_SUCCESS)
+		regions.pop_front();
+	}
+
+	if (regions.empty())
 	{
-		throw std::runtime_error("Failed to create graphics pipeline.");
+		head = 0;
 	}
 }
 
-void agl::aglShader::CreateComputePipeline()
+bool agl::aglStagingRing::Block::TryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
 {
+	Reclaim();
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	VkDeviceSize alignedHead = (head + alignment - 1) / alignment * alignment;
 
-	if (pushConstant) {
-		//setup push constants
-		VkPushConstantRange push_constant;
-		//this push constant range starts at the beginning
-		push_constant.offset = 0;
-		//this push constant range takes up the size of a MeshPushConstants struct
-		push_constant.size = pushConstant->size;
-		//this push constant range is accessible only in the vertex shader
-		push_constant.stageFlags = pushConstant->flags;
+	if (regions.empty())
+	{
+		if (size > this->size)
+		{
+			return false;
+		}
 
-		pipelineLayoutInfo.pPushConstantRanges = &push_constant;
-		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		offset = 0;
+		return true;
 	}
 
-	if (vkCreatePipelineLayout(GetDevice(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	VkDeviceSize tail = regions.front().begin;
+
+	if (head > tail)
 	{
-		throw std::runtime_error("failed to create pipeline layout!");
-	}
+		// Free space runs to the end of the block, then wraps to the start
+		if (alignedHead + size <= this->size)
+		{
+			offset = alignedHead;
+			return true;
+		}
 
-	VkComputePipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.stage = shaderStages[0];
+		if (size <= tail)
+		{
+			offset = 0;
+			return true;
+		}
 
-	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mainPipeline) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create compute pipeline!");
+		return false;
+	}
+
+	// Already wrapped, the free space ends at the oldest live region
+	if (alignedHead + size <= tail)
+	{
+		offset = alignedHead;
+		return true;
 	}
+
+	return false;
 }
 
-void agl::aglShader::CreateDescriptorSetLayout()
+agl::aglStagingRing::Allocation agl::aglStagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment)
 {
-	VkDescriptorSetLayoutCreateInfo layoutInfo{};
-	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = static_cast<u32>(bindings.size());
-	layoutInfo.pBindings = bindings.data();
+	std::lock_guard<std::mutex> lock(mutex);
 
-	VkResult result = vkCreateDescriptorSetLayout(GetDevice(), &layoutInfo, nullptr, &descriptorSetLayout);
+	VkDeviceSize offset = 0;
+	u32 blockIndex = 0;
 
-	if (result != VK_SUCCESS)
+	for (; blockIndex < blocks.size(); ++blockIndex)
 	{
-		throw std::runtime_error("Failed to create descriptor set layout!");
+		if (blocks[blockIndex].TryAllocate(size, alignment, offset))
+		{
+			break;
+		}
 	}
+
+	if (blockIndex == blocks.size())
+	{
+		VkDeviceSize blockSize = blocks.empty() ? size : blocks.back().size * 2;
+		AddBlock(std::max(blockSize, size));
+		offset = 0;
+	}
+
+	Block& block = blocks[blockIndex];
+
+	Region region{};
+	region.id = nextId++;
+	region.begin = offset;
+	region.end = offset + size;
+	block.regions.push_back(region);
+	block.head = region.end;
+
+	Allocation allocation{};
+	allocation.buffer = block.buffer;
+	allocation.offset = offset;
+	allocation.mapped = block.mapped + offset;
+	allocation.block = blockIndex;
+	allocation.id = region.id;
+
+	return allocation;
 }
 
-void agl::aglShader::CreateDescriptorPool()
+void agl::aglStagingRing::Retire(const std::vector<Allocation>& allocations, aglTimeline* timeline, uint64_t value)
 {
-	VkDescriptorPoolCreateInfo poolInfo{};
-
-	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
-	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
+	std::lock_guard<std::mutex> lock(mutex);
 
-	if (vkCreateDescriptorPool(GetDevice(), &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	for (const Allocation& allocation : allocations)
 	{
-		throw std::runtime_error("Failed to create descriptor pool.");
+		for (Region& region : blocks[allocation.block].regions)
+		{
+			if (region.id == allocation.id)
+			{
+				region.timeline = timeline;
+				region.value = value;
+				break;
+			}
+		}
 	}
 }
 
-void agl::aglShader::CreateDescriptorSet()
+void agl::aglStagingRing::Destroy()
 {
-	for (auto port : ports)
+	for (Block& block : blocks)
 	{
-		if (port->type == DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
-			aglTexture* texture = port->texture;
-			if (texture) {
-				for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-				{
+		vkDestroyBuffer(device, block.buffer, nullptr);
+		aglAllocator::Free(block.memory);
+	}
 
-					VkDescriptorImageInfo* imageInfo = new VkDescriptorImageInfo;
-					imageInfo->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-					imageInfo->imageView = texture->textureImageView;
-					imageInfo->sampler = texture->textureSampler;
+	blocks.clear();
+}
 
-					VkWriteDescriptorSet* descriptorWrite;
+agl::aglStagingRing::Allocation agl::aglUploadBatch::Stage(const void* data, VkDeviceSize size)
+{
+	aglStagingRing::Allocation allocation = aglStagingRing::Allocate(size);
 
-					descriptorWrite = CreateDescriptorSetWrite(i,port->binding);
-					descriptorWrite->descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-					descriptorWrite->pImageInfo = imageInfo;
+	memcpy(allocation.mapped, data, static_cast<size_t>(size));
 
-					AttachDescriptorWrite(descriptorWrite, i,port->binding);
-				}
-			}
-		}
+	staged.push_back(allocation);
 
-		if (port->type == DESCRIPTOR_TYPE_STORAGE_IMAGE) {
-			aglTexture* texture = port->texture;
-			if (texture) {
-				for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-				{
+	return allocation;
+}
 
-					VkDescriptorImageInfo* imageInfo = new VkDescriptorImageInfo;
-					imageInfo->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-					imageInfo->imageView = texture->textureImageView;
-					imageInfo->sampler = texture->textureSampler;
+void agl::aglUploadBatch::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+	RecordCopyBuffer(GetCommandBuffer(), srcBuffer, dstBuffer, size, srcOffset, dstOffset);
 
-					VkWriteDescriptorSet* descriptorWrite;
+	if (usesTransferQueue)
+	{
+		ReleaseBuffer(dstBuffer, dstOffset, size);
+		return;
+	}
 
-					descriptorWrite = CreateDescriptorSetWrite(i, port->binding);
-					descriptorWrite->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-					descriptorWrite->pImageInfo = imageInfo;
+	// On the graphics queue the copy still has to be made visible to the frames that read it
+	VkBufferMemoryBarrier barrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = dstBuffer;
+	barrier.offset = dstOffset;
+	barrier.size = size;
 
-					AttachDescriptorWrite(descriptorWrite, i, port->binding);
-				}
-			}
+	vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void agl::aglUploadBatch::CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 height, u32 regionCount, VkBufferImageCopy* regions)
+{
+	RecordCopyBufferToImage(GetCommandBuffer(), buffer, image, width, height, regionCount, regions);
+}
+
+void agl::aglUploadBatch::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, u32 mipCount)
+{
+	VkCommandBuffer cmdBuf = GetCommandBuffer();
+
+	// The transfer queue can only wait on transfer stages, so the transition out of
+	// TRANSFER_DST doubles as the ownership transfer and completes on the graphics queue
+	if (usesTransferQueue && oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+	{
+		ReleaseImage(image, oldLayout, newLayout, layerCount, mipCount);
+		return;
+	}
+
+	RecordTransitionImageLayout(cmdBuf, image, format, oldLayout, newLayout, layerCount, mipCount);
+}
+
+void agl::aglUploadBatch::ReleaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	VkBufferMemoryBarrier barrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+	barrier.srcQueueFamilyIndex = transferFamily;
+	barrier.dstQueueFamilyIndex = graphicsFamily;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	acquires.buffers.push_back(barrier);
+}
+
+void agl::aglUploadBatch::ReleaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, u32 mipCount)
+{
+	VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = transferFamily;
+	barrier.dstQueueFamilyIndex = graphicsFamily;
+	barrier.image = image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipCount, 0, static_cast<u32>(layerCount) };
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	acquires.images.push_back(barrier);
+}
+
+VkCommandBuffer agl::aglUploadBatch::GetCommandBuffer()
+{
+	if (recording != VK_NULL_HANDLE)
+	{
+		return recording;
+	}
+
+	if (commandPool == VK_NULL_HANDLE)
+	{
+		QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(physicalDevice);
+
+		usesTransferQueue = background && HasTransferQueue();
+		submitTimeline = usesTransferQueue ? transferTimeline : timeline;
+		graphicsFamily = queueFamilyIndices.graphicsFamily.value();
+		transferFamily = queueFamilyIndices.transferFamily.value_or(graphicsFamily);
+
+		VkCommandPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = usesTransferQueue ? transferFamily : graphicsFamily;
+
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create upload command pool.");
 		}
 	}
 
-	vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, GetDescriptorSetLayout());
-	VkDescriptorSetAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = GetDescriptorPool();
-	allocInfo.descriptorSetCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
-	allocInfo.pSetLayouts = layouts.data();
+	// Reuse a command buffer whose last submission has finished
+	for (auto& commandBuffer : commandBuffers)
+	{
+		if (commandBuffer.token != UINT64_MAX && submitTimeline->IsComplete(commandBuffer.token))
+		{
+			recording = commandBuffer.commandBuffer;
+			commandBuffer.token = UINT64_MAX;
+			vkResetCommandBuffer(recording, 0);
+			break;
+		}
+	}
 
-	descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-	if (vkAllocateDescriptorSets(GetDevice(), &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+	if (recording == VK_NULL_HANDLE)
 	{
-		throw std::runtime_error("Failed to allocate descriptor sets.");
+		VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = commandPool;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &recording) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate upload command buffer.");
+		}
+
+		commandBuffers.push_back({ recording, UINT64_MAX });
 	}
 
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(recording, &beginInfo);
+
+	return recording;
+}
+
+uint64_t agl::aglUploadBatch::Submit()
+{
+	if (recording == VK_NULL_HANDLE)
 	{
-		vector<VkWriteDescriptorSet> writes(descriptorWrites[i].size());
-		int ctr = 0;
-		for (VkWriteDescriptorSet descriptor_write : descriptorWrites[i])
+		return token;
+	}
+
+	vkEndCommandBuffer(recording);
+
+	token = submitTimeline->Submit(usesTransferQueue ? transferQueue : graphicsQueue, recording);
+
+	for (auto& commandBuffer : commandBuffers)
+	{
+		if (commandBuffer.commandBuffer == recording)
 		{
-			descriptor_write.dstSet = descriptorSets[i];
-			descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				
-			writes[ctr] = descriptor_write;
-			ctr++;
+			commandBuffer.token = token;
 		}
+	}
 
-		vkUpdateDescriptorSets(GetDevice(), static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+	aglStagingRing::Retire(staged, submitTimeline, token);
+	staged.clear();
+
+	if (!acquires.buffers.empty() || !acquires.images.empty())
+	{
+		acquires.transferValue = token;
+
+		std::lock_guard<std::mutex> lock(acquireMutex);
+		pendingAcquires.push_back(std::move(acquires));
+		acquires = aglPendingAcquire{};
 	}
 
+	recording = VK_NULL_HANDLE;
+
+	return token;
 }
 
-nlohmann::json agl::aglShader::Serialize()
+bool agl::aglUploadBatch::IsComplete()
 {
-	nlohmann::json j = json::object();
+	return submitTimeline == nullptr || submitTimeline->IsComplete(token);
+}
 
-	j["Id"] = id;
+void agl::aglUploadBatch::Wait()
+{
+	if (submitTimeline == nullptr)
+	{
+		return;
+	}
 
-	j["Settings"] = {
-		{"VertexPath", settings.paths.vertexPath},
-		{"FragmentPath", settings.paths.fragmentPath},
-		{"GeometryPath", settings.paths.geometryPath},
-		{"ComputePath", settings.paths.computePath},
-		{"CullFlags", settings.cullFlags},
-		{"DepthCompare", settings.depthCompare},
-		{"FrontFace", settings.frontFace},
-		
-	};
+	submitTimeline->Wait(token);
+}
 
-	for (auto port : ports)
+void agl::aglUploadBatch::Destroy()
+{
+	Submit();
+	Wait();
+
+	if (commandPool != VK_NULL_HANDLE)
 	{
-		nlohmann::json p;
+		vkDestroyCommandPool(device, commandPool, nullptr);
+		commandPool = VK_NULL_HANDLE;
+	}
+	commandBuffers.clear();
+}
 
-		p["Set"] = port->set;
-		p["Binding"] = port->binding;
-		p["Count"] = port->count;
-		p["Type"] = port->type;
-		p["Name"] = port->name;
- 
-		if (port->texture)
+void agl::FlushPendingAcquires(VkCommandBuffer cmdBuf)
+{
+	std::lock_guard<std::mutex> lock(acquireMutex);
+
+	for (auto& acquire : pendingAcquires)
+	{
+		vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+			static_cast<u32>(acquire.buffers.size()), acquire.buffers.data(),
+			static_cast<u32>(acquire.images.size()), acquire.images.data());
+
+		pendingTransferValue = std::max(pendingTransferValue, acquire.transferValue);
+	}
+
+	pendingAcquires.clear();
+}
+
+agl::aglRenderQueue::aglRenderQueue(aglRenderPass* pass)
+{
+	this->pass = pass;
+}
+
+void agl::aglRenderQueue::AttachQueueEntry(aglRenderQueueEntry entry)
+{
+	if (entry.lod < 0)
+	{
+		entry.lod = static_cast<int>(SelectLod(entry.mesh, entry.transform));
+	}
+
+	entry.depth = glm::length(vec3(entry.transform * vec4(entry.mesh->boundsCenter, 1.0f)) - cameraPosition);
+
+	if (aglRenderThread::IsCapturing())
+	{
+		aglRenderThread::GetWriteSnapshot()->queueEntries[this].push_back(entry);
+		return;
+	}
+
+	queueEntries.push_back(entry);
+}
+
+void agl::aglRenderQueue::AttachQueueEntries(const aglRenderQueueEntry* entries, size_t count)
+{
+	cullingArray.Clear();
+
+	// Only instanced shaders draw at the entry transform, anything else passes through
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (entries[i].shader->settings.instanced)
 		{
-			p["Texture"] = port->texture->id;
+			cullingArray.Add(entries[i].mesh->GetBoundingSphere(entries[i].transform));
 		}
-		j["Ports"][port->binding] = p;
 	}
 
-	return j;
+	CullSpheres(cullingArray, cullingVisible);
+
+	size_t sphere = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!entries[i].shader->settings.instanced || cullingVisible[sphere++])
+		{
+			AttachQueueEntry(entries[i]);
+		}
+	}
 }
 
-void agl::aglShader::Load(nlohmann::json j)
+void agl::aglRenderQueue::Push()
 {
-	agl::aglShaderSettings shaderSettings = {
-	{
-		j["Settings"]["VertexPath"],
-		j["Settings"]["FragmentPath"],
-		j["Settings"]["GeometryPath"],
-		j["Settings"]["ComputePath"],
-	},
-	j["Settings"]["CullFlags"],
-	j["Settings"]["FrontFace"],
-	j["Settings"]["DepthCompare"],
-		j["Id"]
-	};
+	if (!disabled) {
+		VkCommandBuffer cmdBuf = pass->commandBuffer->GetCommandBuffer(agl::currentFrame);
 
-	settings = shaderSettings;
+		BuildSortKeys();
 
-	for (auto port : j["Ports"])
+		if (sorted)
+		{
+			RadixSort(sortItems, sortScratch);
+		}
+
+		BuildDraws();
+
+		if (!instances.empty())
+		{
+			// Bound once, every draw reaches its instances through firstInstance
+			VkBuffer instanceBuffer;
+			VkDeviceSize instanceOffset;
+			WriteFrameBuffer(instanceBuffers[currentFrame], VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, instances.data(),
+			                 sizeof(aglInstanceData) * instances.size(), instanceBuffer, instanceOffset);
+
+			vkCmdBindVertexBuffers(cmdBuf, AGL_INSTANCE_BINDING, 1, &instanceBuffer, &instanceOffset);
+		}
+
+		if (indirect)
+		{
+			EmitIndirect(cmdBuf);
+
+			if (culler)
+			{
+				culler->Dispatch();
+			}
+		}
+		else
+		{
+			EmitDirect(cmdBuf, 0, draws.size());
+		}
+	}
+
+	queueEntries.clear();
+}
+
+void agl::aglRenderQueue::BuildDraws()
+{
+	draws.clear();
+	instances.clear();
+
+	for (size_t i = 0; i < sortItems.size();)
 	{
-		if (port.contains("Texture"))
+		const aglRenderQueueEntry& entry = queueEntries[sortItems[i].entry];
+		size_t runEnd = i + 1;
+
+		if (entry.shader->settings.instanced)
 		{
-			cout << "Processing port: " << port["Name"] << endl;
-			AttachTexture(aglTextureFactory::GetTexture(port["Texture"]), port["Binding"]);
+			// Sorting puts entries with the same shader, mesh and LOD next to each other
+			while (runEnd < sortItems.size())
+			{
+				const aglRenderQueueEntry& next = queueEntries[sortItems[runEnd].entry];
+
+				if (next.shader != entry.shader || next.mesh != entry.mesh || next.lod != entry.lod)
+				{
+					break;
+				}
+
+				runEnd++;
+			}
+
+			draws.push_back({ &entry, static_cast<u32>(std::max(entry.lod, 0)), static_cast<u32>(runEnd - i), static_cast<u32>(instances.size()) });
+
+			for (size_t j = i; j < runEnd; ++j)
+			{
+				const aglRenderQueueEntry& instance = queueEntries[sortItems[j].entry];
+				instances.push_back({ instance.transform, instance.materialIndex });
+			}
+		}
+		else
+		{
+			draws.push_back({ &entry, static_cast<u32>(std::max(entry.lod, 0)), 1, 0 });
 		}
+
+		i = runEnd;
 	}
 }
 
-void agl::aglShader::AttachTexture(aglTexture* texture, u32 binding)
+void agl::aglRenderQueue::EmitDirect(VkCommandBuffer cmdBuf, size_t first, size_t last)
 {
+	// Consecutive draws mostly share state after sorting, only what changes is bound
+	aglShader* boundShader = nullptr;
+	u32 boundPage = UINT32_MAX;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
 
-	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-	samplerLayoutBinding.binding = binding;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	for (size_t i = first; i < last; ++i)
+	{
+		const Draw& draw = draws[i];
+		aglMesh* mesh = draw.entry->mesh;
+
+		if (draw.entry->shader != boundShader)
+		{
+			boundShader = draw.entry->shader;
+			boundShader->BindGraphicsPipeline(cmdBuf);
+		}
 
+		if (mesh->vertexRange.page != boundPage || mesh->indexType != boundIndexType)
+		{
+			boundPage = mesh->vertexRange.page;
+			boundIndexType = mesh->indexType;
+			aglMeshArena::Bind(cmdBuf, boundPage, boundIndexType);
+		}
 
-	VkDescriptorPoolSize samplerPoolSize{};
+		mesh->DrawBound(cmdBuf, draw.lod, draw.instanceCount, draw.firstInstance);
 
-	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerPoolSize.descriptorCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
+		if (mesh->format.splitPosition)
+		{
+			boundPage = UINT32_MAX;
+		}
+	}
+}
 
-	AttachDescriptorPool(samplerPoolSize, binding);
-	AttachDescriptorSetLayout(samplerLayoutBinding,binding);
+void agl::aglRenderQueue::EmitIndirect(VkCommandBuffer cmdBuf)
+{
+	// Split formats bind per-mesh stream offsets, which an indirect command can't express
+	auto canBatch = [](const Draw& draw)
+	{
+		return !draw.entry->mesh->format.splitPosition && (!draw.entry->shader->settings.instanced || drawIndirectFirstInstanceSupported);
+	};
 
-	if (binding != -1)
+	for (size_t i = 0; i < draws.size();)
 	{
+		const Draw& draw = draws[i];
 
-		ports[binding]->texture = texture;
+		if (!canBatch(draw))
+		{
+			EmitDirect(cmdBuf, i, i + 1);
+			i++;
+			continue;
+		}
+
+		aglShader* shader = draw.entry->shader;
+		aglMesh* mesh = draw.entry->mesh;
+
+		size_t groupEnd = i;
+		while (groupEnd < draws.size())
+		{
+			const Draw& next = draws[groupEnd];
+			const aglMesh* nextMesh = next.entry->mesh;
+
+			if (next.entry->shader != shader || nextMesh->vertexRange.page != mesh->vertexRange.page ||
+				nextMesh->indexType != mesh->indexType || !canBatch(next))
+			{
+				break;
+			}
+
+			groupEnd++;
+		}
+
+		shader->BindGraphicsPipeline(cmdBuf);
+		aglMeshArena::Bind(cmdBuf, mesh->vertexRange.page, mesh->indexType);
+
+		// Only instanced shaders read the transform the spheres are built from, other groups draw unculled
+		if (culler && shader->settings.instanced && EmitCulled(cmdBuf, i, groupEnd))
+		{
+			i = groupEnd;
+			continue;
+		}
+
+		indirectCommands.clear();
+
+		for (size_t d = i; d < groupEnd; ++d)
+		{
+			const Draw& next = draws[d];
+			indirectCommands.push_back(next.entry->mesh->GetDrawCommand(next.lod, next.instanceCount, next.firstInstance));
+		}
+
+		VkBuffer indirectBuffer;
+		VkDeviceSize indirectOffset;
+		WriteFrameBuffer(indirectBuffers[currentFrame], VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, indirectCommands.data(),
+		                 sizeof(VkDrawIndexedIndirectCommand) * indirectCommands.size(), indirectBuffer, indirectOffset);
+
+		u32 commandCount = static_cast<u32>(indirectCommands.size());
+
+		if (multiDrawIndirectSupported)
+		{
+			vkCmdDrawIndexedIndirect(cmdBuf, indirectBuffer, indirectOffset, commandCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			for (u32 c = 0; c < commandCount; ++c)
+			{
+				vkCmdDrawIndexedIndirect(cmdBuf, indirectBuffer, indirectOffset + sizeof(VkDrawIndexedIndirectCommand) * c, 1, 0);
+			}
+		}
+
+		i = groupEnd;
+	}
+}
+
+bool agl::aglRenderQueue::EmitCulled(VkCommandBuffer cmdBuf, size_t first, size_t last)
+{
+	cullObjects.clear();
+
+	for (size_t i = first; i < last; ++i)
+	{
+		const Draw& draw = draws[i];
+		const aglMesh* mesh = draw.entry->mesh;
+
+		// Draws are split so every instance is tested on its own
+		for (u32 j = 0; j < draw.instanceCount; ++j)
+		{
+			aglCullObject object{};
+			object.sphere = mesh->GetBoundingSphere(instances[draw.firstInstance + j].transform);
+			object.command = mesh->GetDrawCommand(draw.lod, 1, draw.firstInstance + j);
+
+			cullObjects.push_back(object);
+		}
+	}
+
+	return culler->Draw(cmdBuf, cullObjects.data(), static_cast<u32>(cullObjects.size()));
+}
+
+void agl::aglRenderQueue::ResetFrameBuffers(u32 frame)
+{
+	instanceBuffers[frame].cursor = 0;
+	indirectBuffers[frame].cursor = 0;
+}
+
+void agl::aglRenderQueue::DestroyFrameBuffers()
+{
+	for (u32 frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+	{
+		for (FrameBuffer* frameBuffer : { &instanceBuffers[frame], &indirectBuffers[frame] })
+		{
+			if (frameBuffer->buffer != VK_NULL_HANDLE)
+			{
+				vkDestroyBuffer(device, frameBuffer->buffer, nullptr);
+				aglAllocator::Free(frameBuffer->memory);
+			}
+
+			*frameBuffer = {};
+		}
+	}
+}
+
+void agl::aglRenderQueue::WriteFrameBuffer(FrameBuffer& frameBuffer, VkBufferUsageFlags usage, const void* data, VkDeviceSize size,
+	VkBuffer& buffer, VkDeviceSize& offset)
+{
+	// Instance attributes and indirect commands are both fine at 16 bytes
+	VkDeviceSize start = (frameBuffer.cursor + 15) & ~VkDeviceSize(15);
+
+	if (start + size > frameBuffer.capacity)
+	{
+		// Draws recorded earlier this frame keep reading the old buffer until the GPU is done with it
+		if (frameBuffer.buffer != VK_NULL_HANDLE)
+		{
+			aglDeletionQueue::Push([oldBuffer = frameBuffer.buffer, oldMemory = frameBuffer.memory]() mutable
+			{
+				vkDestroyBuffer(device, oldBuffer, nullptr);
+				aglAllocator::Free(oldMemory);
+			});
+		}
+
+		frameBuffer.capacity = std::max(std::max(frameBuffer.capacity * 2, size), VkDeviceSize(64 * 1024));
+		start = 0;
+
+		CreateBuffer(frameBuffer.capacity, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		             frameBuffer.buffer, frameBuffer.memory, AGL_MEMORY_OTHER);
+	}
+
+	memcpy(static_cast<uint8_t*>(frameBuffer.memory.mapped) + start, data, static_cast<size_t>(size));
+
+	buffer = frameBuffer.buffer;
+	offset = start;
+	frameBuffer.cursor = start + size;
+}
+
+void agl::aglRenderQueue::BuildSortKeys()
+{
+	sortItems.resize(queueEntries.size());
+
+	// Dense ids in first use order, so they fit their fields regardless of how many shaders and meshes exist
+	std::unordered_map<aglShader*, uint64_t> pipelineIds;
+	std::unordered_map<aglMesh*, uint64_t> meshIds;
+
+	for (size_t i = 0; i < queueEntries.size(); ++i)
+	{
+		const aglRenderQueueEntry& entry = queueEntries[i];
+
+		uint64_t pipeline = pipelineIds.insert({ entry.shader, pipelineIds.size() }).first->second & 0xffff;
+		// 12 bits of mesh and 4 of LOD, so instanceable entries end up next to each other
+		uint64_t mesh = ((meshIds.insert({ entry.mesh, meshIds.size() }).first->second & 0xfff) << 4) | (std::max(entry.lod, 0) & 0xf);
+		uint64_t buffers = ((uint64_t(entry.mesh->vertexRange.page) << 1) | (entry.mesh->indexType == VK_INDEX_TYPE_UINT32 ? 1 : 0)) & 0xfff;
+		uint64_t layer = std::min<uint64_t>(entry.layer, 15);
+
+		// The top bits of a positive float keep its order
+		uint32_t depthBits;
+		float depth = std::max(entry.depth, 0.0f);
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+		uint64_t depthKey = depthBits >> 16;
+
+		uint64_t key;
+		if (entry.layer >= AGL_RENDER_LAYER_TRANSPARENT)
+		{
+			key = (layer << 60) | ((0xffff - depthKey) << 44) | (pipeline << 28) | (buffers << 16) | mesh;
+		}
+		else
+		{
+			key = (layer << 60) | (pipeline << 44) | (buffers << 32) | (mesh << 16) | depthKey;
+		}
+
+		sortItems[i] = { key, static_cast<u32>(i) };
+	}
+}
+
+void agl::aglRenderQueue::RadixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch)
+{
+	if (items.size() < 2)
+	{
+		return;
+	}
+
+	scratch.resize(items.size());
+
+	uint64_t differing = 0;
+	for (const SortItem& item : items)
+	{
+		differing |= item.key ^ items[0].key;
+	}
+
+	for (u32 shift = 0; shift < 64; shift += 8)
+	{
+		if (((differing >> shift) & 0xff) == 0)
+		{
+			continue;
+		}
+
+		u32 offsets[256] = {};
+		for (const SortItem& item : items)
+		{
+			offsets[(item.key >> shift) & 0xff]++;
+		}
+
+		u32 sum = 0;
+		for (u32& offset : offsets)
+		{
+			u32 count = offset;
+			offset = sum;
+			sum += count;
+		}
+
+		for (const SortItem& item : items)
+		{
+			scratch[offsets[(item.key >> shift) & 0xff]++] = item;
+		}
+
+		items.swap(scratch);
+	}
+}
+
+void agl::aglRenderQueue::SetCamera(const glm::mat4& view, const glm::mat4& projection, float viewportHeight)
+{
+	cameraPosition = vec3(glm::inverse(view)[3]);
+	cameraOrthographic = projection[3][3] == 1.0f;
+	cameraProjectionScale = std::abs(projection[1][1]) * viewportHeight * 0.5f;
+
+	// The render thread records a frame behind, it picks the camera up from the snapshot
+	if (aglRenderThread::IsCapturing())
+	{
+		aglRenderThread::GetWriteSnapshot()->viewProjection = projection * view;
+	}
+	else
+	{
+		cullViewProjection = projection * view;
+	}
+
+	aglCullingArray::ExtractFrustumPlanes(projection * view, cameraFrustum);
+	cameraFrustumSet = true;
+}
+
+void agl::aglRenderQueue::CullSpheres(const aglCullingArray& spheres, std::vector<uint8_t>& visible)
+{
+	if (!cameraFrustumSet)
+	{
+		visible.assign(spheres.Size(), 1);
+		return;
+	}
+
+	spheres.Cull(cameraFrustum, visible);
+}
+
+u32 agl::aglRenderQueue::SelectLod(const aglMesh* mesh, const glm::mat4& transform)
+{
+	if (mesh->lods.size() <= 1 || cameraProjectionScale <= 0.0f)
+	{
+		return 0;
+	}
+
+	float scale = std::max(glm::length(vec3(transform[0])), std::max(glm::length(vec3(transform[1])), glm::length(vec3(transform[2]))));
+	float pixelsPerUnit = cameraProjectionScale;
+
+	if (!cameraOrthographic)
+	{
+		vec3 center = vec3(transform * vec4(mesh->boundsCenter, 1.0f));
+		float distance = glm::length(center - cameraPosition) - mesh->boundsRadius * scale;
+
+		// Inside the bounds, nothing but the full mesh is safe
+		if (distance <= 0.0f)
+		{
+			return 0;
+		}
+
+		pixelsPerUnit /= distance;
+	}
+
+	float allowedPixels = lodPixelError * std::exp2(lodBias);
+	u32 lod = 0;
+
+	for (u32 i = 1; i < mesh->lods.size(); ++i)
+	{
+		if (mesh->lods[i].error * scale * pixelsPerUnit > allowedPixels)
+		{
+			break;
+		}
+
+		lod = i;
+	}
+
+	return lod;
+}
+
+agl::aglRenderPass::aglRenderPass(aglFramebuffer* framebuffer, aglRenderPassSettings settings)
+{
+	this->framebuffer = framebuffer;
+	this->renderQueue = new aglRenderQueue(this);
+
+	CreateRenderPass(settings);
+}
+
+void agl::aglRenderPass::AttachToCommandBuffer(aglCommandBuffer* buffer)
+{
+	commandBuffer = buffer;
+}
+
+void agl::aglRenderPass::Begin(u32 imageIndex, VkCommandBuffer cmdBuf)
+{
+	VkRenderPassBeginInfo renderPassInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = framebuffer->framebuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = framebuffer->extent;
+
+	array<VkClearValue, 2> clearValues{};
+
+	clearValues[0].color = { 0.2f,0.3f,0.3f,1.0f };
+	clearValues[1].depthStencil = { 1.0f,0 };
+
+	renderPassInfo.clearValueCount = cast(clearValues.size(), u32);
+	renderPassInfo.pClearValues = clearValues.data();
+
+	vkCmdBeginRenderPass(cmdBuf, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(framebuffer->extent.width);
+	viewport.height = static_cast<float>(framebuffer->extent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = framebuffer->extent;
+	vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
+}
+
+void agl::aglRenderPass::PushRenderQueue()
+{
+	renderQueue->Push();
+}
+
+void agl::aglRenderPass::End(VkCommandBuffer cmdBuf)
+{
+	vkCmdEndRenderPass(cmdBuf);
+}
+
+void agl::aglRenderPass::CreateRenderPass(aglRenderPassSettings settings)
+{
+	VkAttachmentDescription colorAttachment{};
+	colorAttachment.format = framebuffer->imageFormat;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.finalLayout = settings.colorAttachmentLayout;
+
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = FindDepthFormat();
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depthAttachmentRef{ 1,VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference colorAttachmentRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+	array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+	VkRenderPassCreateInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = cast(attachments.size(), u32);
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = settings.dependencies.size();
+	renderPassInfo.pDependencies = settings.dependencies.data();
+
+	VkResult result = vkCreateRenderPass(GetDevice(), &renderPassInfo, nullptr, &renderPass);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create render pass.");
+	}
+}
+
+void agl::DisableRenderQueue()
+{
+	baseSurface->framebuffer->renderPass->renderQueue->disabled = true;
+}
+
+agl::aglSwapchain::aglSwapchain()
+{
+	fbo = new aglFramebuffer();
+	CreateSwapChain();
+	fbo->CreateFramebuffers({VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
+}
+
+void agl::aglSwapchain::CreateSwapChain(VkSwapchainKHR oldSwapchain)
+{
+	SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+
+	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
+	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+	VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
+
+	activePresentMode = presentMode;
+
+	u32 imageCount = swapChainSupport.capabilities.minImageCount + 1;
+
+	if (details->swapchainImageCount != 0)
+	{
+		imageCount = std::max(details->swapchainImageCount, swapChainSupport.capabilities.minImageCount);
+	}
+
+	if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+	{
+		imageCount = swapChainSupport.capabilities.maxImageCount;
+	}
+
+	VkSwapchainCreateInfoKHR createInfo{};
+
+	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	createInfo.surface = surface;
+
+	createInfo.minImageCount = imageCount;
+	createInfo.imageFormat = surfaceFormat.format;
+	createInfo.imageColorSpace = surfaceFormat.colorSpace;
+	createInfo.imageExtent = extent;
+	createInfo.imageArrayLayers = 1;
+	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
+	uint32_t queueFamilyIndices[ ] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+
+	if (indices.graphicsFamily != indices.presentFamily)
+	{
+		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = 2;
+		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+	else
+	{
+		createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createInfo.queueFamilyIndexCount = 0; // Optional
+		createInfo.pQueueFamilyIndices = nullptr; // Optional
+	}
+
+	createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+
+	createInfo.presentMode = presentMode;
+	createInfo.clipped = VK_TRUE;
+
+	// Lets the driver reuse the old images and keep presenting them while this one is built
+	createInfo.oldSwapchain = oldSwapchain;
+
+	VkResult result = vkCreateSwapchainKHR(GetDevice(), &createInfo, nullptr, &swapChain);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create swapchain.");
+	}
+
+	vkGetSwapchainImagesKHR(GetDevice(), swapChain, &imageCount, nullptr);
+	fbo->images.resize(imageCount);
+	vkGetSwapchainImagesKHR(GetDevice(), swapChain, &imageCount, fbo->images.data());
+
+	fbo->extent = extent;
+	fbo->imageFormat = surfaceFormat.format;
+}
+
+void agl::aglSwapchain::Destroy()
+{
+	fbo->Destroy();
+	vkDestroySwapchainKHR(device, swapChain, nullptr);
+}
+
+void agl::aglSwapchain::Recreate()
+{
+	fbo->WaitForValidExtent();
+
+	VkSwapchainKHR oldSwapchain = swapChain;
+
+	// Everything submitted so far may still reference the old swapchain
+	RetiredSurfaceResources retired;
+	retired.swapchain = oldSwapchain;
+	fbo->Retire(retired);
+	aglDeletionQueue::Push(timeline->GetLastSubmitted(), [retired]() mutable { retired.Destroy(); });
+
+	CreateSwapChain(oldSwapchain);
+	fbo->Recreate();
+}
+
+void agl::RetiredSurfaceResources::Destroy()
+{
+	for (auto framebuffer : framebuffers)
+	{
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+	}
+
+	for (auto image_view : imageViews)
+	{
+		vkDestroyImageView(device, image_view, nullptr);
+	}
+
+	vkDestroyImageView(device, depthImageView, nullptr);
+	vkDestroyImage(device, depthImage, nullptr);
+	aglAllocator::Free(depthImageMemory);
+
+	vkDestroySwapchainKHR(device, swapchain, nullptr);
+}
+
+void agl::aglDeletionQueue::Push(std::function<void()> destroy)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// The render thread may still have to record the snapshot that references the object
+	u32 submissions = aglRenderThread::IsActive() ? 2 : 1;
+	pending.push_back({ submissions, std::move(destroy) });
+}
+
+void agl::aglDeletionQueue::Push(uint64_t timelineValue, std::function<void()> destroy)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	entries.push_back({ timelineValue, std::move(destroy) });
+}
+
+void agl::aglDeletionQueue::OnFrameSubmitted(uint64_t frameValue)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto entry = pending.begin();
+	while (entry != pending.end())
+	{
+		if (--entry->submissions == 0)
+		{
+			entries.push_back({ frameValue, std::move(entry->destroy) });
+			entry = pending.erase(entry);
+		}
+		else
+		{
+			++entry;
+		}
+	}
+}
+
+void agl::aglDeletionQueue::Collect()
+{
+	std::vector<std::function<void()>> ready;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto entry = entries.begin();
+		while (entry != entries.end())
+		{
+			if (timeline->IsComplete(entry->timelineValue))
+			{
+				ready.push_back(std::move(entry->destroy));
+				entry = entries.erase(entry);
+			}
+			else
+			{
+				++entry;
+			}
+		}
+	}
+
+	for (auto& destroy : ready)
+	{
+		destroy();
+	}
+}
+
+void agl::aglDeletionQueue::Flush()
+{
+	std::vector<std::function<void()>> ready;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& entry : pending)
+		{
+			ready.push_back(std::move(entry.destroy));
+		}
+
+		for (auto& entry : entries)
+		{
+			ready.push_back(std::move(entry.destroy));
+		}
+
+		pending.clear();
+		entries.clear();
+	}
+
+	for (auto& destroy : ready)
+	{
+		destroy();
+	}
+}
+
+agl::aglFramebuffer::aglFramebuffer()
+{
+
+}
+
+agl::aglFramebuffer::aglFramebuffer(int width, int height, aglFramebufferCreationSettings settings)
+{
+	for (u32 i = 0; i < framesInFlight; ++i)
+	{
+		VkImage image;
+		aglAllocation memory;
+		aglTexture::CreateVulkanImage(width, height, settings.format, VK_IMAGE_TILING_OPTIMAL, settings.usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, false, 1, AGL_MEMORY_FRAMEBUFFER, this);
+		images.push_back(image);
+	}
+	imageFormat = settings.format;
+}
+
+void agl::aglFramebuffer::Destroy()
+{
+
+	for (auto framebuffer : framebuffers)
+	{
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+	}
+
+	for (auto image_view : imageViews)
+	{
+		vkDestroyImageView(device, image_view, nullptr);
+	}
+
+	if (depthImageView != VK_NULL_HANDLE)
+	{
+		vkDestroyImageView(device, depthImageView, nullptr);
+		vkDestroyImage(device, depthImage, nullptr);
+		aglAllocator::Free(depthImageMemory);
+	}
+
+	framebuffers.clear();
+	imageViews.clear();
+	depthImageView = VK_NULL_HANDLE;
+}
+
+void agl::aglFramebuffer::Retire(RetiredSurfaceResources& retired)
+{
+	retired.framebuffers = std::move(framebuffers);
+	retired.imageViews = std::move(imageViews);
+	retired.depthImage = depthImage;
+	retired.depthImageMemory = depthImageMemory;
+	retired.depthImageView = depthImageView;
+
+	framebuffers.clear();
+	imageViews.clear();
+	depthImage = VK_NULL_HANDLE;
+	depthImageMemory = aglAllocation();
+	depthImageView = VK_NULL_HANDLE;
+}
+
+void agl::aglFramebuffer::WaitForValidExtent()
+{
+	// A minimized window has no surface extent to create a swapchain with
+	if (aglRenderThread::IsRenderThread())
+	{
+		// The window and its events belong to the application thread, which reports when it's back
+		while (true)
+		{
+			VkSurfaceCapabilitiesKHR capabilities;
+			vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &capabilities);
+
+			VkExtent2D extent = ChooseSwapExtent(capabilities);
+			if ((extent.width > 0 && extent.height > 0) || !aglRenderThread::WaitForWindow())
+			{
+				return;
+			}
+		}
+	}
+
+	int width = 0, height = 0;
+	SDL_GetWindowSize(window, &width, &height);
+	while (width == 0 || height == 0)
+	{
+		SDL_GetWindowSize(window, &width, &height);
+		SDL_WaitEvent(event);
+	}
+}
+
+void agl::aglFramebuffer::Recreate()
+{
+	// The render pass only depends on the formats, which do not change with the size
+	CreateFramebuffers({VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
+}
+
+void agl::aglFramebuffer::CreateFramebuffers(aglRenderPassSettings settings)
+{
+	CreateDepthResources();
+	CreateImageViews();
+
+	if (renderPass == nullptr)
+	{
+		renderPass = new aglRenderPass(this, settings);
+	}
+	framebuffers.resize(imageViews.size());
+
+	for (size_t i = 0; i < imageViews.size(); i++)
+	{
+		array<VkImageView, 2> attachments = {
+			imageViews[i],
+			depthImageView
+		};
+
+		VkFramebufferCreateInfo framebufferInfo{};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = renderPass->renderPass;
+		framebufferInfo.attachmentCount = cast(attachments.size(), u32);
+		framebufferInfo.pAttachments = attachments.data();
+		framebufferInfo.width = extent.width;
+		framebufferInfo.height = extent.height;
+		framebufferInfo.layers = 1;
+
+		if (vkCreateFramebuffer(GetDevice(), &framebufferInfo, nullptr, &framebuffers[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create framebuffer.");
+		}
+	}
+}
+
+void agl::aglFramebuffer::CreateImageViews()
+{
+	imageViews.resize(images.size());
+
+	for (int i = 0; i < images.size(); ++i)
+	{
+		imageViews[i] = aglTexture::CreateImageView(images[i], imageFormat, VK_IMAGE_ASPECT_COLOR_BIT, false);
+	}
+}
+
+void agl::aglFramebuffer::CreateDepthResources()
+{
+	VkFormat depthFormat = FindDepthFormat();
+
+	aglTexture::CreateVulkanImage(extent.width, extent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory, false, 1, AGL_MEMORY_FRAMEBUFFER, this);
+
+	depthImageView = aglTexture::CreateImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, false);
+	//TransitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+}
+
+void agl::aglShaderFactory::ReloadAllShaders()
+{
+	for (auto loaded_shader : loadedShaders)
+	{
+		loaded_shader->Recreate();
+	}
+}
+
+void agl::aglShaderFactory::ReloadShader(u32 id)
+{
+	loadedShaders[id]->Recreate();
+}
+
+void agl::aglShaderFactory::SetupAllShaders()
+{
+	for (auto loaded_shader : loadedShaders)
+	{
+		loaded_shader->Setup();
+	}
+}
+
+void agl::aglShaderFactory::InsertShader(aglShader* shader, u32 desiredId)
+{
+	u32 id = desiredId;
+
+	if (id == -1)
+	{
+		id = loadedShaders.size();
+		loadedShaders.resize(loadedShaders.size() + 1);
+	}
+
+	shader->id = id;
+	loadedShaders[id] = (shader);
+}
+
+agl::aglShader* agl::aglShaderFactory::GetShader(u32 id)
+{
+
+	if (loadedShaders.size() <= id || loadedShaders[id] == nullptr)
+	{
+		agl::aglShaderSettings shaderSettings = {
+			{
+				data["LoadedShaders"]["Settings"]["VertexPath"],
+				data["LoadedShaders"]["Settings"]["FragmentPath"],
+				data["LoadedShaders"]["Settings"]["GeometryPath"],
+				data["LoadedShaders"]["Settings"]["ComputePath"],
+			},
+			data["LoadedShaders"]["Settings"]["CullFlags"],
+			data["LoadedShaders"]["Settings"]["FrontFace"],
+			data["LoadedShaders"]["Settings"]["DepthCompare"],
+			data["LoadedShaders"]["Id"]
+		};
+		aglShader* shader = new aglShader(shaderSettings);
+
+		shader->Load(data["LoadedShaders"]);
+
+		return shader;
+	}
+
+	return loadedShaders[id];
+}
+
+nlohmann::json agl::aglShaderFactory::Serialize()
+{
+
+	nlohmann::json j = json::object();
+
+	for (auto loaded_shader : loadedShaders)
+	{
+
+		if (loaded_shader->type == COMPUTE_FULL)
+		{
+			continue;
+		}
+
+		j["LoadedShaders"][loaded_shader->id] = loaded_shader->Serialize();
+	}
+
+	return j;
+}
+
+void agl::aglShaderFactory::Load(nlohmann::json j)
+{
+	data = j;
+
+	loadedShaders.resize(j["LoadedShaders"].size());
+
+	for (auto s : j["LoadedShaders"])
+	{
+		if (loadedShaders[s["Id"]] == nullptr)
+		{
+			agl::aglShaderSettings shaderSettings = {
+				{
+					s["Settings"]["VertexPath"],
+					s["Settings"]["FragmentPath"],
+					s["Settings"]["GeometryPath"],
+					s["Settings"]["ComputePath"],
+				},
+				s["Settings"]["CullFlags"],
+				s["Settings"]["FrontFace"],
+				s["Settings"]["DepthCompare"],
+				s["Id"]
+			};
+			aglShader* shader = new aglShader(shaderSettings);
+
+			shader->Load(s);
+		}
+	}
+}
+
+void agl::aglShaderFactory::SetData(nlohmann::json j)
+{
+	data = j;
+}
+
+void agl::aglShader::Setup()
+{
+
+	ppBuffer = new aglUniformBuffer(this, { VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(PostProcessingSettings)});
+
+	if (GetBindingByName("postProcessingSettings") != -1) {
+		ppBuffer->AttachToShader(this, GetBindingByName("postProcessingSettings"));
+	}
+
+	CreateDescriptorSetLayout();
+
+	CreateDescriptorPool();
+
+	// Graphics Pipeline
+
+	if (compModule == nullptr) {
+		CreateGraphicsPipeline();
+	} else
+	{
+		CreateComputePipeline();
+	}
+
+	CreateDescriptorSet();
+
+	setup = true;
+}
+
+void agl::aglShader::Create()
+{
+
+	shaderStages.clear();
+
+	if (settings.paths.vertexPath != "") {
+		string path = settings.paths.vertexPath;
+		vertexCode = ReadString(path);
+
+		if (ustring::hasEnding(path, "vert"))
+		{
+			vertexCode = CompileGLSLToSpirV(path);
+		}
+
+		vertModule = new aglShaderLevel(vertexCode, VERTEX, this);
+
+		shaderStages.push_back(vertModule->stageInfo);
+		type = VISUAL_FULL;
+	}
+
+	if (settings.paths.fragmentPath != "") {
+		string path = settings.paths.fragmentPath;
+		fragmentCode = ReadString(path);
+
+		if (ustring::hasEnding(path, "frag"))
+		{
+			fragmentCode = CompileGLSLToSpirV(path);
+		}
+
+		fragModule = new aglShaderLevel(fragmentCode, FRAGMENT, this);
+
+		shaderStages.push_back(fragModule->stageInfo);
+		type = VISUAL_FULL;
+	}
+
+	if (settings.paths.computePath != "") {
+		string path = settings.paths.computePath;
+		computeCode = ReadString(path);
+
+		if (ustring::hasEnding(path, "comp"))
+		{
+			computeCode = CompileGLSLToSpirV(path);
+		}
+
+		compModule = new aglShaderLevel(computeCode, COMPUTE, this);
+
+		shaderStages.push_back(compModule->stageInfo);
+		type = COMPUTE_FULL;
+	}
+
+
+	for (int i = 0; i < descriptorWrites.size(); ++i)
+	{
+		if (descriptorWrites[i].size() != ports.size()) {
+			descriptorWrites[i].resize(ports.size());
+		}
+	}
+
+}
+
+agl::aglShader::aglShader(aglShaderSettings settings)
+{
+	descriptorWrites.resize(framesInFlight);
+	this->settings = settings;
+
+	aglShaderFactory::InsertShader(this, settings.desiredID);
+
+	Create();
+}
+
+std::string agl::aglShader::CompileGLSLToSpirV(std::string path)
+{
+
+	static vector<string> compiledShaders;
+
+	string elevPath = ustring::substring(path, "resources/shaders/");
+
+	if (ustring::hasEnding(elevPath, ".vert")) {
+		elevPath = ustring::substring(elevPath, ".vert");
+		elevPath += ".vert-spv";
+	}
+
+	if (ustring::hasEnding(elevPath, ".frag")) {
+		elevPath = ustring::substring(elevPath, ".frag");
+		elevPath += ".frag-spv";
+	}
+
+	if (ustring::hasEnding(elevPath, ".comp")) {
+		elevPath = ustring::substring(elevPath, ".comp");
+		elevPath += ".comp-spv";
+	}
+
+	string spvPath = "compiled/shaders/" + elevPath;
+
+	if (std::find(compiledShaders.begin(), compiledShaders.end(), spvPath) == compiledShaders.end()) {
+
+		compiledShaders.push_back(spvPath);
+
+		filesystem::remove(spvPath);
+
+		filesystem::create_directory("compiled/");
+		filesystem::create_directory("compiled/shaders/");
+
+		filesystem::path fpath(spvPath);
+
+		filesystem::path parent = fpath.parent_path();
+
+		filesystem::create_directory(fpath.parent_path());
+
+		string sysCmd = "cd " + filesystem::current_path().string() + " && ";
+
+		sysCmd += "C:/VulkanSDK/1.3.250.0/Bin/glslc ";
+
+		sysCmd += path;
+
+		sysCmd += " -o ";
+
+		sysCmd += spvPath;
+
+		int retcode = system(sysCmd.c_str());
+
+		cout << "Compiled shader: " << spvPath << " Returned: " << retcode << endl;
+
+		if (retcode != 0) {
+			return "";
+		}
+
+	}
+
+	return ReadString(spvPath);
+}
+
+u32 agl::aglShader::GetBindingByName(string n)
+{
+	for (aglDescriptorPort* port : ports)
+	{
+		if (port->name == n)
+		{
+			return port->binding;
+		}
+	}
+
+	//throw new std::exception(("No binding found with name: " + n).c_str());
+
+	return -1;
+}
+
+void agl::aglShader::Destroy()
+{
+	if (fragModule) {
+		fragModule->Destroy();
+	}
+	if (vertModule) {
+		vertModule->Destroy();
+	}
+	if (compModule)
+	{
+		compModule->Destroy();
+		compModule = nullptr;
+	}
+
+	if (ppBuffer)
+	{
+		ppBuffer->Destroy();
+		delete ppBuffer;
+		ppBuffer = nullptr;
+	}
+
+	VkDescriptorSetLayout setLayout = descriptorSetLayout;
+	VkPipeline pipeline = mainPipeline;
+	VkPipelineLayout layout = pipelineLayout;
+	VkDescriptorPool pool = descriptorPool;
+
+	aglDeletionQueue::Push([setLayout, pipeline, layout, pool]
+	{
+		vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, layout, nullptr);
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	});
+
+	descriptorSetLayout = VK_NULL_HANDLE;
+	mainPipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	descriptorPool = VK_NULL_HANDLE;
+	descriptorSets.clear();
+}
+
+void agl::aglShader::Recreate()
+{
+	Destroy();
+	Create();
+	Setup();
+}
+
+VkWriteDescriptorSet* agl::aglShader::CreateDescriptorSetWrite(int frame, int binding)
+{
+	auto write = new VkWriteDescriptorSet();
+	write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write->dstBinding = binding;
+	write->dstArrayElement = 0;
+	write->descriptorCount = 1;
+	return write;
+}
+
+VkDescriptorSetLayout agl::aglShader::GetDescriptorSetLayout()
+{ return descriptorSetLayout; }
+
+VkDescriptorPool agl::aglShader::GetDescriptorPool()
+{ return descriptorPool; }
+
+void agl::aglShader::AttachDescriptorSetLayout(VkDescriptorSetLayoutBinding binding, int b)
+{
+	if (bindings.size() <= b)
+	{
+		bindings.resize(b + 1);
+	}
+	bindings[b] = binding;
+}
+
+void agl::aglShader::AttachDescriptorPool(VkDescriptorPoolSize pool, int b)
+{
+	if (poolSizes.size() <= b)
+	{
+		poolSizes.resize(b+1);
+	}
+	poolSizes[b] = pool;
+}
+
+void agl::aglShader::AttachDescriptorWrite(VkWriteDescriptorSet* write, int frame, int binding)
+{
+	descriptorWrites[frame][binding] = (*write);
+}
+
+void agl::aglShader::AttachDescriptorWrites(std::vector<VkWriteDescriptorSet*> writes, int frame)
+{
+	int ctr = 0;
+	for (auto write : writes)
+	{
+		AttachDescriptorWrite(write, frame, ctr);
+		ctr++;
+	}
+}
+
+void agl::aglShader::BindGraphicsPipeline(VkCommandBuffer commandBuffer)
+{
+	if (pushConstant) {
+		vkCmdPushConstants(commandBuffer, GetPipelineLayout(), pushConstant->flags, 0, pushConstant->size, pushConstant->data);
+	}
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mainPipeline);
+
+	ppBuffer->Update(&postProcessing, sizeof(postProcessing));
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GetPipelineLayout(), 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+}
+
+VkPipelineLayout agl::aglShader::GetPipelineLayout()
+{
+	return pipelineLayout;
+}
+
+void agl::aglShader::CreateGraphicsPipeline()
+{
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = 0;
+	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+
+	std::vector<VkVertexInputBindingDescription> bindingDesc;
+	std::vector<VkVertexInputAttributeDescription> attributeDesc;
+	settings.vertexFormat.GetInputState(bindingDesc, attributeDesc, settings.positionOnly);
+
+	if (settings.instanced)
+	{
+		aglInstanceData::GetInputState(bindingDesc, attributeDesc);
+	}
+
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<u32>(bindingDesc.size());
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<u32>(attributeDesc.size());
+
+	vertexInputInfo.pVertexBindingDescriptions = bindingDesc.data();
+	vertexInputInfo.pVertexAttributeDescriptions = attributeDesc.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = settings.cullFlags;
+	rasterizer.frontFace = settings.frontFace;
+	rasterizer.depthBiasEnable = VK_FALSE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending{};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+	colorBlending.blendConstants[0] = 0.0f;
+	colorBlending.blendConstants[1] = 0.0f;
+	colorBlending.blendConstants[2] = 0.0f;
+	colorBlending.blendConstants[3] = 0.0f;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil{};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = settings.depthCompare;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.minDepthBounds = 0.0f;
+	depthStencil.maxDepthBounds = 1.f;
+	depthStencil.stencilTestEnable = VK_FALSE;
+
+	std::vector<VkDynamicState> dynamicStates = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+
+	if (pushConstant) {
+		//setup push constants
+		VkPushConstantRange push_constant;
+		//this push constant range starts at the beginning
+		push_constant.offset = 0;
+		//this push constant range takes up the size of a MeshPushConstants struct
+		push_constant.size = pushConstant->size;
+		//this push constant range is accessible only in the vertex shader
+		push_constant.stageFlags = pushConstant->flags;
+
+		pipelineLayoutInfo.pPushConstantRanges = &push_constant;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+	}
+
+	if (vkCreatePipelineLayout(GetDevice(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = shaderStages.size();
+	pipelineInfo.pStages = shaderStages.data();
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil; // Optional
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.renderPass = settings.renderPass->renderPass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	if (vkCreateGraphicsPipelines(GetDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mainPipeline) !=
+		VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create graphics pipeline.");
+	}
+}
+
+void agl::aglShader::CreateComputePipeline()
+{
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+
+	if (pushConstant) {
+		//setup push constants
+		VkPushConstantRange push_constant;
+		//this push constant range starts at the beginning
+		push_constant.offset = 0;
+		//this push constant range takes up the size of a MeshPushConstants struct
+		push_constant.size = pushConstant->size;
+		//this push constant range is accessible only in the vertex shader
+		push_constant.stageFlags = pushConstant->flags;
+
+		pipelineLayoutInfo.pPushConstantRanges = &push_constant;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+	}
+
+	if (vkCreatePipelineLayout(GetDevice(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.stage = shaderStages[0];
+
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mainPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+}
+
+void agl::aglShader::CreateDescriptorSetLayout()
+{
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(GetDevice(), &layoutInfo, nullptr, &descriptorSetLayout);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor set layout!");
+	}
+}
+
+void agl::aglShader::CreateDescriptorPool()
+{
+	VkDescriptorPoolCreateInfo poolInfo{};
+
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = static_cast<u32>(framesInFlight);
+
+	if (vkCreateDescriptorPool(GetDevice(), &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor pool.");
+	}
+}
+
+void agl::aglShader::CreateDescriptorSet()
+{
+	for (auto port : ports)
+	{
+		if (port->type == DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
+			aglTexture* texture = port->texture;
+			if (texture) {
+				for (u32 i = 0; i < framesInFlight; ++i)
+				{
+
+					VkDescriptorImageInfo* imageInfo = new VkDescriptorImageInfo;
+					imageInfo->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+					imageInfo->imageView = texture->textureImageView;
+					imageInfo->sampler = texture->textureSampler;
+
+					VkWriteDescriptorSet* descriptorWrite;
+
+					descriptorWrite = CreateDescriptorSetWrite(i,port->binding);
+					descriptorWrite->descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+					descriptorWrite->pImageInfo = imageInfo;
+
+					AttachDescriptorWrite(descriptorWrite, i,port->binding);
+				}
+			}
+		}
+
+		if (port->type == DESCRIPTOR_TYPE_STORAGE_IMAGE) {
+			aglTexture* texture = port->texture;
+			if (texture) {
+				for (u32 i = 0; i < framesInFlight; ++i)
+				{
+
+					VkDescriptorImageInfo* imageInfo = new VkDescriptorImageInfo;
+					imageInfo->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+					imageInfo->imageView = texture->textureImageView;
+					imageInfo->sampler = texture->textureSampler;
+
+					VkWriteDescriptorSet* descriptorWrite;
+
+					descriptorWrite = CreateDescriptorSetWrite(i, port->binding);
+					descriptorWrite->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+					descriptorWrite->pImageInfo = imageInfo;
+
+					AttachDescriptorWrite(descriptorWrite, i, port->binding);
+				}
+			}
+		}
+	}
+
+	vector<VkDescriptorSetLayout> layouts(framesInFlight, GetDescriptorSetLayout());
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = GetDescriptorPool();
+	allocInfo.descriptorSetCount = static_cast<u32>(framesInFlight);
+	allocInfo.pSetLayouts = layouts.data();
+
+	descriptorSets.resize(framesInFlight);
+	if (vkAllocateDescriptorSets(GetDevice(), &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate descriptor sets.");
+	}
+
+	for (u32 i = 0; i < framesInFlight; ++i)
+	{
+		vector<VkWriteDescriptorSet> writes(descriptorWrites[i].size());
+		int ctr = 0;
+		for (VkWriteDescriptorSet descriptor_write : descriptorWrites[i])
+		{
+			descriptor_write.dstSet = descriptorSets[i];
+			descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				
+			writes[ctr] = descriptor_write;
+			ctr++;
+		}
+
+		vkUpdateDescriptorSets(GetDevice(), static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+	}
+
+}
+
+nlohmann::json agl::aglShader::Serialize()
+{
+	nlohmann::json j = json::object();
+
+	j["Id"] = id;
+
+	j["Settings"] = {
+		{"VertexPath", settings.paths.vertexPath},
+		{"FragmentPath", settings.paths.fragmentPath},
+		{"GeometryPath", settings.paths.geometryPath},
+		{"ComputePath", settings.paths.computePath},
+		{"CullFlags", settings.cullFlags},
+		{"DepthCompare", settings.depthCompare},
+		{"FrontFace", settings.frontFace},
+		{"VertexEncodings", settings.vertexFormat.encodings},
+		{"SplitPosition", settings.vertexFormat.splitPosition},
+		{"PositionOnly", settings.positionOnly},
+		{"Instanced", settings.instanced},
+	};
+
+	for (auto port : ports)
+	{
+		nlohmann::json p;
+
+		p["Set"] = port->set;
+		p["Binding"] = port->binding;
+		p["Count"] = port->count;
+		p["Type"] = port->type;
+		p["Name"] = port->name;
+ 
+		if (port->texture)
+		{
+			p["Texture"] = port->texture->id;
+		}
+		j["Ports"][port->binding] = p;
+	}
+
+	return j;
+}
+
+void agl::aglShader::Load(nlohmann::json j)
+{
+	agl::aglShaderSettings shaderSettings = {
+	{
+		j["Settings"]["VertexPath"],
+		j["Settings"]["FragmentPath"],
+		j["Settings"]["GeometryPath"],
+		j["Settings"]["ComputePath"],
+	},
+	j["Settings"]["CullFlags"],
+	j["Settings"]["FrontFace"],
+	j["Settings"]["DepthCompare"],
+		j["Id"]
+	};
+
+	if (j["Settings"].contains("VertexEncodings"))
+	{
+		for (u32 i = 0; i < AGL_VERTEX_ATTRIBUTE_COUNT; ++i)
+		{
+			shaderSettings.vertexFormat.encodings[i] = j["Settings"]["VertexEncodings"][i];
+		}
+		shaderSettings.vertexFormat.splitPosition = j["Settings"]["SplitPosition"];
+		shaderSettings.positionOnly = j["Settings"]["PositionOnly"];
+	}
+
+	if (j["Settings"].contains("Instanced"))
+	{
+		shaderSettings.instanced = j["Settings"]["Instanced"];
+	}
+
+	settings = shaderSettings;
+
+	for (auto port : j["Ports"])
+	{
+		if (port.contains("Texture"))
+		{
+			cout << "Processing port: " << port["Name"] << endl;
+			AttachTexture(aglTextureFactory::GetTexture(port["Texture"]), port["Binding"]);
+		}
+	}
+}
+
+void agl::aglShader::AttachTexture(aglTexture* texture, u32 binding)
+{
+
+	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+	samplerLayoutBinding.binding = binding;
+	samplerLayoutBinding.descriptorCount = 1;
+	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerLayoutBinding.pImmutableSamplers = nullptr;
+	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+
+	VkDescriptorPoolSize samplerPoolSize{};
+
+	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerPoolSize.descriptorCount = static_cast<u32>(framesInFlight);
+
+	AttachDescriptorPool(samplerPoolSize, binding);
+	AttachDescriptorSetLayout(samplerLayoutBinding,binding);
+
+	if (binding != -1)
+	{
+
+		ports[binding]->texture = texture;
+	}
+}
+
+agl::aglComputeShader::aglComputeShader(aglShaderSettings settings) : aglShader(settings)
+{
+	descriptorWrites.resize(framesInFlight);
+	bindings.resize(1);
+
+	aglShaderFactory::InsertShader(this, settings.desiredID);
+
+	this->settings = settings;
+
+	aglComputeShader::Create();
+}
+
+void agl::aglComputeShader::BeginDispatchField()
+{
+
+	VkCommandBuffer commandBuffer = computeCommandBuffers[currentFrame];
+
+	// The command buffer for this slot may still be executing
+	timeline->Wait(computeTimelineValues[currentFrame]);
+
+	vkResetCommandBuffer(computeCommandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
+
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording compute command buffer!");
+	}
+}
+
+void agl::aglComputeShader::Dispatch(u32 imageIndex, vec3 groupCount)
+{
+
+	if (setup == false)
+	{
+		Setup();
+	}
+
+	VkCommandBuffer commandBuffer = computeCommandBuffers[imageIndex];
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mainPipeline);
+
+	if (ports.size() > 0) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+	}
+
+	vkCmdDispatch(commandBuffer, groupCount.x, groupCount.y, groupCount.z);
+
+}
+
+void agl::aglComputeShader::EndDispatchField()
+{
+
+	VkCommandBuffer commandBuffer = computeCommandBuffers[currentFrame];
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record compute command buffer!");
+	}
+
+	// The next graphics submission waits on this value at vertex input
+	uint64_t value = timeline->Submit(computeQueue, commandBuffer);
+
+	computeTimelineValues[currentFrame] = value;
+	pendingTimelineValue = value;
+}
+
+void agl::aglComputeShader::Create()
+{
+	AreComputeShadersUsed = true;
+	aglShader::Create();
+
+	if (!ObjectsCreated) {
+		CreateCommandBuffers();
+		CreateSyncObjects();
+		ObjectsCreated = true;
+	}
+}
+
+void agl::aglComputeShader::Destroy()
+{
+	aglShader::Destroy();
+}
+
+void agl::aglComputeShader::AttachTexture(aglTexture* texture, u32 binding)
+{
+	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+	samplerLayoutBinding.binding = binding;
+	samplerLayoutBinding.descriptorCount = 1;
+	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	samplerLayoutBinding.pImmutableSamplers = nullptr;
+	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+
+	VkDescriptorPoolSize samplerPoolSize{};
+
+	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	samplerPoolSize.descriptorCount = static_cast<u32>(framesInFlight);
+
+	AttachDescriptorPool(samplerPoolSize, binding);
+	AttachDescriptorSetLayout(samplerLayoutBinding, binding);
+
+	if (binding != -1)
+	{
+
+		ports[binding]->texture = texture;
+	}
+}
+
+void agl::aglComputeShader::CreateCommandBuffers()
+{
+	computeCommandBuffers.resize(framesInFlight);
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = baseSurface->commandBuffer->commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = (uint32_t) computeCommandBuffers.size();
+
+	if (vkAllocateCommandBuffers(device, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate compute command buffers!");
+	}
+}
+
+void agl::aglComputeShader::CreateSyncObjects()
+{
+	// Compute work signals the shared timeline, only the per-slot values need tracking
+	computeTimelineValues.assign(framesInFlight, 0);
+}
+
+agl::aglStorageBuffer::aglStorageBuffer(aglBufferSettings settings)
+{
+	this->settings = settings;
+
+	// UB creation
+
+
+	VkDeviceSize bufferSize = settings.bufferSize;
+
+	buffers.resize(framesInFlight);
+	bufferMemory.resize(framesInFlight);
+	mappedBuffers.resize(framesInFlight);
+
+	for (u32 i = 0; i < framesInFlight; ++i)
+	{
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 buffers[i], bufferMemory[i], AGL_MEMORY_STORAGE_BUFFER, this);
+
+		mappedBuffers[i] = bufferMemory[i].mapped;
+	}
+
+
+	if (settings.binding >= 32)
+	{
+		throw std::exception("Invalid binding.");
+	}
+
+}
+
+
+void agl::aglStorageBuffer::Destroy()
+{
+	aglDeletionQueue::Push([buffers = std::move(buffers), memory = std::move(bufferMemory)]() mutable
+	{
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			vkDestroyBuffer(device, buffers[i], nullptr);
+			aglAllocator::Free(memory[i]);
+		}
+	});
+
+	buffers.clear();
+	bufferMemory.clear();
+	mappedBuffers.clear();
+}
+
+void agl::aglStorageBuffer::AttachToShader(aglShader* shader, u32 bindingIdx)
+{
+
+	if (bindingIdx == -1)
+	{
+		throw new std::exception("Binding index is less than one. Invalid binding requested.");
+	}
+
+	this->shader = shader;
+
+	VkDescriptorSetLayoutBinding uboLayoutBinding{};
+	uboLayoutBinding.binding = bindingIdx;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	uboLayoutBinding.descriptorCount = 1;
+	uboLayoutBinding.stageFlags = settings.flags;
+	uboLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorPoolSize uboPoolSize{};
+
+	uboPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	uboPoolSize.descriptorCount = static_cast<u32>(framesInFlight);
+
+	shader->AttachDescriptorPool(uboPoolSize, bindingIdx);
+
+	CreateBinding(uboLayoutBinding, bindingIdx);
+
+	for (u32 i = 0; i < framesInFlight; ++i)
+	{
+		auto bufferInfo = new VkDescriptorBufferInfo;
+		bufferInfo->buffer = GetBuffer(i);
+		bufferInfo->offset = 0;
+		bufferInfo->range = settings.bufferSize;
+
+		VkWriteDescriptorSet* descriptorWrite;
+
+
+		descriptorWrite = shader->CreateDescriptorSetWrite(i, bindingIdx);
+		descriptorWrite->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrite->pBufferInfo = bufferInfo;
+
+		shader->AttachDescriptorWrite(descriptorWrite, i, bindingIdx);
+	}
+
+}
+
+void agl::aglStorageBuffer::CreateBinding(VkDescriptorSetLayoutBinding bind, int bindingIdx)
+{
+	binding = bind;
+	shader->AttachDescriptorSetLayout(binding, bindingIdx);
+}
+
+
+void agl::aglStorageBuffer::CreatePoolSize(VkDescriptorPoolSize poolSz, int bindingIdx)
+{
+	poolSize = poolSz;
+	shader->AttachDescriptorPool(poolSize, bindingIdx);
+}
+
+VkBuffer agl::aglStorageBuffer::GetBuffer(int frame)
+{
+	return buffers[frame];
+}
+
+void agl::aglStorageBuffer::Update(void* data, size_t dataSize)
+{
+	int bufferSize = settings.bufferSize;
+
+	if (aglRenderThread::IsCapturing())
+	{
+		aglRenderThread::GetWriteSnapshot()->WriteBuffer(mappedBuffers, data, dataSize);
+		return;
+	}
+
+	memcpy(mappedBuffers[currentFrame], data, dataSize);
+
+}
+
+void* agl::aglStorageBuffer::GetData()
+{
+	return mappedBuffers[currentFrame];
+}
+
+
+void agl::aglTextureFactory::InsertTexture(aglTexture* texture, u32 desiredId)
+{
+
+	u32 id = desiredId;
+
+	if (id == -1)
+	{
+		id = LoadedTextures.size();
+		LoadedTextures.resize(LoadedTextures.size() + 1);
+	}
+
+	if (id >= LoadedTextures.size())
+	{
+		LoadedTextures.resize(id + 1);
+	}
+
+	texture->id = id;
+
+	LoadedTextures[id] = texture;
+
+}
+
+nlohmann::json agl::aglTextureFactory::Serialize()
+{
+	nlohmann::json j = json::object();
+
+	for (auto loaded_texture : LoadedTextures)
+	{
+
+		j["LoadedTextures"][loaded_texture->id] = loaded_texture->Serialize();
+	}
+
+	return j;
+}
+
+void agl::aglTextureFactory::Load(nlohmann::json j)
+{
+
+	data = j;
+
+	for (auto t : j["LoadedTextures"])
+	{
+		if (LoadedTextures[t["Id"]] == nullptr) {
+
+			aglTextureCreationInfo info = { 1,1,1 };
+
+			info.desiredId = t["Id"];
+
+			aglTexture* tex = new aglTexture(info);
+			tex->Load(t);
+			LoadedTextures[t["Id"]] = tex;
+		}
+	}
+}
+
+agl::aglTexture* agl::aglTextureFactory::GetTexture(u32 id)
+{
+
+	if (LoadedTextures.size() <= id || LoadedTextures[id] == nullptr)
+	{
+		aglTextureCreationInfo info = { 1,1,1 };
+
+		info.desiredId = id;
+
+		aglTexture* tex = new aglTexture(info);
+		tex->Load(data["LoadedTextures"].at(id));
+		return tex;
+	}
+
+	return LoadedTextures[id];
+}
+
+void agl::aglTextureFactory::SetData(json j)
+{
+	data = j;
+}
+
+agl::aglTexture::aglTexture(string path, VkFormat format, aglUploadBatch* batch)
+{
+	Create(path, format, batch);
+
+	aglTextureFactory::InsertTexture(this, -1);
+
+}
+
+agl::aglTexture::aglTexture(aglShader* shader, aglTextureCreationInfo info)
+{
+	Create(shader, info);
+
+	aglTextureFactory::InsertTexture(this, info.desiredId);
+}
+
+agl::aglTexture::aglTexture(aglTextureCreationInfo info, aglUploadBatch* batch)
+{
+	aglTextureFactory::InsertTexture(this, info.desiredId);
+
+	this->info = info;
+
+	VkDeviceSize imageSize = info.width * info.height * 4;
+
+	width = info.width;
+	height = info.height;
+	channels = info.channels;
+
+  	format = VK_FORMAT_R8G8B8A8_SRGB;
+
+	std::vector<VkBufferImageCopy> bufferCopyRegions;
+	uint32_t offset = 0;
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	if (info.computeTexture)
+	{
+		usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+		format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	}
+
+	CreateVulkanImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, false, 1, AGL_MEMORY_TEXTURE, this);
+
+	aglUploadBatch localBatch;
+	aglUploadBatch* upload = batch ? batch : &localBatch;
+
+	upload->TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	upload->TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	localBatch.Destroy();
+
+	textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT, false);
+	CreateTextureSampler();
+
+	if (info.isCubemap)
+	{
+		type = AGL_TEXTURE_CUBEMAP;
+	}
+}
+
+void agl::aglTexture::Create(std::string path, VkFormat format, aglUploadBatch* batch)
+{
+	this->path = path;
+	int texWidth, texHeight, texChannels;
+
+	stbi_set_flip_vertically_on_load(true);
+
+	stbi_uc* pixels = stbi_load(path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	VkDeviceSize imageSize = texWidth * texHeight * 4;
+
+	if (!pixels) {
+		throw std::runtime_error("failed to load texture image!");
+	}
+
+	width = texWidth;
+	height = texHeight;
+	channels = texChannels;
+	this->format = format;
+
+	aglUploadBatch localBatch;
+	aglUploadBatch* upload = batch ? batch : &localBatch;
+
+	aglStagingRing::Allocation staging = upload->Stage(pixels, imageSize);
+
+	stbi_image_free(pixels);
+
+	std::vector<VkBufferImageCopy> bufferCopyRegions(1);
+	bufferCopyRegions[0].bufferOffset = staging.offset;
+	bufferCopyRegions[0].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	bufferCopyRegions[0].imageExtent = { static_cast<u32>(texWidth), static_cast<u32>(texHeight), 1 };
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	CreateVulkanImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, false, 1, AGL_MEMORY_TEXTURE, this);
+
+	upload->TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	upload->CopyBufferToImage(staging.buffer, textureImage, static_cast<u32>(texWidth), static_cast<u32>(texHeight), bufferCopyRegions.size(), bufferCopyRegions.data());
+	upload->TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	localBatch.Destroy();
+
+	textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT, false);
+	CreateTextureSampler();
+
+	this->info = info;
+}
+
+void agl::aglTexture::Create(aglShader* shader, aglTextureCreationInfo info)
+{
+	sourceShader = shader;
+
+	width = info.width;
+	height = info.height;
+	channels = info.channels;
+	
+
+	VkDeviceSize imageSize = info.width * info.height * info.channels;
+	const uint32_t numMips = static_cast<uint32_t>(floor(log2(static_cast<double>(width)))) + 1;
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	VkImageLayout layout;
+
+	if (info.isCubemap)
+	{
+		usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	}
+	else {
+		usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	}
+
+
+
+
+	CreateVulkanImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, info.isCubemap, numMips, info.isCubemap ? AGL_MEMORY_CUBEMAP : AGL_MEMORY_TEXTURE, this);
+
+	textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT, info.isCubemap, numMips);
+
+	CreateTextureSampler(static_cast<float>(numMips));
+
+	aglFramebuffer* fbo = new aglFramebuffer();
+	if (info.isCubemap)
+	{
+		fbo = new aglFramebuffer(width, height, aglFramebufferCreationSettings{ format , VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT });
+	}
+	else
+	{
+		fbo->imageFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+	}
+	fbo->extent = VkExtent2D{ (u32) width,(u32) height };
+	if (!info.isCubemap) {
+		fbo->images.push_back(textureImage);
+	}
+
+	vector<VkSubpassDependency> dependencies;
+
+	dependencies.resize(2);
+
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	fbo->CreateFramebuffers({ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, dependencies });
+	if (info.isCubemap)
+	{
+		TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1, true, numMips);
+	}
+	else
+	{
+		TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1, true, numMips);
+	}
+
+	// Pipeline layout
+	struct PushBlock {
+		glm::mat4 mvp;
+		int drawId = 0;
+		int mipId = 0;
+		int mipCount = 0;
+	} pushBlock;
+
+	glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
+	glm::mat4 captureViews[ ] =
+	{
+	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
+	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
+	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),
+	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),
+	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
+	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
+	};
+
+
+	if (info.isCubemap) {
+
+		shader->pushConstant = new aglPushConstant();
+		shader->pushConstant->flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		shader->pushConstant->size = sizeof(pushBlock);
+		shader->AttachTexture(info.baseCubemap, shader->GetBindingByName("equirectangularMap"));
+	}
+
+
+	shader->settings.renderPass = fbo->renderPass;
+
+	shader->Setup();
+
+	int layerCount = 1;
+
+	if (info.isCubemap) {
+		layerCount = 6;
+		TransitionImageLayout(textureImage, fbo->imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerCount, true, numMips);
+	}
+
+	VkCommandBuffer cmd = baseSurface->commandBuffer->BeginSingleTimeCommands();
+
+	fbo->renderPass->commandBuffer = new aglCommandBuffer;
+	fbo->renderPass->commandBuffer->commandBuffers[0] = cmd;
+
+	if (info.isCubemap) {
+
+		for (int m = 0; m < numMips; ++m)
+		{
+			for (int i = 0; i < 6; ++i)
+			{
+				fbo->extent.width = static_cast<float>(width * std::pow(0.5f, m));
+				fbo->extent.height = static_cast<float>(height * std::pow(0.5f, m));
+
+				pushBlock.mvp = captureProjection * captureViews[i];
+				pushBlock.drawId = i;
+				pushBlock.mipId = m;
+				pushBlock.mipCount = numMips;
+
+				shader->pushConstant->data = &pushBlock;
+				shader->pushConstant->size = sizeof(pushBlock);
+
+				fbo->Bind(0, cmd);
+
+				shader->BindGraphicsPipeline(cmd);
+
+				((aglPrimitives*) agl_ext::installedExtensions[AGL_EXTENSION_PRIMITIVES_LAYER_NAME])->GetPrims()[aglPrimitives::CUBE]->Draw(cmd, 0);
+
+				fbo->renderPass->End(cmd);
+
+				TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 1, false, numMips);
+
+				CopyImageToImage(textureImage, fbo->images[0], i, 1, fbo->extent.width, fbo->extent.height, false, 0, m);
+
+				TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1, false, numMips);
+			}
+		}
+
+	}
+	else
+	{
+		fbo->Bind(0, cmd);
+
+		shader->BindGraphicsPipeline(cmd);
+
+		((aglPrimitives*) agl_ext::installedExtensions[AGL_EXTENSION_PRIMITIVES_LAYER_NAME])->GetPrims()[aglPrimitives::QUAD]->Draw(cmd, 0);
+
+		fbo->renderPass->End(cmd);
+	}
+
+	if (info.isCubemap) {
+		TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, false, numMips);
+	}
+	else
+	{
+		TransitionImageLayout(fbo->images[0], format, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, false, numMips);
+	}
+
+	baseSurface->commandBuffer->EndSingleTimeCommands(cmd);
+
+
+	if (!info.isCubemap) {
+		textureImage = fbo->images[0];
+		textureImageView = fbo->imageViews[0];
+		CreateTextureSampler();
+	}
+	else {
+
+	}
+
+	if (info.isCubemap)
+	{
+		type = AGL_PROCEDURAL_CUBEMAP;
+	}
+	else
+	{
+		type = AGL_PROCEDURAL_2D;
+	}
+
+	this->info = info;
+}
+
+VkImageView agl::aglTexture::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
+                                             bool isCubemap, u32 mipCount)
+{
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = VkImageSubresourceRange{ aspectFlags, 0,mipCount,0,1 };
+
+	if (isCubemap)
+	{
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+		viewInfo.subresourceRange.layerCount = 6;
+	}
+
+	VkImageView imageView;
+	if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create texture image view");
 	}
+
+	return imageView;
 }
 
-agl::aglComputeShader::aglComputeShader(aglShaderSettings settings) : aglShader(settings)
+void agl::aglTexture::CreateVulkanImage(u32 width, u32 height, VkFormat format, VkImageTiling tiling,
+	VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, aglAllocation& imageMemory,
+	bool isCubemap, u32 mipCount, aglMemoryCategory category, const void* owner)
 {
-	descriptorWrites.resize(MAX_FRAMES_IN_FLIGHT);
-	bindings.resize(1);
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = mipCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = format;
+	imageInfo.tiling = tiling;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = usage;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	aglShaderFactory::InsertShader(this, settings.desiredID);
+	if (isCubemap)
+	{
+		imageInfo.arrayLayers = 6;
+		imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+	}
 
-	this->settings = settings;
+	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create image!");
+	}
 
-	aglComputeShader::Create();
+	imageMemory = aglAllocator::AllocateForImage(image, properties, category, owner, tiling == VK_IMAGE_TILING_LINEAR);
 }
 
-void agl::aglComputeShader::BeginDispatchField()
+void agl::aglTexture::CreateTextureSampler(float numMips)
 {
+	VkSamplerCreateInfo samplerInfo{};
 
-	VkCommandBuffer commandBuffer = computeCommandBuffers[currentFrame];
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 
-	// Compute submission        
-	vkWaitForFences(device, 1, &computeInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-	vkResetFences(device, 1, &computeInFlightFences[currentFrame]);
+	samplerInfo.anisotropyEnable = VK_FALSE;
 
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-	vkResetCommandBuffer(computeCommandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
+	samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
 
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
 
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = numMips;
 
-	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-		throw std::runtime_error("failed to begin recording compute command buffer!");
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create texture sampler!");
 	}
 }
 
-void agl::aglComputeShader::Dispatch(u32 imageIndex, vec3 groupCount)
+nlohmann::json agl::aglTexture::Serialize()
 {
+	nlohmann::json j = json::object();
 
-	if (setup == false)
-	{
-		Setup();
-	}
+	bool isCB = (info.baseCubemap != nullptr);
 
-	VkCommandBuffer commandBuffer = computeCommandBuffers[imageIndex];
+	j["Type"] = json::number_float_t(type);
+	j["Path"] = path;
+	j["Info"] = {
+		{"Width", width},
+		{"Height", height},
+		{"Channels", channels},
+		{"IsCubemap", isCB}
+	};
+	j["Format"] = json::number_float_t(format);
+	j["Id"] = json::number_float_t(id);
 
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mainPipeline);
 
-	if (ports.size() > 0) {
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+	if (type == AGL_PROCEDURAL_2D || type == AGL_PROCEDURAL_CUBEMAP)
+	{
+		j["Shader"] = json::number_float_t(sourceShader->id);
+		if (info.baseCubemap) {
+			j["BaseCubemap"] = json::number_float_t(info.baseCubemap->id);
+		}
 	}
 
-	vkCmdDispatch(commandBuffer, groupCount.x, groupCount.y, groupCount.z);
-
+	return j;
 }
 
-void agl::aglComputeShader::EndDispatchField()
+void agl::aglTexture::Load(nlohmann::json j)
 {
+	type = j["Type"];
+	path = j["Path"];
+	info = {
+		j["Info"]["Width"],
+		j["Info"]["Height"],
+		j["Info"]["Channels"],
+		j.contains("BaseCubemap"),
+	};
+	format = j["Format"];
+	info.desiredId = j["Id"];
 
-	VkCommandBuffer commandBuffer = computeCommandBuffers[currentFrame];
-
-	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-		throw std::runtime_error("failed to record compute command buffer!");
-	}
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &computeCommandBuffers[currentFrame];
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &computeFinishedSemaphores[currentFrame];
 
+	if (type == AGL_PROCEDURAL_2D || type == AGL_PROCEDURAL_CUBEMAP)
+	{
+		if (j.contains("BaseCubemap"))
+		{
+			info.baseCubemap = aglTextureFactory::GetTexture(j["BaseCubemap"]);
+		}
 
-	VkPipelineStageFlags waitStages[ ] = { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
-	submitInfo.pWaitDstStageMask = waitStages;
 
-	if (vkQueueSubmit(computeQueue, 1, &submitInfo, computeInFlightFences[currentFrame]) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit compute command buffer!");
+		Create(aglShaderFactory::GetShader(j["Shader"]), info);
+	} else
+	{
+		Create(j["Path"], j["Format"]);
 	}
 }
 
-void agl::aglComputeShader::Create()
+agl::aglVertexFormat agl::aglVertexFormat::Standard()
 {
-	AreComputeShadersUsed = true;
-	aglShader::Create();
-
-	if (!ObjectsCreated) {
-		CreateCommandBuffers();
-		CreateSyncObjects();
-		ObjectsCreated = true;
-	}
+	return aglVertexFormat();
 }
 
-void agl::aglComputeShader::Destroy()
+agl::aglVertexFormat agl::aglVertexFormat::Compact()
 {
-	aglShader::Destroy();
+	aglVertexFormat format;
+	format.encodings[AGL_VERTEX_NORMAL] = AGL_ENCODING_OCTAHEDRAL;
+	format.encodings[AGL_VERTEX_TEXCOORD] = AGL_ENCODING_HALF;
+	return format;
 }
 
-void agl::aglComputeShader::AttachTexture(aglTexture* texture, u32 binding)
+VkFormat agl::aglVertexFormat::GetAttributeFormat(aglVertexAttribute attribute, aglVertexEncoding encoding)
 {
-	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-	samplerLayoutBinding.binding = binding;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-
-
-	VkDescriptorPoolSize samplerPoolSize{};
-
-	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-	samplerPoolSize.descriptorCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
-
-	AttachDescriptorPool(samplerPoolSize, binding);
-	AttachDescriptorSetLayout(samplerLayoutBinding, binding);
-
-	if (binding != -1)
+	switch (attribute)
+	{
+	case AGL_VERTEX_POSITION:
+		if (encoding == AGL_ENCODING_FLOAT) return VK_FORMAT_R32G32B32_SFLOAT;
+		if (encoding == AGL_ENCODING_HALF) return VK_FORMAT_R16G16B16A16_SFLOAT;
+		break;
+	case AGL_VERTEX_NORMAL:
+		if (encoding == AGL_ENCODING_FLOAT) return VK_FORMAT_R32G32B32_SFLOAT;
+		if (encoding == AGL_ENCODING_SNORM16) return VK_FORMAT_R16G16B16A16_SNORM;
+		if (encoding == AGL_ENCODING_OCTAHEDRAL) return VK_FORMAT_R16G16_SNORM;
+		break;
+	case AGL_VERTEX_TEXCOORD:
+		if (encoding == AGL_ENCODING_FLOAT) return VK_FORMAT_R32G32_SFLOAT;
+		if (encoding == AGL_ENCODING_HALF) return VK_FORMAT_R16G16_SFLOAT;
+		break;
+	case AGL_VERTEX_TANGENT:
+		if (encoding == AGL_ENCODING_FLOAT) return VK_FORMAT_R32G32B32A32_SFLOAT;
+		if (encoding == AGL_ENCODING_SNORM16) return VK_FORMAT_R16G16B16A16_SNORM;
+		break;
+	case AGL_VERTEX_COLOR:
+		if (encoding == AGL_ENCODING_FLOAT) return VK_FORMAT_R32G32B32A32_SFLOAT;
+		if (encoding == AGL_ENCODING_UNORM8) return VK_FORMAT_R8G8B8A8_UNORM;
+		break;
+	default:
+		break;
+	}
+
+	throw std::runtime_error("unsupported vertex attribute encoding!");
+}
+
+u32 agl::aglVertexFormat::GetAttributeSize(aglVertexAttribute attribute, aglVertexEncoding encoding)
+{
+	if (encoding == AGL_ENCODING_NONE)
 	{
+		return 0;
+	}
 
-		ports[binding]->texture = texture;
+	switch (GetAttributeFormat(attribute, encoding))
+	{
+	case VK_FORMAT_R32G32B32A32_SFLOAT: return 16;
+	case VK_FORMAT_R32G32B32_SFLOAT: return 12;
+	case VK_FORMAT_R32G32_SFLOAT: return 8;
+	case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+	case VK_FORMAT_R16G16B16A16_SNORM: return 8;
+	default: return 4;
 	}
 }
 
-void agl::aglComputeShader::CreateCommandBuffers()
+u32 agl::aglVertexFormat::GetStreamCount() const
 {
-	computeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = baseSurface->commandBuffer->commandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t) computeCommandBuffers.size();
-
-	if (vkAllocateCommandBuffers(device, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate compute command buffers!");
-	}
+	return splitPosition ? 2 : 1;
 }
 
-void agl::aglComputeShader::CreateSyncObjects()
+u32 agl::aglVertexFormat::GetStride(u32 stream) const
 {
-	computeFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	computeInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+	u32 stride = 0;
 
-	VkSemaphoreCreateInfo semaphoreInfo{};
-	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-	VkFenceCreateInfo fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	for (u32 i = 0; i < AGL_VERTEX_ATTRIBUTE_COUNT; ++i)
+	{
+		u32 attributeStream = splitPosition && i != AGL_VERTEX_POSITION ? 1 : 0;
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &computeFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(device, &fenceInfo, nullptr, &computeInFlightFences[i]) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create compute synchronization objects for a frame!");
+		if (attributeStream == stream)
+		{
+			stride += GetAttributeSize(static_cast<aglVertexAttribute>(i), encodings[i]);
 		}
 	}
+
+	return stride;
 }
 
-agl::aglStorageBuffer::aglStorageBuffer(aglBufferSettings settings)
+void agl::aglVertexFormat::GetInputState(std::vector<VkVertexInputBindingDescription>& bindings,
+	std::vector<VkVertexInputAttributeDescription>& attributes, bool positionOnly) const
 {
-	this->settings = settings;
+	u32 streamCount = positionOnly ? 1 : GetStreamCount();
+	u32 offsets[2] = {};
 
-	// UB creation
-
-
-	VkDeviceSize bufferSize = settings.bufferSize;
+	for (u32 stream = 0; stream < streamCount; ++stream)
+	{
+		VkVertexInputBindingDescription binding{};
+		binding.binding = stream;
+		binding.stride = GetStride(stream);
+		binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		bindings.push_back(binding);
+	}
 
-	buffers.resize(MAX_FRAMES_IN_FLIGHT);
-	bufferMemory.resize(MAX_FRAMES_IN_FLIGHT);
-	mappedBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	for (u32 i = 0; i < AGL_VERTEX_ATTRIBUTE_COUNT; ++i)
+	{
+		if (encodings[i] == AGL_ENCODING_NONE)
+		{
+			continue;
+		}
 
-	VkDevice dev = agl::GetDevice();
+		aglVertexAttribute attribute = static_cast<aglVertexAttribute>(i);
+		u32 stream = splitPosition && attribute != AGL_VERTEX_POSITION ? 1 : 0;
 
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-	{
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					 buffers[i], bufferMemory[i]);
+		// Interleaved formats still step over the other attributes when only positions are fed
+		if (!positionOnly || attribute == AGL_VERTEX_POSITION)
+		{
+			VkVertexInputAttributeDescription description{};
+			description.binding = stream;
+			description.location = i;
+			description.format = GetAttributeFormat(attribute, encodings[i]);
+			description.offset = offsets[stream];
+			attributes.push_back(description);
+		}
 
-		vkMapMemory(dev, bufferMemory[i], 0, bufferSize, 0, &mappedBuffers[i]);
+		offsets[stream] += GetAttributeSize(attribute, encodings[i]);
 	}
+}
 
+void agl::aglInstanceData::GetInputState(std::vector<VkVertexInputBindingDescription>& bindings,
+	std::vector<VkVertexInputAttributeDescription>& attributes)
+{
+	VkVertexInputBindingDescription binding{};
+	binding.binding = AGL_INSTANCE_BINDING;
+	binding.stride = sizeof(aglInstanceData);
+	binding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	bindings.push_back(binding);
 
-	if (settings.binding >= 32)
+	for (u32 column = 0; column < 4; ++column)
 	{
-		throw std::exception("Invalid binding.");
+		VkVertexInputAttributeDescription description{};
+		description.binding = AGL_INSTANCE_BINDING;
+		description.location = AGL_VERTEX_ATTRIBUTE_COUNT + column;
+		description.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		description.offset = static_cast<u32>(offsetof(aglInstanceData, transform) + sizeof(vec4) * column);
+		attributes.push_back(description);
 	}
 
+	VkVertexInputAttributeDescription material{};
+	material.binding = AGL_INSTANCE_BINDING;
+	material.location = AGL_VERTEX_ATTRIBUTE_COUNT + 4;
+	material.format = VK_FORMAT_R32_UINT;
+	material.offset = static_cast<u32>(offsetof(aglInstanceData, materialIndex));
+	attributes.push_back(material);
 }
 
-
-void agl::aglStorageBuffer::Destroy()
+static uint32_t EncodeOctahedral(vec3 n)
 {
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (length == 0.0f)
 	{
-		vkDestroyBuffer(GetDevice(), buffers[i], nullptr);
-		vkFreeMemory(GetDevice(), bufferMemory[i], nullptr);
+		return glm::packSnorm2x16(vec2(0.0f));
 	}
 
+	n /= length;
 
+	vec2 e = vec2(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		vec2 signs = vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+		e = (1.0f - glm::abs(vec2(e.y, e.x))) * signs;
+	}
 
+	return glm::packSnorm2x16(e);
 }
 
-void agl::aglStorageBuffer::AttachToShader(aglShader* shader, u32 bindingIdx)
+static void WriteAttribute(uint8_t* dst, agl::aglVertexEncoding encoding, vec4 value, u32 components)
 {
-
-	if (bindingIdx == -1)
+	switch (encoding)
 	{
-		throw new std::exception("Binding index is less than one. Invalid binding requested.");
+	case agl::AGL_ENCODING_FLOAT:
+		memcpy(dst, &value[0], components * sizeof(float));
+		break;
+	case agl::AGL_ENCODING_HALF:
+	{
+		uint32_t packed[2] = { glm::packHalf2x16(vec2(value.x, value.y)), glm::packHalf2x16(vec2(value.z, value.w)) };
+		memcpy(dst, packed, components > 2 ? 8 : 4);
+		break;
 	}
-
-	this->shader = shader;
-
-	VkDescriptorSetLayoutBinding uboLayoutBinding{};
-	uboLayoutBinding.binding = bindingIdx;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = settings.flags;
-	uboLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorPoolSize uboPoolSize{};
-
-	uboPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	uboPoolSize.descriptorCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
-
-	shader->AttachDescriptorPool(uboPoolSize, bindingIdx);
-
-	CreateBinding(uboLayoutBinding, bindingIdx);
-
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	case agl::AGL_ENCODING_SNORM16:
 	{
-		auto bufferInfo = new VkDescriptorBufferInfo;
-		bufferInfo->buffer = GetBuffer(i);
-		bufferInfo->offset = 0;
-		bufferInfo->range = settings.bufferSize;
+		uint64_t packed = glm::packSnorm4x16(value);
+		memcpy(dst, &packed, 8);
+		break;
+	}
+	case agl::AGL_ENCODING_OCTAHEDRAL:
+	{
+		uint32_t packed = EncodeOctahedral(vec3(value));
+		memcpy(dst, &packed, 4);
+		break;
+	}
+	case agl::AGL_ENCODING_UNORM8:
+	{
+		uint32_t packed = glm::packUnorm4x8(value);
+		memcpy(dst, &packed, 4);
+		break;
+	}
+	default:
+		break;
+	}
+}
 
-		VkWriteDescriptorSet* descriptorWrite;
+void agl::aglVertexFormat::Encode(const std::vector<aglVertex>& vertices, const std::vector<vec4>& tangents,
+	const std::vector<vec4>& colors, std::vector<std::vector<uint8_t>>& streams) const
+{
+	u32 streamCount = GetStreamCount();
+	u32 strides[2] = { GetStride(0), GetStride(1) };
 
+	streams.resize(streamCount);
+	for (u32 stream = 0; stream < streamCount; ++stream)
+	{
+		streams[stream].assign(static_cast<size_t>(strides[stream]) * vertices.size(), 0);
+	}
 
-		descriptorWrite = shader->CreateDescriptorSetWrite(i, bindingIdx);
-		descriptorWrite->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrite->pBufferInfo = bufferInfo;
+	for (size_t v = 0; v < vertices.size(); ++v)
+	{
+		const aglVertex& vertex = vertices[v];
+
+		vec4 values[AGL_VERTEX_ATTRIBUTE_COUNT] = {
+			vec4(vertex.position, 1.0f),
+			vec4(vertex.normal, 0.0f),
+			vec4(vertex.texCoord, 0.0f, 0.0f),
+			v < tangents.size() ? tangents[v] : vec4(1.0f, 0.0f, 0.0f, 1.0f),
+			v < colors.size() ? colors[v] : vec4(1.0f)
+		};
+		// Float positions and normals are vec3, float texcoords vec2
+		u32 components[AGL_VERTEX_ATTRIBUTE_COUNT] = { 3, 3, 2, 4, 4 };
 
-		shader->AttachDescriptorWrite(descriptorWrite, i, bindingIdx);
-	}
+		u32 offsets[2] = {};
 
-}
+		for (u32 i = 0; i < AGL_VERTEX_ATTRIBUTE_COUNT; ++i)
+		{
+			if (encodings[i] == AGL_ENCODING_NONE)
+			{
+				continue;
+			}
 
-void agl::aglStorageBuffer::CreateBinding(VkDescriptorSetLayoutBinding bind, int bindingIdx)
-{
-	binding = bind;
-	shader->AttachDescriptorSetLayout(binding, bindingIdx);
-}
+			u32 stream = splitPosition && i != AGL_VERTEX_POSITION ? 1 : 0;
+			uint8_t* dst = streams[stream].data() + v * strides[stream] + offsets[stream];
 
+			WriteAttribute(dst, encodings[i], values[i], components[i]);
 
-void agl::aglStorageBuffer::CreatePoolSize(VkDescriptorPoolSize poolSz, int bindingIdx)
-{
-	poolSize = poolSz;
-	shader->AttachDescriptorPool(poolSize, bindingIdx);
+			offsets[stream] += GetAttributeSize(static_cast<aglVertexAttribute>(i), encodings[i]);
+		}
+	}
 }
 
-VkBuffer agl::aglStorageBuffer::GetBuffer(int frame)
+bool agl::aglVertexFormat::operator==(const aglVertexFormat& other) const
 {
-	return buffers[frame];
+	return splitPosition == other.splitPosition && std::equal(std::begin(encodings), std::end(encodings), std::begin(other.encodings));
 }
 
-void agl::aglStorageBuffer::Update(void* data, size_t dataSize)
+agl::aglMesh* agl::aglMesh::GrabMesh(std::string path, int idx)
 {
-	int bufferSize = settings.bufferSize;
-
 
-	memcpy(mappedBuffers[currentFrame], data, dataSize);
+	aglModel model(path);
 
+	return model.meshes[idx];
 }
 
-void* agl::aglStorageBuffer::GetData()
+agl::aglMesh::aglMesh(aiMesh* mesh, string path, int idx, aglUploadBatch* batch)
 {
-	return mappedBuffers[currentFrame];
-}
+	this->path = path;
+	this->meshIndex = idx;
 
+	Convert(mesh);
+	Setup(batch);
+}
 
-void agl::aglTextureFactory::InsertTexture(aglTexture* texture, u32 desiredId)
+void agl::aglMesh::Convert(aiMesh* mesh)
 {
+	u32 vertexCount = mesh->mNumVertices;
 
-	u32 id = desiredId;
+	bool hasNormals = mesh->HasNormals();
+	bool hasTexCoords = mesh->HasTextureCoords(0);
+	// Only kept when the format uploads them
+	bool keepTangents = mesh->HasTangentsAndBitangents() && format.encodings[AGL_VERTEX_TANGENT] != AGL_ENCODING_NONE;
+	bool keepColors = mesh->HasVertexColors(0) && format.encodings[AGL_VERTEX_COLOR] != AGL_ENCODING_NONE;
 
-	if (id == -1)
-	{
-		id = LoadedTextures.size();
-		LoadedTextures.resize(LoadedTextures.size() + 1);
-	}
+	vertices.resize(vertexCount);
 
-	if (id >= LoadedTextures.size())
+	for (u32 j = 0; j < vertexCount; ++j)
 	{
-		LoadedTextures.resize(id + 1);
-	}
+		const aiVector3D& v = mesh->mVertices[j];
 
-	texture->id = id;
+		aglVertex& vtx = vertices[j];
+		vtx.position = vec3(v.x, v.y, v.z);
+		vtx.normal = hasNormals ? vec3(mesh->mNormals[j].x, mesh->mNormals[j].y, mesh->mNormals[j].z) : vec3(0.0f);
+		vtx.texCoord = hasTexCoords ? vec2(mesh->mTextureCoords[0][j].x, mesh->mTextureCoords[0][j].y) : vec2(0.0f);
+	}
 
-	LoadedTextures[id] = texture;
+	if (keepTangents)
+	{
+		tangents.resize(vertexCount);
 
-}
+		for (u32 j = 0; j < vertexCount; ++j)
+		{
+			const aiVector3D& tan = mesh->mTangents[j];
+			const aiVector3D& bitan = mesh->mBitangents[j];
+			vec3 tangent(tan.x, tan.y, tan.z);
 
-nlohmann::json agl::aglTextureFactory::Serialize()
-{
-	nlohmann::json j = json::object();
+			float handedness = glm::dot(glm::cross(vertices[j].normal, tangent), vec3(bitan.x, bitan.y, bitan.z)) < 0.0f ? -1.0f : 1.0f;
+			tangents[j] = vec4(tangent, handedness);
+		}
+	}
 
-	for (auto loaded_texture : LoadedTextures)
+	if (keepColors)
 	{
+		colors.resize(vertexCount);
 
-		j["LoadedTextures"][loaded_texture->id] = loaded_texture->Serialize();
+		for (u32 j = 0; j < vertexCount; ++j)
+		{
+			const aiColor4D& c = mesh->mColors[0][j];
+			colors[j] = vec4(c.r, c.g, c.b, c.a);
+		}
 	}
 
-	return j;
-}
-
-void agl::aglTextureFactory::Load(nlohmann::json j)
-{
-
-	data = j;
+	indices.reserve(mesh->mNumFaces * 3);
 
-	for (auto t : j["LoadedTextures"])
+	for (u32 j = 0; j < mesh->mNumFaces; ++j)
 	{
-		if (LoadedTextures[t["Id"]] == nullptr) {
+		const aiFace& face = mesh->mFaces[j];
+		indices.insert(indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
+	}
 
-			aglTextureCreationInfo info = { 1,1,1 };
+	materialIndex = mesh->mMaterialIndex;
 
-			info.desiredId = t["Id"];
+	if (optimizeOnImport)
+	{
+		Optimize();
+	}
 
-			aglTexture* tex = new aglTexture(info);
-			tex->Load(t);
-			LoadedTextures[t["Id"]] = tex;
-		}
+	if (importLodCount > 1)
+	{
+		GenerateLods(importLodCount);
 	}
 }
 
-agl::aglTexture* agl::aglTextureFactory::GetTexture(u32 id)
+agl::aglMesh::aglMesh(aglMeshCreationData data, aglUploadBatch* batch)
 {
+	indices = data.indices;
+	vertices = data.vertices;
+	tangents = data.tangents;
+	colors = data.colors;
+	format = data.format;
 
-	if (LoadedTextures.size() <= id || LoadedTextures[id] == nullptr)
-	{
-		aglTextureCreationInfo info = { 1,1,1 };
-
-		info.desiredId = id;
-
-		aglTexture* tex = new aglTexture(info);
-		tex->Load(data["LoadedTextures"].at(id));
-		return tex;
-	}
-
-	return LoadedTextures[id];
+	Setup(batch);
 }
 
-void agl::aglTextureFactory::SetData(json j)
+void agl::aglMesh::Draw(VkCommandBuffer commandBuffer, u32 imageIndex, u32 lod)
 {
-	data = j;
+	aglMeshArena::Bind(commandBuffer, vertexRange.page, indexType);
+
+	//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+
+	DrawBound(commandBuffer, lod);
 }
 
-agl::aglTexture::aglTexture(string path, VkFormat format)
+void agl::aglMesh::DrawBound(VkCommandBuffer commandBuffer, u32 lod, u32 instanceCount, u32 firstInstance)
 {
-	Create(path, format);
+	if (format.splitPosition)
+	{
+		// The streams have different strides, so they can't share a vertexOffset
+		VkBuffer buffer = aglMeshArena::GetVertexBuffer(vertexRange.page);
+		VkBuffer buffers[] = { buffer, buffer };
+		VkDeviceSize offsets[] = { vertexRange.offset, attributeRange.offset };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+	}
 
-	aglTextureFactory::InsertTexture(this, -1);
+	VkDrawIndexedIndirectCommand command = GetDrawCommand(lod, instanceCount, firstInstance);
 
+	vkCmdDrawIndexed(commandBuffer, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
 }
 
-agl::aglTexture::aglTexture(aglShader* shader, aglTextureCreationInfo info)
+VkDrawIndexedIndirectCommand agl::aglMesh::GetDrawCommand(u32 lod, u32 instanceCount, u32 firstInstance) const
 {
-	Create(shader, info);
+	const Lod& level = lods[std::min(lod, static_cast<u32>(lods.size()) - 1)];
 
-	aglTextureFactory::InsertTexture(this, info.desiredId);
+	VkDrawIndexedIndirectCommand command{};
+	command.indexCount = level.indexCount;
+	command.instanceCount = instanceCount;
+	command.firstIndex = static_cast<u32>(indexRange.offset / (indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4)) + level.firstIndex;
+	// Split formats bind the mesh's streams at its offsets instead
+	command.vertexOffset = format.splitPosition ? 0 : static_cast<int32_t>(vertexRange.offset / format.GetStride(0));
+	command.firstInstance = firstInstance;
+
+	return command;
 }
 
-agl::aglTexture::aglTexture(aglTextureCreationInfo info)
+void agl::aglMesh::Optimize()
 {
-	aglTextureFactory::InsertTexture(this, info.desiredId);
+	acmrBefore = aglMeshOptimizer::ComputeACMR(indices, vertices.size());
 
-	this->info = info;
+	aglMeshOptimizer::OptimizeVertexCache(indices, vertices.size());
+	aglMeshOptimizer::OptimizeOverdraw(indices, vertices);
 
-	VkDeviceSize imageSize = info.width * info.height * 4;
+	std::vector<uint32_t> remap = aglMeshOptimizer::OptimizeVertexFetch(indices, vertices.size());
 
-	width = info.width;
-	height = info.height;
-	channels = info.channels;
+	size_t usedCount = 0;
+	for (uint32_t index : remap)
+	{
+		if (index != UINT32_MAX)
+		{
+			usedCount++;
+		}
+	}
 
-  	format = VK_FORMAT_R8G8B8A8_SRGB;
+	aglMeshOptimizer::Remap(vertices, remap, usedCount);
+	aglMeshOptimizer::Remap(tangents, remap, usedCount);
+	aglMeshOptimizer::Remap(colors, remap, usedCount);
 
-	std::vector<VkBufferImageCopy> bufferCopyRegions;
-	uint32_t offset = 0;
+	acmrAfter = aglMeshOptimizer::ComputeACMR(indices, vertices.size());
+}
 
-	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+void agl::aglMesh::GenerateLods(u32 lodCount, float reduction, float maxError)
+{
+	// Levels are always rebuilt from the full mesh
+	u32 baseCount = lods.empty() ? static_cast<u32>(indices.size()) : lods[0].indexCount;
+	indices.resize(baseCount);
+	lods = { { 0, baseCount, 0.0f } };
 
-	if (info.computeTexture)
+	if (vertices.empty())
 	{
-		usage |= VK_IMAGE_USAGE_STORAGE_BIT;
-		format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		return;
 	}
 
-	CreateVulkanImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, false);
+	ComputeBounds();
 
-	TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, true,1);
-	TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, true,1);
+	vec3 extents = boundsMax - boundsMin;
+	float extent = std::max(extents.x, std::max(extents.y, extents.z));
 
-	textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT, false);
-	CreateTextureSampler();
+	std::vector<unsigned> source = indices;
+	float error = 0.0f;
 
-	if (info.isCubemap)
+	for (u32 i = 1; i < lodCount; ++i)
 	{
-		type = AGL_TEXTURE_CUBEMAP;
-	}
-}
+		size_t target = static_cast<size_t>(source.size() / 3 * reduction) * 3;
 
-void agl::aglTexture::Create(std::string path, VkFormat format)
-{
-	this->path = path;
-	int texWidth, texHeight, texChannels;
+		float levelError = 0.0f;
+		std::vector<unsigned> level = aglMeshOptimizer::Simplify(source, vertices, target, maxError, &levelError);
 
-	stbi_set_flip_vertically_on_load(true);
+		// Not worth a level if simplification stalled
+		if (level.empty() || level.size() > source.size() * 9 / 10)
+		{
+			break;
+		}
 
-	stbi_uc* pixels = stbi_load(path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
+		aglMeshOptimizer::OptimizeVertexCache(level, vertices.size());
 
-	if (!pixels) {
-		throw std::runtime_error("failed to load texture image!");
-	}
+		// Each level is simplified from the previous one, so their errors add up
+		error += levelError * extent;
 
-	width = texWidth;
-	height = texHeight;
-	channels = texChannels;
-	this->format = format;
+		lods.push_back({ static_cast<u32>(indices.size()), static_cast<u32>(level.size()), error });
+		indices.insert(indices.end(), level.begin(), level.end());
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+		source = std::move(level);
+	}
+}
 
-	CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+void agl::aglMesh::ReleaseCpuData(aglMeshCpuData policy)
+{
+	if (policy == AGL_MESH_CPU_KEEP)
+	{
+		return;
+	}
 
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(device, stagingBufferMemory);
+	// Swapped with empty vectors, clear keeps the capacity
+	std::vector<aglVertex>().swap(vertices);
+	std::vector<unsigned>().swap(indices);
+	std::vector<vec4>().swap(tangents);
+	std::vector<vec4>().swap(colors);
 
-	stbi_image_free(pixels);
+	if (policy == AGL_MESH_CPU_DROP)
+	{
+		boundsCenter = boundsMin = boundsMax = vec3(0.0f);
+		boundsRadius = 0.0f;
+	}
 
-	std::vector<VkBufferImageCopy> bufferCopyRegions;
-	uint32_t offset = 0;
+	cpuData = std::max(cpuData, policy);
+}
 
-	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+bool agl::aglMesh::RequireCpuData()
+{
+	if (cpuData == AGL_MESH_CPU_KEEP)
+	{
+		return true;
+	}
 
-	CreateVulkanImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, false);
+	if (!aglMeshCache::LoadMeshData(*this))
+	{
+		return false;
+	}
 
-	TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, true, 1);
-	CopyBufferToImage(stagingBuffer, textureImage, static_cast<u32>(texWidth), static_cast<u32>(texHeight), bufferCopyRegions.size(), bufferCopyRegions.data());
-	TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, true, 1);
+	ComputeBounds();
+	cpuData = AGL_MESH_CPU_KEEP;
+	return true;
+}
 
-	vkDestroy(vkDestroyBuffer, stagingBuffer);
-	vkDestroy(vkFreeMemory, stagingBufferMemory);
+void agl::aglMesh::ComputeBounds()
+{
+	ComputeBounds(vertices.data(), vertices.size());
+}
 
-	textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT, false);
-	CreateTextureSampler();
+void agl::aglMesh::ComputeBounds(const aglVertex* source, size_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
 
-	this->info = info;
+	vec3 minimum = source[0].position;
+	vec3 maximum = source[0].position;
+	for (size_t i = 0; i < count; ++i)
+	{
+		minimum = glm::min(minimum, source[i].position);
+		maximum = glm::max(maximum, source[i].position);
+	}
+
+	boundsMin = minimum;
+	boundsMax = maximum;
+	boundsCenter = (minimum + maximum) * 0.5f;
+	boundsRadius = 0.0f;
+	for (size_t i = 0; i < count; ++i)
+	{
+		boundsRadius = std::max(boundsRadius, glm::length(source[i].position - boundsCenter));
+	}
 }
 
-void agl::aglTexture::Create(aglShader* shader, aglTextureCreationInfo info)
+glm::vec4 agl::aglMesh::GetBoundingSphere(const glm::mat4& transform) const
 {
-	sourceShader = shader;
-
-	width = info.width;
-	height = info.height;
-	channels = info.channels;
-	
+	// Large enough to pass every plane, small enough to stay finite once projected
+	if (boundsRadius <= 0.0f)
+	{
+		return vec4(vec3(transform[3]), 1e30f);
+	}
 
-	VkDeviceSize imageSize = info.width * info.height * info.channels;
-	const uint32_t numMips = static_cast<uint32_t>(floor(log2(static_cast<double>(width)))) + 1;
+	float scale = std::max(glm::length(vec3(transform[0])), std::max(glm::length(vec3(transform[1])), glm::length(vec3(transform[2]))));
 
-	VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	return vec4(vec3(transform * vec4(boundsCenter, 1.0f)), boundsRadius * scale);
+}
 
-	VkImageLayout layout;
+void agl::aglMesh::Destroy()
+{
+	std::array<aglMeshArena::Range, 2> streams = { vertexRange, attributeRange };
+	aglMeshArena::Range indices = indexRange;
 
-	if (info.isCubemap)
+	aglDeletionQueue::Push([streams, indices]
 	{
-		usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	}
-	else {
-		usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-		layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	}
+		aglMeshArena::Free(2, streams.data(), indices);
+	});
+
+	vertexRange = {};
+	attributeRange = {};
+	indexRange = {};
+}
 
+void agl::aglMeshArena::Create(VkDeviceSize vertexPageSize, VkDeviceSize indexPageSize)
+{
+	aglMeshArena::vertexPageSize = vertexPageSize;
+	aglMeshArena::indexPageSize = indexPageSize;
+}
 
+void agl::aglMeshArena::AddPage(VkDeviceSize vertexSize, VkDeviceSize indexSize)
+{
+	Page page;
 
+	CreateBuffer(vertexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, page.vertexBuffer, page.vertexMemory, AGL_MEMORY_MESH);
+	CreateBuffer(indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, page.indexBuffer, page.indexMemory, AGL_MEMORY_MESH);
 
-	CreateVulkanImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, info.isCubemap, numMips);
+	page.vertexRanges.Reset(vertexSize);
+	page.indexRanges.Reset(indexSize);
 
-	textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT, info.isCubemap, numMips);
+	pages.push_back(std::move(page));
+}
 
-	CreateTextureSampler(static_cast<float>(numMips));
+void agl::aglMeshArena::Allocate(u32 streamCount, const VkDeviceSize* streamSizes, const VkDeviceSize* streamStrides,
+	Range* streams, VkDeviceSize indexSize, VkDeviceSize indexStride, Range& indices)
+{
+	std::lock_guard<std::mutex> lock(mutex);
 
-	aglFramebuffer* fbo = new aglFramebuffer();
-	if (info.isCubemap)
+	VkDeviceSize vertexSize = 0;
+	for (u32 stream = 0; stream < streamCount; ++stream)
 	{
-		fbo = new aglFramebuffer(width, height, aglFramebufferCreationSettings{ format , VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT });
+		vertexSize += streamSizes[stream] + streamStrides[stream];
 	}
-	else
+
+	for (u32 i = 0; i <= pages.size(); ++i)
 	{
-		fbo->imageFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
-	}
-	fbo->extent = VkExtent2D{ (u32) width,(u32) height };
-	if (!info.isCubemap) {
-		fbo->images.push_back(textureImage);
-	}
+		if (i == pages.size())
+		{
+			// Oversized meshes get a page of their own
+			AddPage(std::max(vertexPageSize, vertexSize), std::max(indexPageSize, indexSize));
+		}
 
-	vector<VkSubpassDependency> dependencies;
+		Page& page = pages[i];
 
-	dependencies.resize(2);
+		u32 allocated = 0;
+		for (; allocated < streamCount; ++allocated)
+		{
+			VkDeviceSize offset;
+			if (!page.vertexRanges.TryAllocate(streamSizes[allocated], streamStrides[allocated], offset))
+			{
+				break;
+			}
 
-	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependencies[0].dstSubpass = 0;
-	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-	dependencies[1].srcSubpass = 0;
-	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+			streams[allocated] = { i, offset, streamSizes[allocated] };
+		}
 
-	fbo->CreateFramebuffers({ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, dependencies });
-	if (info.isCubemap)
-	{
-		TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1, true, numMips);
-	}
-	else
-	{
-		TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1, true, numMips);
-	}
+		VkDeviceSize indexOffset;
+		if (allocated < streamCount || !page.indexRanges.TryAllocate(indexSize, indexStride, indexOffset))
+		{
+			for (u32 stream = 0; stream < allocated; ++stream)
+			{
+				page.vertexRanges.Release(streams[stream].offset, streams[stream].size);
+			}
+			continue;
+		}
 
-	// Pipeline layout
-	struct PushBlock {
-		glm::mat4 mvp;
-		int drawId = 0;
-		int mipId = 0;
-		int mipCount = 0;
-	} pushBlock;
+		indices = { i, indexOffset, indexSize };
+		return;
+	}
+}
 
-	glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-	glm::mat4 captureViews[ ] =
+void agl::aglMeshArena::Free(u32 streamCount, const Range* streams, const Range& indices)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (u32 stream = 0; stream < streamCount; ++stream)
 	{
-	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),
-	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),
-	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-	   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
-	};
+		if (streams[stream].size > 0)
+		{
+			pages[streams[stream].page].vertexRanges.Release(streams[stream].offset, streams[stream].size);
+		}
+	}
 
+	if (indices.size > 0)
+	{
+		pages[indices.page].indexRanges.Release(indices.offset, indices.size);
+	}
+}
 
-	if (info.isCubemap) {
+VkBuffer agl::aglMeshArena::GetVertexBuffer(u32 page)
+{
+	std::lock_guard<std::mutex> lock(mutex);
 
-		shader->pushConstant = new aglPushConstant();
-		shader->pushConstant->flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-		shader->pushConstant->size = sizeof(pushBlock);
-		shader->AttachTexture(info.baseCubemap, shader->GetBindingByName("equirectangularMap"));
-	}
+	return pages[page].vertexBuffer;
+}
 
+VkBuffer agl::aglMeshArena::GetIndexBuffer(u32 page)
+{
+	std::lock_guard<std::mutex> lock(mutex);
 
-	shader->settings.renderPass = fbo->renderPass;
+	return pages[page].indexBuffer;
+}
 
-	shader->Setup();
+void agl::aglMeshArena::Bind(VkCommandBuffer commandBuffer, u32 page, VkIndexType indexType)
+{
+	VkBuffer vertexBuffer, indexBuffer;
 
-	int layerCount = 1;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
 
-	if (info.isCubemap) {
-		layerCount = 6;
-		TransitionImageLayout(textureImage, fbo->imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerCount, true, numMips);
+		vertexBuffer = pages[page].vertexBuffer;
+		indexBuffer = pages[page].indexBuffer;
 	}
 
-	VkCommandBuffer cmd = baseSurface->commandBuffer->BeginSingleTimeCommands();
-
-	fbo->renderPass->commandBuffer = new aglCommandBuffer;
-	fbo->renderPass->commandBuffer->commandBuffers[0] = cmd;
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+}
 
-	if (info.isCubemap) {
+void agl::aglMeshArena::Destroy()
+{
+	for (Page& page : pages)
+	{
+		vkDestroyBuffer(device, page.vertexBuffer, nullptr);
+		vkDestroyBuffer(device, page.indexBuffer, nullptr);
+		aglAllocator::Free(page.vertexMemory);
+		aglAllocator::Free(page.indexMemory);
+	}
 
-		for (int m = 0; m < numMips; ++m)
-		{
-			for (int i = 0; i < 6; ++i)
-			{
-				fbo->extent.width = static_cast<float>(width * std::pow(0.5f, m));
-				fbo->extent.height = static_cast<float>(height * std::pow(0.5f, m));
+	pages.clear();
+}
 
-				pushBlock.mvp = captureProjection * captureViews[i];
-				pushBlock.drawId = i;
-				pushBlock.mipId = m;
-				pushBlock.mipCount = numMips;
+void agl::aglMesh::ExportAsCode(aglMesh* mesh, string path)
+{
+	bool success = false;
 
-				shader->pushConstant->data = &pushBlock;
-				shader->pushConstant->size = sizeof(pushBlock);
+	if (!mesh->RequireCpuData())
+	{
+		cout << "Mesh data was released and isn't in the mesh cache: " << mesh->path << endl;
+		return;
+	}
 
-				fbo->Bind(0, cmd);
+#ifndef TEXT_BYTES_PER_LINE
+#define TEXT_BYTES_PER_LINE     20
+#endif
 
-				shader->BindGraphicsPipeline(cmd);
+	// NOTE: Text data buffer size is fixed to 64MB
+	char* txtData = (char*) calloc(64 * 1024 * 1024, sizeof(char));  // 64 MB
 
-				((aglPrimitives*) agl_ext::installedExtensions[AGL_EXTENSION_PRIMITIVES_LAYER_NAME])->GetPrims()[aglPrimitives::CUBE]->Draw(cmd, 0);
+	int byteCount = 0;
+	byteCount += sprintf(txtData + byteCount, "////////////////////////////////////////////////////////////////////////////////////////\n");
+	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
+	byteCount += sprintf(txtData + byteCount, "// MeshAsCode exporter v1.0 - Mesh vertex data exported as arrays                     //\n");
+	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
+	byteCount += sprintf(txtData + byteCount, "// more info and bugs-report:  github.com/raysan5/raylib                              //\n");
+	byteCount += sprintf(txtData + byteCount, "// feedback and support:       ray[at]raylib.com                                      //\n");
+	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
+	byteCount += sprintf(txtData + byteCount, "// Copyright (c) 2023 Ramon Santamaria (@raysan5)                                     //\n");
+	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
+	byteCount += sprintf(txtData + byteCount, "////////////////////////////////////////////////////////////////////////////////////////\n\n");
 
-				fbo->renderPass->End(cmd);
+	// Get file name from path and convert variable name to uppercase
+	char varFileName[256] = { 0 };
+	strcpy(varFileName, GetFileNameWithoutExt(path).c_str());
+	for (int i = 0; varFileName[i] != '\0'; i++) if ((varFileName[i] >= 'a') && (varFileName[i] <= 'z')) { varFileName[i] = varFileName[i] - 32; }
 
-				TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 1, false, numMips);
 
-				CopyImageToImage(textureImage, fbo->images[0], i, 1, fbo->extent.width, fbo->extent.height, false, 0, m);
+	vector<float> vertices;
+	vector<float> normals;
+	vector<float> texCoords;
 
-				TransitionImageLayout(fbo->images[0], fbo->imageFormat, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1, false, numMips);
-			}
+	for (auto vertex : mesh->vertices)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			vertices.push_back(vertex.position[i]);
+		}
+		for (int i = 0; i < 3; ++i)
+		{
+			normals.push_back(vertex.normal[i]);
+		}
+		for (int i = 0; i < 2; ++i)
+		{
+			texCoords.push_back(vertex.texCoord[i]);
 		}
-
 	}
-	else
-	{
-		fbo->Bind(0, cmd);
 
-		shader->BindGraphicsPipeline(cmd);
+	// Only the full mesh, the other LODs follow it in indices
+	size_t firstIndex = mesh->lods.empty() ? 0 : mesh->lods[0].firstIndex;
+	size_t indicesCount = mesh->lods.empty() ? mesh->indices.size() : mesh->lods[0].indexCount;
 
-		((aglPrimitives*) agl_ext::installedExtensions[AGL_EXTENSION_PRIMITIVES_LAYER_NAME])->GetPrims()[aglPrimitives::QUAD]->Draw(cmd, 0);
 
-		fbo->renderPass->End(cmd);
-	}
+	// Add image information
+	byteCount += sprintf(txtData + byteCount, "// Mesh basic information\n");
+	byteCount += sprintf(txtData + byteCount, "#define %s_VERTEX_COUNT    %i\n", varFileName, static_cast<int>(mesh->vertices.size()));
+	byteCount += sprintf(txtData + byteCount, "#define %s_TRIANGLE_COUNT   %i\n\n", varFileName, static_cast<int>(indicesCount/3));
 
-	if (info.isCubemap) {
-		TransitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, false, numMips);
-	}
-	else
-	{
-		TransitionImageLayout(fbo->images[0], format, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, false, numMips);
-	}
+	byteCount += sprintf(txtData + byteCount, "static float %s_VERTEX_DATA[%i] = { ", varFileName, static_cast<int>(mesh->vertices.size() * 3));
+	for (int i = 0; i < mesh->vertices.size() * 3 - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%.3ff,\n" : "%.3ff, "), vertices[i]);
+	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", vertices[mesh->vertices.size() * 3 - 1]);
 
-	baseSurface->commandBuffer->EndSingleTimeCommands(cmd);
+	byteCount += sprintf(txtData + byteCount, "static float %s_NORMAL_DATA[%i] = { ", varFileName, static_cast<int>(mesh->vertices.size() * 3));
+	for (int i = 0; i < mesh->vertices.size() * 3 - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%.3ff,\n" : "%.3ff, "), normals[i]);
+	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", normals[mesh->vertices.size() * 3 - 1]);
 
+	byteCount += sprintf(txtData + byteCount, "static float %s_TEXCOORD_DATA[%i] = { ", varFileName, static_cast<int>(mesh->vertices.size() * 2));
+	for (int i = 0; i < mesh->vertices.size() * 2 - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%.3ff,\n" : "%.3ff, "), texCoords[i]);
+	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", texCoords[mesh->vertices.size() * 2 - 1]);
 
-	if (!info.isCubemap) {
-		textureImage = fbo->images[0];
-		textureImageView = fbo->imageViews[0];
-		CreateTextureSampler();
-	}
-	else {
+	byteCount += sprintf(txtData + byteCount, "static float %s_INDEX_DATA[%i] = { ", varFileName, static_cast<int>(indicesCount));
+	for (int i = 0; i < indicesCount - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%i,\n" : "%i, "), mesh->indices[firstIndex + i]);
+	byteCount += sprintf(txtData + byteCount, "%i };\n\n", mesh->indices[firstIndex + indicesCount - 1]);
 
-	}
+	//-----------------------------------------------------------------------------------------
 
-	if (info.isCubemap)
-	{
-		type = AGL_PROCEDURAL_CUBEMAP;
-	}
-	else
-	{
-		type = AGL_PROCEDURAL_2D;
-	}
+	// NOTE: Text data size exported is determined by '\0' (NULL) character
+	success = WriteString(path, txtData);
 
-	this->info = info;
+	free(txtData);
+
+	//if (success != 0) TRACELOG(LOG_INFO, "FILEIO: [%s] Image as code exported successfully", fileName);
+	//else TRACELOG(LOG_WARNING, "FILEIO: [%s] Failed to export image as code", fileName);
 }
 
-VkImageView agl::aglTexture::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
-                                             bool isCubemap, u32 mipCount)
+void agl::aglMesh::Setup(aglUploadBatch* batch)
 {
-	VkImageViewCreateInfo viewInfo{};
-	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	viewInfo.image = image;
-	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	viewInfo.format = format;
-	viewInfo.subresourceRange = VkImageSubresourceRange{ aspectFlags, 0,mipCount,0,1 };
+	std::vector<std::vector<uint8_t>> streams;
+	format.Encode(vertices, tangents, colors, streams);
 
-	if (isCubemap)
+	const uint8_t* streamData[2] = {};
+	VkDeviceSize streamSizes[2] = {};
+
+	for (u32 stream = 0; stream < format.GetStreamCount(); ++stream)
 	{
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-		viewInfo.subresourceRange.layerCount = 6;
+		streamData[stream] = streams[stream].data();
+		streamSizes[stream] = streams[stream].size();
 	}
 
-	VkImageView imageView;
-	if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+	indexType = vertices.size() <= UINT16_MAX + 1 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	std::vector<uint16_t> shortIndices;
+	const void* indexData = indices.data();
+
+	if (indexType == VK_INDEX_TYPE_UINT16)
 	{
-		throw std::runtime_error("Failed to create texture image view");
+		shortIndices.assign(indices.begin(), indices.end());
+		indexData = shortIndices.data();
 	}
 
-	return imageView;
+	ComputeBounds();
+	Upload(batch, streamData, streamSizes, indexData, static_cast<u32>(indices.size()));
 }
 
-void agl::aglTexture::CreateVulkanImage(u32 width, u32 height, VkFormat format, VkImageTiling tiling,
-	VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory,
-	bool isCubemap, u32 mipCount)
+void agl::aglMesh::Upload(aglUploadBatch* batch, const uint8_t* const* streamData, const VkDeviceSize* streamSizes, const void* indexData, u32 indexCount)
 {
-	VkImageCreateInfo imageInfo{};
-	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	imageInfo.imageType = VK_IMAGE_TYPE_2D;
-	imageInfo.extent.width = width;
-	imageInfo.extent.height = height;
-	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = mipCount;
-	imageInfo.arrayLayers = 1;
-	imageInfo.format = format;
-	imageInfo.tiling = tiling;
-	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	imageInfo.usage = usage;
-	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	if (isCubemap)
+	if (lods.empty())
 	{
-		imageInfo.arrayLayers = 6;
-		imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-	}
-
-	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create image!");
+		lods = { { 0, indexCount, 0.0f } };
 	}
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, image, &memRequirements);
+	aglUploadBatch localBatch;
+	aglUploadBatch* upload = batch ? batch : &localBatch;
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+	u32 streamCount = format.GetStreamCount();
+	VkDeviceSize streamStrides[2] = { 1, 1 };
+	aglMeshArena::Range streamRanges[2];
 
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
+	for (u32 stream = 0; stream < streamCount; ++stream)
+	{
+		streamStrides[stream] = format.GetStride(stream);
 	}
 
-	vkBindImageMemory(device, image, imageMemory, 0);
-}
+	VkDeviceSize indexStride = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	VkDeviceSize indexSize = indexStride * indexCount;
 
-void agl::aglTexture::CreateTextureSampler(float numMips)
-{
-	VkSamplerCreateInfo samplerInfo{};
+	aglMeshArena::Allocate(streamCount, streamSizes, streamStrides, streamRanges, indexSize, indexStride, indexRange);
 
-	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerInfo.magFilter = VK_FILTER_LINEAR;
-	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	vertexRange = streamRanges[0];
+	attributeRange = streamRanges[1];
 
-	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	for (u32 stream = 0; stream < streamCount; ++stream)
+	{
+		aglStagingRing::Allocation staging = upload->Stage(streamData[stream], streamSizes[stream]);
 
-	samplerInfo.anisotropyEnable = VK_FALSE;
+		upload->CopyBuffer(staging.buffer, aglMeshArena::GetVertexBuffer(streamRanges[stream].page), streamSizes[stream], staging.offset, streamRanges[stream].offset);
+	}
 
-	VkPhysicalDeviceProperties properties{};
-	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	{
+		aglStagingRing::Allocation staging = upload->Stage(indexData, indexSize);
 
-	samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+		upload->CopyBuffer(staging.buffer, aglMeshArena::GetIndexBuffer(indexRange.page), indexSize, staging.offset, indexRange.offset);
+	}
 
-	samplerInfo.compareEnable = VK_FALSE;
-	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	localBatch.Destroy();
+}
 
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerInfo.mipLodBias = 0.0f;
-	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = numMips;
+void agl::aglModel::Draw(aglCommandBuffer* commandBuffer, u32 imageIndex, const glm::mat4& transform)
+{
+	// LODs are picked and meshes culled here, the camera belongs to the application thread
+	std::vector<u32> meshLods;
+	SelectMeshLods(transform, meshLods);
 
-	if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create texture sampler!");
+	if (aglRenderThread::IsCapturing())
+	{
+		// The mesh list is copied along with the LODs it was selected for
+		Record([drawn = meshes, meshLods = std::move(meshLods)](VkCommandBuffer cmdBuf)
+		{
+			DrawMeshes(cmdBuf, drawn, meshLods.data());
+		});
+		return;
 	}
+
+	DrawMeshes(commandBuffer->GetCommandBuffer(imageIndex), meshLods.data());
 }
 
-nlohmann::json agl::aglTexture::Serialize()
+void agl::aglModel::DrawMeshes(VkCommandBuffer cmdBuf, const glm::mat4& transform)
 {
-	nlohmann::json j = json::object();
+	std::vector<u32> meshLods;
+	SelectMeshLods(transform, meshLods);
 
-	bool isCB = (info.baseCubemap != nullptr);
+	DrawMeshes(cmdBuf, meshLods.data());
+}
 
-	j["Type"] = json::number_float_t(type);
-	j["Path"] = path;
-	j["Info"] = {
-		{"Width", width},
-		{"Height", height},
-		{"Channels", channels},
-		{"IsCubemap", isCB}
-	};
-	j["Format"] = json::number_float_t(format);
-	j["Id"] = json::number_float_t(id);
+void agl::aglModel::SelectMeshLods(const glm::mat4& transform, std::vector<u32>& meshLods)
+{
+	static thread_local aglCullingArray spheres;
+	static thread_local std::vector<uint8_t> visible;
 
+	meshLods.resize(meshes.size());
 
-	if (type == AGL_PROCEDURAL_2D || type == AGL_PROCEDURAL_CUBEMAP)
+	if (frustumCulling)
 	{
-		j["Shader"] = json::number_float_t(sourceShader->id);
-		if (info.baseCubemap) {
-			j["BaseCubemap"] = json::number_float_t(info.baseCubemap->id);
+		spheres.Clear();
+		for (aglMesh* mesh : meshes)
+		{
+			spheres.Add(mesh->GetBoundingSphere(transform));
 		}
+
+		aglRenderQueue::CullSpheres(spheres, visible);
+	}
+	else
+	{
+		visible.assign(meshes.size(), 1);
 	}
 
-	return j;
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		meshLods[i] = visible[i] ? aglRenderQueue::SelectLod(meshes[i], transform) : CULLED;
+	}
 }
 
-void agl::aglTexture::Load(nlohmann::json j)
+void agl::aglModel::DrawMeshes(VkCommandBuffer cmdBuf, const u32* meshLods)
 {
-	type = j["Type"];
-	path = j["Path"];
-	info = {
-		j["Info"]["Width"],
-		j["Info"]["Height"],
-		j["Info"]["Channels"],
-		j.contains("BaseCubemap"),
-	};
-	format = j["Format"];
-	info.desiredId = j["Id"];
+	DrawMeshes(cmdBuf, meshes, meshLods);
+}
 
+void agl::aglModel::DrawMeshes(VkCommandBuffer cmdBuf, const std::vector<aglMesh*>& drawn, const u32* meshLods)
+{
+	// Submeshes mostly share an arena page and index type, so the buffers are only rebound when they change
+	u32 boundPage = UINT32_MAX;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
 
-	if (type == AGL_PROCEDURAL_2D || type == AGL_PROCEDURAL_CUBEMAP)
+	for (size_t i = 0; i < drawn.size(); ++i)
 	{
-		if (j.contains("BaseCubemap"))
+		aglMesh* mesh = drawn[i];
+
+		if (meshLods[i] == CULLED)
 		{
-			info.baseCubemap = aglTextureFactory::GetTexture(j["BaseCubemap"]);
+			continue;
 		}
 
+		if (mesh->vertexRange.page != boundPage || mesh->indexType != boundIndexType)
+		{
+			boundPage = mesh->vertexRange.page;
+			boundIndexType = mesh->indexType;
+			aglMeshArena::Bind(cmdBuf, boundPage, boundIndexType);
+		}
 
-		Create(aglShaderFactory::GetShader(j["Shader"]), info);
-	} else
-	{
-		Create(j["Path"], j["Format"]);
+		mesh->DrawBound(cmdBuf, meshLods[i]);
+
+		if (mesh->format.splitPosition)
+		{
+			boundPage = UINT32_MAX;
+		}
 	}
 }
 
-agl::aglMesh* agl::aglMesh::GrabMesh(std::string path, int idx)
-{
 
-	aglModel model(path);
 
-	return model.meshes[idx];
+void agl::aglWorkerPool::Start(u32 threadCount)
+{
+	stopping = false;
+
+	for (u32 i = 0; i < threadCount; ++i)
+	{
+		threads.emplace_back(Run);
+	}
 }
 
-agl::aglMesh::aglMesh(aiMesh* mesh, string path, int idx)
+void agl::aglWorkerPool::Stop()
 {
-	this->path = path;
-	this->meshIndex = idx;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+	condition.notify_all();
 
-	for (unsigned int j = 0; j < mesh->mNumVertices; ++j)
+	for (auto& thread : threads)
 	{
-		aiVector3D v = mesh->mVertices[j];
-		aiVector3D t = mesh->mTextureCoords[0][j];
-		aiVector3D n = mesh->mNormals[j];
+		thread.join();
+	}
 
-		aglVertex vtx = { {v.x, v.y,v.z}, {n.x,n.y,n.z}, {t.x, t.y} };
+	threads.clear();
+}
 
-		vertices.push_back(vtx);
+void agl::aglWorkerPool::Submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
 	}
-	for (unsigned int j = 0; j < mesh->mNumFaces; j++)
+	condition.notify_one();
+}
+
+void agl::aglWorkerPool::ParallelFor(u32 count, const std::function<void(u32)>& fn)
+{
+	u32 helperCount = std::min(static_cast<u32>(threads.size()), count > 0 ? count - 1 : 0);
+
+	if (helperCount == 0)
 	{
-		aiFace face = mesh->mFaces[j];
-		for (unsigned int l = 0; l < face.mNumIndices; l++)
-			indices.push_back(face.mIndices[l]);
+		for (u32 i = 0; i < count; ++i)
+		{
+			fn(i);
+		}
+		return;
 	}
 
-	Setup();
+	// Helpers that only get scheduled after everything is done still find the state alive
+	struct State
+	{
+		std::function<void(u32)> fn;
+		u32 count;
+		std::atomic<u32> next{ 0 };
+		std::atomic<u32> done{ 0 };
+		std::mutex mutex;
+		std::condition_variable condition;
+	};
 
-	materialIndex = mesh->mMaterialIndex;
+	auto state = std::make_shared<State>();
+	state->fn = fn;
+	state->count = count;
 
-}
+	auto work = [state]()
+	{
+		for (u32 i = state->next++; i < state->count; i = state->next++)
+		{
+			state->fn(i);
 
-agl::aglMesh::aglMesh(aglMeshCreationData data)
-{
-	indices = data.indices;
-	vertices = data.vertices;
+			if (++state->done == state->count)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->condition.notify_all();
+			}
+		}
+	};
 
-	Setup();
+	for (u32 i = 0; i < helperCount; ++i)
+	{
+		Submit(work);
+	}
+
+	work();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&state] { return state->done == state->count; });
 }
 
-void agl::aglMesh::Draw(VkCommandBuffer commandBuffer, u32 imageIndex)
+void agl::aglWorkerPool::Run()
 {
+	while (true)
+	{
+		std::function<void()> job;
 
-	VkBuffer vertexBuffers[ ] = { vertexBuffer };
-	VkDeviceSize offsets[ ] = { 0 };
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [] { return stopping || !jobs.empty(); });
 
-	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			if (stopping)
+			{
+				return;
+			}
 
-	//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
 
-	vkCmdDrawIndexed(commandBuffer, static_cast<u32>(indices.size()), 1, 0, 0, 0);
+		job();
+	}
 }
 
-void agl::aglMesh::ExportAsCode(aglMesh* mesh, string path)
+agl::aglTexture* agl::aglStreamingLoader::GetPlaceholder()
 {
-	bool success = false;
+	if (placeholder)
+	{
+		return placeholder;
+	}
 
-#ifndef TEXT_BYTES_PER_LINE
-#define TEXT_BYTES_PER_LINE     20
-#endif
+	placeholder = new aglTexture;
+	placeholder->width = 1;
+	placeholder->height = 1;
+	placeholder->channels = 4;
+	placeholder->format = VK_FORMAT_R8G8B8A8_UNORM;
 
-	// NOTE: Text data buffer size is fixed to 64MB
-	char* txtData = (char*) calloc(64 * 1024 * 1024, sizeof(char));  // 64 MB
+	const u32 white = 0xFFFFFFFF;
 
-	int byteCount = 0;
-	byteCount += sprintf(txtData + byteCount, "////////////////////////////////////////////////////////////////////////////////////////\n");
-	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
-	byteCount += sprintf(txtData + byteCount, "// MeshAsCode exporter v1.0 - Mesh vertex data exported as arrays                     //\n");
-	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
-	byteCount += sprintf(txtData + byteCount, "// more info and bugs-report:  github.com/raysan5/raylib                              //\n");
-	byteCount += sprintf(txtData + byteCount, "// feedback and support:       ray[at]raylib.com                                      //\n");
-	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
-	byteCount += sprintf(txtData + byteCount, "// Copyright (c) 2023 Ramon Santamaria (@raysan5)                                     //\n");
-	byteCount += sprintf(txtData + byteCount, "//                                                                                    //\n");
-	byteCount += sprintf(txtData + byteCount, "////////////////////////////////////////////////////////////////////////////////////////\n\n");
+	aglTexture::CreateVulkanImage(1, 1, placeholder->format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, placeholder->textureImage, placeholder->textureImageMemory, false, 1, AGL_MEMORY_TEXTURE, placeholder);
 
-	// Get file name from path and convert variable name to uppercase
-	char varFileName[256] = { 0 };
-	strcpy(varFileName, GetFileNameWithoutExt(path).c_str());
-	for (int i = 0; varFileName[i] != '\0'; i++) if ((varFileName[i] >= 'a') && (varFileName[i] <= 'z')) { varFileName[i] = varFileName[i] - 32; }
+	aglUploadBatch batch;
+	aglStagingRing::Allocation staging = batch.Stage(&white, sizeof(white));
 
+	VkBufferImageCopy region{};
+	region.bufferOffset = staging.offset;
+	region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.imageExtent = { 1, 1, 1 };
 
-	vector<float> vertices;
-	vector<float> normals;
-	vector<float> texCoords;
+	batch.TransitionImageLayout(placeholder->textureImage, placeholder->format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	batch.CopyBufferToImage(staging.buffer, placeholder->textureImage, 1, 1, 1, &region);
+	batch.TransitionImageLayout(placeholder->textureImage, placeholder->format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	batch.Destroy();
 
-	for (auto vertex : mesh->vertices)
-	{
-		for (int i = 0; i < 3; ++i)
-		{
-			vertices.push_back(vertex.position[i]);
-		}
-		for (int i = 0; i < 3; ++i)
-		{
-			normals.push_back(vertex.normal[i]);
-		}
-		for (int i = 0; i < 2; ++i)
-		{
-			texCoords.push_back(vertex.texCoord[i]);
-		}
-	}
+	placeholder->textureImageView = aglTexture::CreateImageView(placeholder->textureImage, placeholder->format, VK_IMAGE_ASPECT_COLOR_BIT, false);
+	placeholder->CreateTextureSampler();
+
+	return placeholder;
+}
 
-	float indicesCount = mesh->indices.size();
+agl::aglTexture* agl::aglStreamingLoader::LoadTexture(std::string path, VkFormat format)
+{
+	aglTexture* source = GetPlaceholder();
 
+	aglTexture* texture = new aglTexture;
+	texture->path = path;
+	texture->format = format;
+	texture->width = source->width;
+	texture->height = source->height;
+	texture->channels = source->channels;
+	texture->textureImage = source->textureImage;
+	texture->textureImageMemory = aglAllocation();
+	texture->textureImageView = source->textureImageView;
+	texture->textureSampler = source->textureSampler;
+	texture->resident = false;
 
-	// Add image information
-	byteCount += sprintf(txtData + byteCount, "// Mesh basic information\n");
-	byteCount += sprintf(txtData + byteCount, "#define %s_VERTEX_COUNT    %i\n", varFileName, static_cast<int>(mesh->vertices.size()));
-	byteCount += sprintf(txtData + byteCount, "#define %s_TRIANGLE_COUNT   %i\n\n", varFileName, static_cast<int>(mesh->indices.size()/3));
+	aglTextureFactory::InsertTexture(texture, -1);
 
-	byteCount += sprintf(txtData + byteCount, "static float %s_VERTEX_DATA[%i] = { ", varFileName, static_cast<int>(mesh->vertices.size() * 3));
-	for (int i = 0; i < mesh->vertices.size() * 3 - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%.3ff,\n" : "%.3ff, "), vertices[i]);
-	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", vertices[mesh->vertices.size() * 3 - 1]);
+	aglWorkerPool::Submit([texture, path, format]
+	{
+		aglUploadBatch* batch = new aglUploadBatch;
+		batch->background = true;
 
-	byteCount += sprintf(txtData + byteCount, "static float %s_NORMAL_DATA[%i] = { ", varFileName, static_cast<int>(mesh->vertices.size() * 3));
-	for (int i = 0; i < mesh->vertices.size() * 3 - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%.3ff,\n" : "%.3ff, "), normals[i]);
-	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", normals[mesh->vertices.size() * 3 - 1]);
+		aglTexture* loaded = new aglTexture;
+		loaded->Create(path, format, batch);
 
-	byteCount += sprintf(txtData + byteCount, "static float %s_TEXCOORD_DATA[%i] = { ", varFileName, static_cast<int>(mesh->vertices.size() * 2));
-	for (int i = 0; i < mesh->vertices.size() * 2 - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%.3ff,\n" : "%.3ff, "), texCoords[i]);
-	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", texCoords[mesh->vertices.size() * 2 - 1]);
+		batch->Submit();
 
-	byteCount += sprintf(txtData + byteCount, "static float %s_INDEX_DATA[%i] = { ", varFileName, static_cast<int>(mesh->indices.size()));
-	for (int i = 0; i < mesh->indices.size() - 1; i++) byteCount += sprintf(txtData + byteCount, ((i % TEXT_BYTES_PER_LINE == 0) ? "%i,\n" : "%i, "), mesh->indices[i]);
-	byteCount += sprintf(txtData + byteCount, "%.3ff };\n\n", mesh->indices[mesh->indices.size() - 1]);
+		std::lock_guard<std::mutex> lock(mutex);
+		completedTextures.push_back({ texture, loaded, batch });
+	});
 
-	//-----------------------------------------------------------------------------------------
+	return texture;
+}
 
-	// NOTE: Text data size exported is determined by '\0' (NULL) character
-	success = WriteString(path, txtData);
+agl::aglModel* agl::aglStreamingLoader::LoadModel(std::string path)
+{
+	aglModel* model = new aglModel;
+	model->resident = false;
 
-	free(txtData);
+	aglWorkerPool::Submit([model, path]
+	{
+		aglUploadBatch* batch = new aglUploadBatch;
+		batch->background = true;
 
-	//if (success != 0) TRACELOG(LOG_INFO, "FILEIO: [%s] Image as code exported successfully", fileName);
-	//else TRACELOG(LOG_WARNING, "FILEIO: [%s] Failed to export image as code", fileName);
+		aglModel* loaded = new aglModel(path, batch);
+
+		batch->Submit();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		completedModels.push_back({ model, loaded, batch });
+	});
+
+	return model;
 }
 
-void agl::aglMesh::Setup()
+void agl::aglStreamingLoader::Update()
 {
-
 	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto texture = completedTextures.begin();
+		while (texture != completedTextures.end())
+		{
+			if (!texture->batch->IsComplete())
+			{
+				++texture;
+				continue;
+			}
 
-		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+			texture->batch->Destroy();
+			delete texture->batch;
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
+			aglTexture* handle = texture->handle;
+			aglTexture* loaded = texture->loaded;
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+			handle->width = loaded->width;
+			handle->height = loaded->height;
+			handle->channels = loaded->channels;
+			handle->textureImage = loaded->textureImage;
+			handle->textureImageMemory = loaded->textureImageMemory;
+			handle->textureImageView = loaded->textureImageView;
+			handle->textureSampler = loaded->textureSampler;
+			handle->resident = true;
 
-		void* data;
-		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertices.data(), (size_t) bufferSize);
-		vkUnmapMemory(device, stagingBufferMemory);
+			delete loaded;
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+			refreshes.push_back({ handle, (1u << framesInFlight) - 1 });
 
-		CopyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+			texture = completedTextures.erase(texture);
+		}
+
+		auto model = completedModels.begin();
+		while (model != completedModels.end())
+		{
+			if (!model->batch->IsComplete())
+			{
+				++model;
+				continue;
+			}
+
+			model->batch->Destroy();
+			delete model->batch;
+
+			model->handle->meshes = std::move(model->loaded->meshes);
+			model->handle->materials = std::move(model->loaded->materials);
+			model->handle->resident = true;
+
+			delete model->loaded;
 
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
+			model = completedModels.erase(model);
+		}
 	}
+}
+
+void agl::aglStreamingLoader::RefreshFrame()
+{
+	// Refreshes are queued by Update, which may run on the application thread
+	std::lock_guard<std::mutex> lock(mutex);
 
+	// Other slots may still be read by frames in flight, each gets rewritten on its own turn
+	auto refresh = refreshes.begin();
+	while (refresh != refreshes.end())
 	{
-		VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+		RefreshDescriptors(refresh->texture, currentFrame);
+		refresh->slotMask &= ~(1u << currentFrame);
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
+		if (refresh->slotMask == 0)
+		{
+			refresh = refreshes.erase(refresh);
+		}
+		else
+		{
+			++refresh;
+		}
+	}
+}
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+void agl::aglStreamingLoader::RefreshDescriptors(aglTexture* texture, u32 slot)
+{
+	for (aglShader* shader : aglShaderFactory::loadedShaders)
+	{
+		if (shader == nullptr || shader->descriptorSets.size() <= slot)
+		{
+			continue;
+		}
 
-		void* data;
-		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, indices.data(), (size_t) bufferSize);
-		vkUnmapMemory(device, stagingBufferMemory);
+		for (auto port : shader->ports)
+		{
+			if (port == nullptr || port->texture != texture || port->type != DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+			{
+				continue;
+			}
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+			VkDescriptorImageInfo imageInfo{};
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = texture->textureImageView;
+			imageInfo.sampler = texture->textureSampler;
 
-		CopyBuffer(stagingBuffer, indexBuffer, bufferSize);
+			VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			write.dstSet = shader->descriptorSets[slot];
+			write.dstBinding = port->binding;
+			write.descriptorCount = 1;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = &imageInfo;
 
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
+			vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+		}
 	}
 }
 
-void agl::aglModel::Draw(aglCommandBuffer* commandBuffer, u32 imageIndex)
+void agl::aglStreamingLoader::Destroy()
 {
-	for (aglMesh* mesh : meshes)
+	for (auto& texture : completedTextures)
 	{
-		mesh->Draw(commandBuffer->GetCommandBuffer(imageIndex), imageIndex);
+		texture.batch->Destroy();
+		delete texture.batch;
 	}
-}
 
+	for (auto& model : completedModels)
+	{
+		model.batch->Destroy();
+		delete model.batch;
+	}
+
+	completedTextures.clear();
+	completedModels.clear();
+	refreshes.clear();
+
+	if (placeholder)
+	{
+		vkDestroySampler(device, placeholder->textureSampler, nullptr);
+		vkDestroyImageView(device, placeholder->textureImageView, nullptr);
+		vkDestroyImage(device, placeholder->textureImage, nullptr);
+		aglAllocator::Free(placeholder->textureImageMemory);
 
+		delete placeholder;
+		placeholder = nullptr;
+	}
+}
 
 void agl::agl_init(agl_details* details)
 {
 
 	agl::details = details;
+	framesInFlight = std::clamp<u32>(details->framesInFlight, 1, MAX_FRAMES_IN_FLIGHT);
 	agl::postProcessing = new PostProcessingSettings;
 
 	window = SDL_CreateWindow(details->applicationName.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, details->Width, details->Height, SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
@@ -3214,6 +6305,17 @@ void agl::agl_init(agl_details* details)
 
 	CreateSyncObjects();
 
+	aglAllocator::Create(details->allocatorBlockSize);
+	aglMeshArena::Create(details->meshArenaVertexSize, details->meshArenaIndexSize);
+	aglStagingRing::Create(details->stagingRingSize);
+
+	u32 workerCount = details->workerThreadCount;
+	if (workerCount == 0)
+	{
+		workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+	aglWorkerPool::Start(workerCount);
+
   	baseSurface = new SurfaceDetails;
 
 
@@ -3221,18 +6323,36 @@ void agl::agl_init(agl_details* details)
 
 void agl::complete_init()
 {
+	if (details->useRenderThread)
+	{
+		aglRenderThread::Start();
+	}
+}
 
 
-}
+u32 agl::aglModel::importFlags = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType;
+
+u32 agl::aglModel::GetImportFlags()
+{
+	u32 flags = importFlags;
+
+	if (aglMesh::defaultFormat.encodings[AGL_VERTEX_TANGENT] != AGL_ENCODING_NONE)
+	{
+		flags |= aiProcess_CalcTangentSpace;
+	}
 
+	return flags;
+}
 
-agl::aglModel::aglModel(string path)
+agl::aglModel::aglModel(string path, aglUploadBatch* batch)
 {
+	if (aglMeshCache::enabled && aglMeshCache::Load(path, *this, batch, aglMesh::defaultCpuData))
+	{
+		return;
+	}
+
 	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path.c_str(), aiProcess_CalcTangentSpace |
-		aiProcess_Triangulate |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_SortByPType);
+	const aiScene* scene = importer.ReadFile(path.c_str(), GetImportFlags());
 
 	// If the import failed, report it
 	if (scene == nullptr) {
@@ -3247,16 +6367,21 @@ agl::aglModel::aglModel(string path)
 
 	}
 
-	for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+	meshes.resize(scene->mNumMeshes);
+
+	aglWorkerPool::ParallelFor(scene->mNumMeshes, [this, scene, &path](u32 i)
 	{
-		aiMesh* aimesh = scene->mMeshes[i];
+		aglMesh* mesh = new aglMesh();
+		mesh->path = path;
+		mesh->meshIndex = static_cast<int>(i);
+		mesh->Convert(scene->mMeshes[i]);
 
-		aglMesh* mesh = new aglMesh(aimesh, path, i);
+		meshes[i] = mesh;
+	});
 
-		meshes.push_back(mesh);
-	}
+	materials.resize(scene->mNumMaterials);
 
-	for (int i = 0; i < scene->mNumMaterials; ++i)
+	aglWorkerPool::ParallelFor(scene->mNumMaterials, [this, scene, &path](u32 i)
 	{
 		aiMaterial* aiMat = scene->mMaterials[i];
 
@@ -3268,7 +6393,46 @@ agl::aglModel::aglModel(string path)
 		material->textures.insert({ aglMaterial::ALBEDO, diffuseTextures });
 		material->textures.insert({ aglMaterial::NORMAL, normalTextures });
 
-		materials.push_back(material);
+		materials[i] = material;
+	});
+
+	// The batch isn't thread safe, so uploads are recorded here once everything is converted
+	aglUploadBatch localBatch;
+	aglUploadBatch* upload = batch ? batch : &localBatch;
+
+	for (aglMesh* mesh : meshes)
+	{
+		mesh->Setup(upload);
+	}
+
+	localBatch.Destroy();
+
+	if (aglMesh::optimizeOnImport && !meshes.empty())
+	{
+		float missesBefore = 0, missesAfter = 0;
+		size_t triangles = 0;
+
+		for (aglMesh* mesh : meshes)
+		{
+			size_t meshTriangles = mesh->lods[0].indexCount / 3;
+			missesBefore += mesh->acmrBefore * meshTriangles;
+			missesAfter += mesh->acmrAfter * meshTriangles;
+			triangles += meshTriangles;
+		}
+
+		if (triangles > 0)
+		{
+			cout << "Optimized " << path << ": ACMR " << missesBefore / triangles << " -> " << missesAfter / triangles << endl;
+		}
+	}
+
+	// Released geometry can only come back from the cache, so it stays without a written entry
+	if (aglMeshCache::enabled && aglMeshCache::Save(path, *this))
+	{
+		for (aglMesh* mesh : meshes)
+		{
+			mesh->ReleaseCpuData(aglMesh::defaultCpuData);
+		}
 	}
 }
 
@@ -3316,19 +6480,17 @@ agl::aglUniformBuffer::aglUniformBuffer(aglShader* shader, aglBufferSettings set
 
 	VkDeviceSize bufferSize = settings.bufferSize;
 
-	uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-	ubMemory.resize(MAX_FRAMES_IN_FLIGHT);
-	mappedUbs.resize(MAX_FRAMES_IN_FLIGHT);
+	uniformBuffers.resize(framesInFlight);
+	ubMemory.resize(framesInFlight);
+	mappedUbs.resize(framesInFlight);
 
-	VkDevice dev = agl::GetDevice();
-
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	for (u32 i = 0; i < framesInFlight; ++i)
 	{
 		CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					 uniformBuffers[i], ubMemory[i]);
+					 uniformBuffers[i], ubMemory[i], AGL_MEMORY_UNIFORM_BUFFER, this);
 
-		vkMapMemory(dev, ubMemory[i], 0, bufferSize, 0, &mappedUbs[i]);
+		mappedUbs[i] = ubMemory[i].mapped;
 	}
 
 
@@ -3342,14 +6504,18 @@ agl::aglUniformBuffer::aglUniformBuffer(aglShader* shader, aglBufferSettings set
 
 void agl::aglUniformBuffer::Destroy()
 {
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	aglDeletionQueue::Push([buffers = std::move(uniformBuffers), memory = std::move(ubMemory)]() mutable
 	{
-		vkDestroyBuffer(GetDevice(), uniformBuffers[i], nullptr);
-		vkFreeMemory(GetDevice(), ubMemory[i], nullptr);
-	}
-
-
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			vkDestroyBuffer(device, buffers[i], nullptr);
+			aglAllocator::Free(memory[i]);
+		}
+	});
 
+	uniformBuffers.clear();
+	ubMemory.clear();
+	mappedUbs.clear();
 }
 
 void agl::aglUniformBuffer::AttachToShader(aglShader* shader, u32 bindingIdx)
@@ -3370,13 +6536,13 @@ void agl::aglUniformBuffer::AttachToShader(aglShader* shader, u32 bindingIdx)
 	VkDescriptorPoolSize uboPoolSize{};
 
 	uboPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboPoolSize.descriptorCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
+	uboPoolSize.descriptorCount = static_cast<u32>(framesInFlight);
 
 	shader->AttachDescriptorPool(uboPoolSize, bindingIdx);
 
 	CreateBinding(uboLayoutBinding, bindingIdx);
 
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	for (u32 i = 0; i < framesInFlight; ++i)
 	{
 		auto bufferInfo = new VkDescriptorBufferInfo;
 		bufferInfo->buffer = GetUniformBuffer(i);
@@ -3422,6 +6588,12 @@ void agl::aglUniformBuffer::Update(void* data, size_t dataSize)
 {
 	int bufferSize = settings.bufferSize;
 
+	if (aglRenderThread::IsCapturing())
+	{
+		aglRenderThread::GetWriteSnapshot()->WriteBuffer(mappedUbs, data, dataSize);
+		return;
+	}
+
 	memcpy(mappedUbs[currentFrame], data,dataSize);
 
 }
@@ -3439,23 +6611,42 @@ void agl::UpdateFrame()
 
 	lastTick = currentTime;
 
-	DrawFrame();
-
 	event = nullptr;
 	frameCount++;
 }
 
 void agl::Destroy()
 {
+	aglRenderThread::Stop();
+	aglWorkerPool::Stop();
+
 	vkDeviceWaitIdle(device);
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	aglDeletionQueue::Flush();
+
+	aglStreamingLoader::Destroy();
+
+	aglMeshArena::Destroy();
+	aglRenderQueue::DestroyFrameBuffers();
+	aglStagingRing::Destroy();
+
+	for (u32 i = 0; i < framesInFlight; i++)
 	{
 		vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(device, inFlightFences[i], nullptr);
 	}
 
+	timeline->Destroy();
+	delete timeline;
+
+	if (transferTimeline)
+	{
+		transferTimeline->Destroy();
+		delete transferTimeline;
+	}
+
+	aglAllocator::Destroy();
+
 	if (validationLayersEnabled)
 	{
 		DestroyDebugUtilsMessengerEXT(instance, DebugMessenger, nullptr);
@@ -1,9 +1,16 @@
 #if !defined(AGL_HPP)
 #define AGL_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <optional>
+#include <thread>
 
 #include "agl.hpp"
 #include "agl.hpp"
@@ -23,6 +30,30 @@ struct agl_details
 	u32 engineVersion;
 
 	int Width, Height;
+
+	// 1 to MAX_FRAMES_IN_FLIGHT, fewer frames lower latency and per-frame buffer memory
+	u32 framesInFlight = 3;
+
+	// Falls back to the closest supported mode, FIFO is always available
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	// 0 picks minImageCount + 1, otherwise clamped to what the surface supports
+	u32 swapchainImageCount = 0;
+	// Frames per second the CPU is paced to, 0 leaves the frame rate uncapped
+	float targetFrameRate = 0;
+
+	// Records and submits frames on a dedicated thread, see agl::aglRenderThread
+	bool useRenderThread = false;
+	// Runs background upload batches on a transfer-only queue family when the device has one
+	bool useTransferQueue = true;
+	// Initial size of the persistently mapped staging ring, it grows on demand
+	VkDeviceSize stagingRingSize = 64ull * 1024 * 1024;
+	// Threads used for background decoding and imports, 0 uses all but one core
+	u32 workerThreadCount = 0;
+	// Size of the device memory blocks resources are sub-allocated from
+	VkDeviceSize allocatorBlockSize = 64ull * 1024 * 1024;
+	// Size of each shared vertex / index buffer page in the mesh arena
+	VkDeviceSize meshArenaVertexSize = 64ull * 1024 * 1024;
+	VkDeviceSize meshArenaIndexSize = 32ull * 1024 * 1024;
 };
 
 struct AURORA_API agl
@@ -38,6 +69,8 @@ struct AURORA_API agl
 	{
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		// Only set for a family without graphics or compute, usually the DMA engines
+		std::optional<uint32_t> transferFamily;
 
 		bool isComplete()
 		{
@@ -74,12 +107,20 @@ struct AURORA_API agl
 	inline static VkDebugUtilsMessengerEXT DebugMessenger = VK_NULL_HANDLE;
 	inline static VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	inline static VkDevice device = VK_NULL_HANDLE;
+	// VK_EXT_memory_budget is optional, aglAllocator falls back to its own accounting
+	inline static bool memoryBudgetSupported = false;
+	// Optional features for the indirect render queue path
+	inline static bool multiDrawIndirectSupported = false;
+	inline static bool drawIndirectFirstInstanceSupported = false;
+	inline static bool drawIndirectCountSupported = false;
+	// Needed for the occlusion half of aglGpuCuller
+	inline static bool storageImageArrayDynamicIndexingSupported = false;
 	inline static VkQueue graphicsQueue = VK_NULL_HANDLE;
 	inline static VkSurfaceKHR surface = VK_NULL_HANDLE;
 	inline static VkQueue presentQueue = VK_NULL_HANDLE;
+	inline static VkQueue transferQueue = VK_NULL_HANDLE;
 	inline static std::vector<VkSemaphore> imageAvailableSemaphores;
 	inline static std::vector<VkSemaphore> renderFinishedSemaphores;
-	inline static std::vector<VkFence> inFlightFences;
 	inline static u32 currentImage;
 	inline static bool closeWindow = false;
 	IS float deltaTime = 1.0f / 60.0f;
@@ -88,6 +129,181 @@ struct AURORA_API agl
 
 	static VkDevice GetDevice();
 
+	// A timeline semaphore signalled by every submission made to its queue. Each submission
+	// signals a strictly increasing value, so "is this work done" becomes a single comparison.
+	struct AURORA_API aglTimeline
+	{
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+
+		aglTimeline();
+
+		// Reserves the value the next submission will signal, call with queueMutex held so
+		// values reach the semaphore in increasing order
+		uint64_t Next() { return ++lastSubmitted; }
+		uint64_t GetLastSubmitted() const { return lastSubmitted; }
+
+		uint64_t GetCompletedValue();
+		bool IsComplete(uint64_t value);
+		void Wait(uint64_t value);
+
+		// Submits a single command buffer that signals the next value, returns that value
+		uint64_t Submit(VkQueue queue, VkCommandBuffer commandBuffer);
+
+		void Destroy();
+
+	private:
+		std::atomic<uint64_t> lastSubmitted = 0;
+		std::atomic<uint64_t> lastCompleted = 0;
+	};
+
+	// Queues are externally synchronized, every submit and present goes through this
+	inline static std::mutex queueMutex;
+
+	inline static aglTimeline* timeline = nullptr;
+	// Signalled by upload batches running on transferQueue
+	inline static aglTimeline* transferTimeline = nullptr;
+
+	static bool HasTransferQueue() { return transferQueue != VK_NULL_HANDLE; }
+
+	// Resources released by the transfer queue still need their ownership acquired on the
+	// graphics queue. Acquires are recorded at the start of the next frame, whose submission
+	// then waits on the transfer timeline.
+	struct aglPendingAcquire
+	{
+		uint64_t transferValue;
+		std::vector<VkBufferMemoryBarrier> buffers;
+		std::vector<VkImageMemoryBarrier> images;
+	};
+
+	inline static std::mutex acquireMutex;
+	inline static std::vector<aglPendingAcquire> pendingAcquires;
+	inline static uint64_t pendingTransferValue = 0;
+	static void FlushPendingAcquires(VkCommandBuffer cmdBuf);
+	inline static VkPresentModeKHR activePresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	inline static uint64_t nextFrameDeadline = 0;
+	// Timeline value of the last submission made for each frame slot / swapchain image
+	inline static std::vector<uint64_t> frameTimelineValues;
+	inline static std::vector<uint64_t> imageTimelineValues;
+
+	struct aglAllocator;
+
+	// First-fit free list over [0, size), used to carve ranges out of blocks and buffers
+	struct aglFreeList
+	{
+		VkDeviceSize size = 0;
+		// Free ranges keyed by offset, neighbours are merged when released
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+
+		void Reset(VkDeviceSize size);
+		// The alignment doesn't have to be a power of two
+		bool TryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+		void Release(VkDeviceSize offset, VkDeviceSize size);
+		bool IsEmpty() const;
+	};
+
+	enum aglMemoryCategory
+	{
+		AGL_MEMORY_MESH = 0,
+		AGL_MEMORY_TEXTURE,
+		AGL_MEMORY_CUBEMAP,
+		AGL_MEMORY_UNIFORM_BUFFER,
+		AGL_MEMORY_STORAGE_BUFFER,
+		AGL_MEMORY_FRAMEBUFFER,
+		AGL_MEMORY_STAGING,
+		AGL_MEMORY_OTHER,
+		AGL_MEMORY_CATEGORY_COUNT
+	};
+
+	struct aglMemoryHeapStats
+	{
+		VkDeviceSize size = 0;
+		// From VK_EXT_memory_budget when available, otherwise the heap size and what agl allocated
+		VkDeviceSize budget = 0;
+		VkDeviceSize usage = 0;
+		// Device memory agl holds in this heap, and how much of it is handed out to resources
+		VkDeviceSize blockBytes = 0;
+		VkDeviceSize allocatedBytes = 0;
+		bool deviceLocal = false;
+	};
+
+	struct aglMemoryStats
+	{
+		VkDeviceSize categoryBytes[AGL_MEMORY_CATEGORY_COUNT] = {};
+		u32 categoryAllocations[AGL_MEMORY_CATEGORY_COUNT] = {};
+		std::vector<aglMemoryHeapStats> heaps;
+		bool budgetFromDriver = false;
+	};
+
+	// A range of device memory handed out by aglAllocator
+	struct aglAllocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		// Points at offset for host visible memory, the whole block stays mapped
+		void* mapped = nullptr;
+
+		bool IsValid() const { return memory != VK_NULL_HANDLE; }
+
+	private:
+		friend aglAllocator;
+
+		u32 pool = 0;
+		u32 block = 0;
+		u32 heap = 0;
+		bool dedicated = false;
+		aglMemoryCategory category = AGL_MEMORY_OTHER;
+		const void* owner = nullptr;
+	};
+
+	// Sub-allocates device memory out of large blocks per memory type so resources don't
+	// each cost a vkAllocateMemory call. Buffers and linear images never share a block with
+	// optimal images, which keeps bufferImageGranularity out of the picture. Resources the
+	// driver wants dedicated or that take more than half a block get their own allocation.
+	struct AURORA_API aglAllocator
+	{
+		static void Create(VkDeviceSize blockSize);
+
+		// Allocate and bind. The owner is only used as a key for GetOwnerUsage
+		static aglAllocation AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties,
+		                                       aglMemoryCategory category = AGL_MEMORY_OTHER, const void* owner = nullptr);
+		static aglAllocation AllocateForImage(VkImage image, VkMemoryPropertyFlags properties,
+		                                      aglMemoryCategory category = AGL_MEMORY_TEXTURE, const void* owner = nullptr, bool linear = false);
+
+		static void Free(aglAllocation& allocation);
+		static void Destroy();
+
+		static aglMemoryStats GetMemoryStats();
+		static VkDeviceSize GetOwnerUsage(const void* owner);
+		static const char* GetCategoryName(aglMemoryCategory category);
+
+	private:
+		struct Block
+		{
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			char* mapped = nullptr;
+			aglFreeList ranges;
+		};
+
+		static aglAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+		                              bool linear, bool dedicated, VkBuffer buffer, VkImage image,
+		                              aglMemoryCategory category, const void* owner);
+		static VkDeviceMemory AllocateMemory(VkDeviceSize size, u32 memoryType, VkBuffer buffer, VkImage image, char** mapped);
+		static void Track(const aglAllocation& allocation, bool add);
+
+		IS std::mutex mutex;
+		// Keyed by memory type * 2 + linear
+		IS std::map<u32, std::vector<Block>> pools;
+		IS VkDeviceSize blockSize = 64ull * 1024 * 1024;
+		IS VkPhysicalDeviceMemoryProperties memoryProperties;
+
+		IS VkDeviceSize categoryBytes[AGL_MEMORY_CATEGORY_COUNT] = {};
+		IS u32 categoryAllocations[AGL_MEMORY_CATEGORY_COUNT] = {};
+		IS std::map<const void*, VkDeviceSize> ownerBytes;
+		IS std::vector<VkDeviceSize> heapBlockBytes;
+		IS std::vector<VkDeviceSize> heapAllocatedBytes;
+	};
+
 	struct aglShader;
 	struct aglTexture;
 	struct aglCommandBuffer;
@@ -109,19 +325,29 @@ struct AURORA_API agl
 
 private:
 	IS SurfaceDetails* baseSurface;
-	IS u32 currentFrame;
+	// Frame slot being recorded, advanced by the render thread when it runs
+	IS std::atomic<u32> currentFrame = 0;
+	IS u32 framesInFlight = MAX_FRAMES_IN_FLIGHT;
 public:
 
 	static SurfaceDetails* GetSurfaceDetails();
 	static u32 GetCurrentImage();
+	static u32 GetFramesInFlight();
 
 	static void CreateInstance();
 	static void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-	                         VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	                         VkBuffer& buffer, aglAllocation& bufferMemory,
+	                         aglMemoryCategory category = AGL_MEMORY_OTHER, const void* owner = nullptr);
 	static void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 	static void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, bool endCmd, u32 mipCount);
 	static void CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 height, u32 regionCount, VkBufferImageCopy* regions);
 	static void CopyImageToImage(VkImage base, VkImage sub, int layer, int layerCount, int width, int height, bool endCmd, int srcMip, int dstMip);
+
+	// Command recording behind the helpers above, usable with any command buffer
+	static void RecordCopyBuffer(VkCommandBuffer cmdBuf, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+	static void RecordTransitionImageLayout(VkCommandBuffer cmdBuf, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, u32 mipCount);
+	static void RecordCopyBufferToImage(VkCommandBuffer cmdBuf, VkBuffer buffer, VkImage image, u32 width, u32 height, u32 regionCount, VkBufferImageCopy* regions);
+	static void RecordCopyImageToImage(VkCommandBuffer cmdBuf, VkImage base, VkImage sub, int layer, int layerCount, int width, int height, int srcMip, int dstMip);
 	static VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling,
 	                                    VkFormatFeatureFlags features);
 
@@ -145,9 +371,23 @@ public:
 	static VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 	static VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 
+	// Frame loop. BeginFrame waits until the current frame slot is free, so per-frame
+	// resources (uniform/storage buffers, descriptor sets, command buffers) may only be
+	// written between BeginFrame and EndFrame. With the render thread active nothing is
+	// acquired here and the returned image index is meaningless.
+	static u32 BeginFrame();
+	static void EndFrame();
+
+	// These recreate the swapchain on the next present
+	static void SetPresentMode(VkPresentModeKHR mode);
+	static void SetSwapchainImageCount(u32 count);
+	static void SetFrameRateLimit(float framesPerSecond);
+	static VkPresentModeKHR GetPresentMode();
+
+	static void PaceFrame();
+
 	static void record_command_buffer(u32 imageIndex);
 	static void FinishRecordingCommandBuffer(u32 imageIndex);
-	static void DrawFrame();
 	static void PollEvent(SDL_Event event);
 
 	template <typename T>
@@ -226,6 +466,8 @@ public:
 	struct AURORA_API aglCommandBuffer
 	{
 		VkCommandPool commandPool;
+		// Separate pool so single-time commands never touch the pool the render thread records from
+		VkCommandPool singleTimePool;
 		std::vector<VkCommandBuffer> commandBuffers;
 		VkCommandBuffer GetCommandBuffer(u32 currentImage) { return commandBuffers[currentImage]; }
 		VkCommandBuffer currentBufferUsed=VK_NULL_HANDLE;
@@ -249,14 +491,179 @@ public:
 		void Destroy();
 	};
 
+	// Persistently mapped, host visible memory all staging copies are sub-allocated from.
+	// Each block is used as a ring: regions are handed out in order and recycled from the
+	// tail once the submission that read them completes. When no block has room a new,
+	// larger block is added instead of waiting.
+	struct AURORA_API aglStagingRing
+	{
+		struct Allocation
+		{
+			VkBuffer buffer;
+			VkDeviceSize offset;
+			void* mapped;
+
+			u32 block;
+			uint64_t id;
+		};
+
+		static void Create(VkDeviceSize size);
+		static Allocation Allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+		// Regions stay reserved until tagged with the submission that reads them
+		static void Retire(const std::vector<Allocation>& allocations, aglTimeline* timeline, uint64_t value);
+		static void Destroy();
+
+	private:
+		struct Region
+		{
+			uint64_t id;
+			VkDeviceSize begin;
+			VkDeviceSize end;
+			aglTimeline* timeline;
+			uint64_t value;
+		};
+
+		struct Block
+		{
+			VkBuffer buffer;
+			aglAllocation memory;
+			char* mapped;
+			VkDeviceSize size;
+			VkDeviceSize head = 0;
+			std::deque<Region> regions;
+
+			void Reclaim();
+			bool TryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+		};
+
+		static void AddBlock(VkDeviceSize size);
+
+		IS std::mutex mutex;
+		IS std::vector<Block> blocks;
+		IS uint64_t nextId = 0;
+	};
+
+	// Records any number of copies and layout transitions and submits them in one go.
+	// Staging regions from Stage live until the submission that reads them completes.
+	// Resources filled through a batch must not be used by a frame submitted before the batch.
+	struct AURORA_API aglUploadBatch
+	{
+		// Copies data into the staging ring, the region is recycled once the batch completes
+		aglStagingRing::Allocation Stage(const void* data, VkDeviceSize size);
+
+		void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+		void CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 height, u32 regionCount = 0, VkBufferImageCopy* regions = nullptr);
+		void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount = 1, u32 mipCount = 1);
+
+		// Only background batches run on the transfer queue. Their ownership acquires are deferred
+		// to the next frame, so waiting on one doesn't make its resources usable right away.
+		// Set before the first command is recorded.
+		bool background = false;
+
+		// Begins recording on first use
+		VkCommandBuffer GetCommandBuffer();
+
+		// Submits everything recorded so far, returns the timeline value that signals its completion.
+		// For background batches on the transfer queue that value belongs to transferTimeline and
+		// the resources become usable from the first frame recorded after the submission.
+		uint64_t Submit();
+		uint64_t GetToken() const { return token; }
+		aglTimeline* GetTimeline() const { return submitTimeline; }
+		bool IsComplete();
+		void Wait();
+
+		void Destroy();
+
+	private:
+		struct CommandBuffer
+		{
+			VkCommandBuffer commandBuffer;
+			uint64_t token;
+		};
+
+		// Queue family ownership release, the matching acquire is queued in pendingAcquires
+		void ReleaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+		void ReleaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, int layerCount, u32 mipCount);
+
+		bool usesTransferQueue = false;
+		// Looked up once with the command pool, every release barrier needs them
+		u32 graphicsFamily = 0;
+		u32 transferFamily = 0;
+		aglTimeline* submitTimeline = nullptr;
+		aglPendingAcquire acquires;
+
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		std::vector<CommandBuffer> commandBuffers;
+		std::vector<aglStagingRing::Allocation> staged;
+		VkCommandBuffer recording = VK_NULL_HANDLE;
+		uint64_t token = 0;
+	};
+
 	struct aglMesh;
+	struct aglModel;
 	struct aglRenderPass;
+	struct aglStreamingLoader;
+	struct aglMeshCache;
+	struct aglMeshOptimizer;
+	struct aglGpuCuller;
 
 
 	struct aglRenderQueueEntry
 	{
 		agl::aglMesh* mesh;
 		agl::aglShader* shader;
+
+		// Picks the LOD and sorts by depth. Instanced shaders also get it as the instance
+		// transform, so only their entries are culled by it.
+		glm::mat4 transform = glm::mat4(1.0f);
+		// Negative picks one from the mesh's projected size when the entry is attached
+		int lod = -1;
+		// Lower layers draw first. From AGL_RENDER_LAYER_TRANSPARENT on, entries are sorted back to
+		// front ahead of state, everything below is sorted by state and then front to back.
+		uint8_t layer = 0;
+
+		// Per-instance, only read by instanced shaders
+		u32 materialIndex = 0;
+
+		// Distance to the camera, filled in when the entry is attached
+		float depth = 0.0f;
+	};
+
+	constexpr uint8_t AGL_RENDER_LAYER_TRANSPARENT = 8;
+
+	// One instance handed to the GPU culling pass, laid out like CullObject in cull.comp
+	struct aglCullObject
+	{
+		// World space bounding sphere, radius in w
+		glm::vec4 sphere;
+		VkDrawIndexedIndirectCommand command;
+		// Filled in by aglGpuCuller::Draw
+		u32 groupBase;
+		u32 groupSlot;
+		u32 countIndex;
+	};
+
+	// Bounding spheres kept as separate x, y, z and radius arrays, so the frustum test covers
+	// 8 spheres per step with AVX and 4 with SSE
+	struct AURORA_API aglCullingArray
+	{
+		void Clear();
+		// Radius in w
+		void Add(const glm::vec4& sphere);
+		size_t Size() const { return centerX.size(); }
+
+		// visible[i] becomes 1 when sphere i is at least partly inside all six planes
+		void Cull(const glm::vec4 planes[6], std::vector<uint8_t>& visible) const;
+
+		// Normalized, pointing inwards. The near plane is the -1 to 1 one, which is only looser
+		// for 0 to 1 projections.
+		static void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+	private:
+		std::vector<float> centerX;
+		std::vector<float> centerY;
+		std::vector<float> centerZ;
+		std::vector<float> radius;
 	};
 
 	struct aglRenderQueue
@@ -277,13 +684,175 @@ public:
 		void Push();
 
 		bool disabled = false;
+		// Off keeps submission order, for passes that depend on it
+		bool sorted = true;
+		// Draws sharing a pipeline and arena page go out as one vkCmdDrawIndexedIndirect. Instanced
+		// shaders get their instance data through firstInstance, so they stay direct without
+		// drawIndirectFirstInstance.
+		bool indirect = false;
+		// Tests the indirect draws of instanced shaders on the GPU before they are drawn, one
+		// queue per culler. Other shaders don't read the entry transform, so they aren't culled.
+		aglGpuCuller* culler = nullptr;
+
+		// The queue is pushed when the next frame starts recording, ahead of anything drawn directly
+		void AttachQueueEntry(aglRenderQueueEntry entry);
+		// Frustum culls the entries of instanced shaders in SIMD batches and only attaches the
+		// visible ones, other entries are attached as they are
+		void AttachQueueEntries(const aglRenderQueueEntry* entries, size_t count);
+
+		// Camera used for LOD selection, until it's set every draw uses LOD 0
+		static void SetCamera(const glm::mat4& view, const glm::mat4& projection, float viewportHeight);
+		// Coarsest LOD whose simplification error projects to at most lodPixelError * 2^lodBias pixels
+		static u32 SelectLod(const aglMesh* mesh, const glm::mat4& transform);
+		// Tests against the frustum given to SetCamera, everything is visible until it's called
+		static void CullSpheres(const aglCullingArray& spheres, std::vector<uint8_t>& visible);
+
+		// Called once the frame slot is free, its instance and indirect data can be overwritten from then on
+		static void ResetFrameBuffers(u32 frame);
+		static void DestroyFrameBuffers();
+
+		// Positive values switch to coarser LODs sooner, each step doubles the allowed error
+		IS float lodBias = 0.0f;
+		IS float lodPixelError = 1.0f;
+
+		// Camera of the frame being recorded, for GPU culling. All zero until SetCamera is called.
+		IS glm::mat4 cullViewProjection = glm::mat4(0.0f);
 
-		void AttachQueueEntry(aglRenderQueueEntry entry)
+	private:
+		struct SortItem
 		{
-			queueEntries.push_back(entry);
-		}
+			uint64_t key;
+			u32 entry;
+		};
+
+		// Packs layer, pipeline, arena buffers, mesh and depth into one key per entry
+		void BuildSortKeys();
+		// LSD radix sort by key, bytes that are equal across all keys are skipped
+		static void RadixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch);
+
+		struct Draw
+		{
+			const aglRenderQueueEntry* entry;
+			u32 lod;
+			u32 instanceCount;
+			// Into the instances written for this push, only used by instanced shaders
+			u32 firstInstance;
+		};
+
+		// Merges runs of instanceable entries and gathers their instance data
+		void BuildDraws();
+		void EmitDirect(VkCommandBuffer cmdBuf, size_t first, size_t last);
+		void EmitIndirect(VkCommandBuffer cmdBuf);
+		// Hands one indirect group of an instanced shader to the culler, false when it has no room left
+		bool EmitCulled(VkCommandBuffer cmdBuf, size_t first, size_t last);
+
+		std::vector<SortItem> sortItems;
+		std::vector<SortItem> sortScratch;
+		std::vector<Draw> draws;
+		std::vector<aglInstanceData> instances;
+		std::vector<VkDrawIndexedIndirectCommand> indirectCommands;
+		std::vector<aglCullObject> cullObjects;
+
+		// Host visible buffer that is filled front to back during a frame and grows when full
+		struct FrameBuffer
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			aglAllocation memory;
+			VkDeviceSize capacity = 0;
+			VkDeviceSize cursor = 0;
+		};
+
+		static void WriteFrameBuffer(FrameBuffer& frameBuffer, VkBufferUsageFlags usage, const void* data, VkDeviceSize size,
+		                             VkBuffer& buffer, VkDeviceSize& offset);
+
+		// Shared by all queues, one per frame in flight
+		IS FrameBuffer instanceBuffers[MAX_FRAMES_IN_FLIGHT];
+		IS FrameBuffer indirectBuffers[MAX_FRAMES_IN_FLIGHT];
+
+		IS vec3 cameraPosition = vec3(0.0f);
+		// Pixels per world unit at distance 1, or at any distance for orthographic cameras
+		IS float cameraProjectionScale = 0.0f;
+		IS bool cameraOrthographic = false;
+		IS glm::vec4 cameraFrustum[6] = {};
+		IS bool cameraFrustumSet = false;
+
+		aglCullingArray cullingArray;
+		std::vector<uint8_t> cullingVisible;
 	};
 
+	// What the application thread hands to the render thread for one frame
+	struct aglFrameSnapshot
+	{
+		struct BufferWrite
+		{
+			// Per-frame mapped pointers of the destination buffer, copied so the buffer can be
+			// destroyed before the write is applied (its memory outlives the frame in flight)
+			void* mapped[MAX_FRAMES_IN_FLIGHT];
+			std::vector<char> data;
+		};
+
+		// Keyed by the queue the entries were attached to
+		std::map<aglRenderQueue*, std::vector<aglRenderQueueEntry>> queueEntries;
+		std::vector<BufferWrite> bufferWrites;
+		// Carried over between frames, like the camera it comes from
+		glm::mat4 viewProjection = glm::mat4(0.0f);
+		std::vector<std::function<void(VkCommandBuffer)>> recordCommands;
+
+		void WriteBuffer(const std::vector<void*>& mapped, void* data, size_t dataSize);
+		void Clear();
+	};
+
+	// Opt-in through agl_details::useRenderThread. The application thread fills one snapshot
+	// while the render thread acquires, records, submits and presents the previous one.
+	// While it runs, the frame slot (currentFrame) belongs to the render thread: buffer
+	// updates, queue entries and agl::Record calls made on the application thread are captured
+	// into the snapshot instead, the ones made while consuming go straight to the frame.
+	struct AURORA_API aglRenderThread
+	{
+		static void Start();
+		static void Stop();
+		static bool IsActive() { return running; }
+		static bool IsRenderThread() { return std::this_thread::get_id() == thread.get_id(); }
+		// Active and called from the application thread
+		static bool IsCapturing() { return running && !IsRenderThread(); }
+
+		static aglFrameSnapshot* GetWriteSnapshot() { return &snapshots[writeIndex]; }
+
+		// Hands the filled snapshot over, blocks until the render thread is done with the
+		// snapshot before it
+		static void Publish();
+
+		// SDL's window and event calls belong to the application thread, which reports the window
+		// size here every frame for the render thread to recreate the swapchain with
+		static void UpdateWindowExtent();
+		static VkExtent2D GetWindowExtent() { return { windowWidth, windowHeight }; }
+		// Render thread only, blocks until the application thread sees a window with an area
+		// again. False once the thread is stopping.
+		static bool WaitForWindow();
+
+	private:
+		static void Run();
+		static void Consume(aglFrameSnapshot* snapshot);
+
+		IS std::thread thread;
+		IS std::mutex mutex;
+		IS std::condition_variable condition;
+		IS aglFrameSnapshot snapshots[2];
+		IS u32 writeIndex = 0;
+		IS u32 readIndex = 0;
+		IS bool pending = false;
+		IS bool busy = false;
+		IS std::atomic<bool> running = false;
+		IS std::exception_ptr error;
+		IS std::atomic<u32> windowWidth = 0;
+		IS std::atomic<u32> windowHeight = 0;
+		IS bool waitingForWindow = false;
+	};
+
+	// Records into the current frame's command buffer, or into the snapshot when the
+	// render thread is active
+	static void Record(std::function<void(VkCommandBuffer)> command);
+
 	struct aglRenderPassSettings
 	{
 		VkImageLayout colorAttachmentLayout;
@@ -324,11 +893,60 @@ public:
 
 		aglSwapchain();
 
-		void CreateSwapChain();
+		void CreateSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
 		void Destroy();
 		void Recreate();
 	};
 
+	// Vulkan objects released while submitted work may still reference them. Each entry is
+	// destroyed once the graphics timeline passes the last submission that could have used it,
+	// so destroying or reloading resources never has to drain the device.
+	struct AURORA_API aglDeletionQueue
+	{
+		// For objects the frame being recorded may reference, retires after that frame is submitted
+		static void Push(std::function<void()> destroy);
+		// Retires once the graphics timeline reaches timelineValue
+		static void Push(uint64_t timelineValue, std::function<void()> destroy);
+
+		static void OnFrameSubmitted(uint64_t frameValue);
+		// Runs every entry whose timeline value has completed
+		static void Collect();
+		// Runs everything, the device must be idle
+		static void Flush();
+
+	private:
+		struct PendingEntry
+		{
+			// Frame submissions left before the entry gets a timeline value
+			u32 submissions;
+			std::function<void()> destroy;
+		};
+
+		struct Entry
+		{
+			uint64_t timelineValue;
+			std::function<void()> destroy;
+		};
+
+		IS std::mutex mutex;
+		IS std::vector<PendingEntry> pending;
+		IS std::vector<Entry> entries;
+	};
+
+	// Swapchain resources replaced by a recreation, handed to aglDeletionQueue so resizing
+	// never drains the device
+	struct RetiredSurfaceResources
+	{
+		VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+		std::vector<VkFramebuffer> framebuffers;
+		std::vector<VkImageView> imageViews;
+		VkImage depthImage = VK_NULL_HANDLE;
+		aglAllocation depthImageMemory;
+		VkImageView depthImageView = VK_NULL_HANDLE;
+
+		void Destroy();
+	};
+
 	struct aglFramebufferCreationSettings
 	{
 		VkFormat format;
@@ -342,9 +960,9 @@ public:
 		VkFormat imageFormat;
 		VkExtent2D extent;
 		std::vector<VkFramebuffer> framebuffers;
-		VkImage depthImage;
-		VkDeviceMemory depthImageMemory;
-		VkImageView depthImageView;
+		VkImage depthImage = VK_NULL_HANDLE;
+		aglAllocation depthImageMemory;
+		VkImageView depthImageView = VK_NULL_HANDLE;
 
 		aglFramebuffer();
 
@@ -353,10 +971,13 @@ public:
 		aglRenderPass* GetRenderPass() { return renderPass; };
 
 		void Destroy();
+		// Hands the size-dependent views, framebuffers and depth target over to be destroyed later
+		void Retire(RetiredSurfaceResources& retired);
 
 		float GetAspect() { return extent.width / static_cast<float>(extent.height); }
 
 		void Recreate();
+		void WaitForValidExtent();
 
 		bool IsResized() { return Resized; }
 
@@ -367,13 +988,14 @@ public:
 			GetRenderPass()->Begin(imageIndex, cmdBuf);
 		}
 
-		bool Resized = false;
+		// Set by the application thread, taken by whichever thread presents
+		std::atomic<bool> Resized = false;
 
 
 		void CreateImageViews();
 		void CreateDepthResources();
 
-		aglRenderPass* renderPass;
+		aglRenderPass* renderPass = nullptr;
 	};
 
 	struct aglUniformBuffer;
@@ -440,6 +1062,81 @@ public:
 		aglShader* parent;
 	};
 
+	struct aglVertex;
+
+	// Attributes always use their enum value as shader location
+	enum aglVertexAttribute
+	{
+		AGL_VERTEX_POSITION = 0,
+		AGL_VERTEX_NORMAL,
+		AGL_VERTEX_TEXCOORD,
+		AGL_VERTEX_TANGENT,
+		AGL_VERTEX_COLOR,
+		AGL_VERTEX_ATTRIBUTE_COUNT
+	};
+
+	enum aglVertexEncoding
+	{
+		// Attribute isn't stored
+		AGL_ENCODING_NONE = 0,
+		AGL_ENCODING_FLOAT,
+		// Positions and texcoords
+		AGL_ENCODING_HALF,
+		// Normals and tangents, xyzw
+		AGL_ENCODING_SNORM16,
+		// Normals as two 16-bit snorms, the shader receives a vec2 e and decodes it with
+		// n = vec3(e, 1 - abs(e.x) - abs(e.y)); if (n.z < 0) n.xy = (1 - abs(n.yx)) * sign(n.xy);
+		AGL_ENCODING_OCTAHEDRAL,
+		// Colors
+		AGL_ENCODING_UNORM8
+	};
+
+	// GPU layout of mesh vertices. Apart from octahedral normals, every encoding reaches the
+	// shader with the same type as the float layout, so shaders don't change with the format.
+	struct AURORA_API aglVertexFormat
+	{
+		aglVertexEncoding encodings[AGL_VERTEX_ATTRIBUTE_COUNT] = {
+			AGL_ENCODING_FLOAT, AGL_ENCODING_FLOAT, AGL_ENCODING_FLOAT, AGL_ENCODING_NONE, AGL_ENCODING_NONE
+		};
+		// Positions get a stream (binding 0) of their own and the rest goes to binding 1, so
+		// depth-only passes fetch nothing but positions
+		bool splitPosition = false;
+
+		// 32 bytes, the same layout as aglVertex
+		static aglVertexFormat Standard();
+		// 20 bytes: float positions, octahedral normals and half texcoords
+		static aglVertexFormat Compact();
+
+		u32 GetStreamCount() const;
+		u32 GetStride(u32 stream) const;
+		void GetInputState(std::vector<VkVertexInputBindingDescription>& bindings,
+		                   std::vector<VkVertexInputAttributeDescription>& attributes, bool positionOnly = false) const;
+
+		// One byte stream per GetStreamCount. Tangents and colors may be empty, missing values
+		// encode as (1, 0, 0, 1) and white.
+		void Encode(const std::vector<aglVertex>& vertices, const std::vector<vec4>& tangents,
+		            const std::vector<vec4>& colors, std::vector<std::vector<uint8_t>>& streams) const;
+
+		bool operator==(const aglVertexFormat& other) const;
+
+		static VkFormat GetAttributeFormat(aglVertexAttribute attribute, aglVertexEncoding encoding);
+		static u32 GetAttributeSize(aglVertexAttribute attribute, aglVertexEncoding encoding);
+	};
+
+	// Per-instance vertex data of instanced draws, fed through AGL_INSTANCE_BINDING. Shaders read
+	// the transform columns at locations AGL_VERTEX_ATTRIBUTE_COUNT to +3 and the material index at +4.
+	struct aglInstanceData
+	{
+		glm::mat4 transform;
+		u32 materialIndex;
+		u32 padding[3];
+
+		static void GetInputState(std::vector<VkVertexInputBindingDescription>& bindings,
+		                          std::vector<VkVertexInputAttributeDescription>& attributes);
+	};
+
+	constexpr u32 AGL_INSTANCE_BINDING = 2;
+
 	struct aglShaderSettings
 	{
 		struct SettingPaths
@@ -457,6 +1154,13 @@ public:
 		u32 desiredID = cast(-1, u32);
 
 		aglRenderPass* renderPass = GetSurfaceDetails()->framebuffer->renderPass;
+
+		// Has to match the format of the meshes drawn with the shader
+		aglVertexFormat vertexFormat;
+		// Only feeds the position attribute, for depth passes
+		bool positionOnly = false;
+		// Takes aglInstanceData, the render queue merges entries sharing mesh, LOD and shader into one draw
+		bool instanced = false;
 	};
 
 	struct AURORA_API aglShader
@@ -516,10 +1220,10 @@ public:
 		std::vector<VkDescriptorSet> descriptorSets;
 		std::vector<std::vector<VkWriteDescriptorSet>> descriptorWrites;
 		std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
-		VkPipelineLayout pipelineLayout;
-		VkDescriptorSetLayout descriptorSetLayout;
-		VkPipeline mainPipeline;
-		VkDescriptorPool descriptorPool;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		VkPipeline mainPipeline = VK_NULL_HANDLE;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 		std::vector<aglDescriptorPort*> ports;
 
 		nlohmann::json Serialize();
@@ -547,8 +1251,9 @@ public:
 
 		IS VkQueue computeQueue;
 		IS std::vector<VkCommandBuffer> computeCommandBuffers;
-		IS std::vector<VkSemaphore> computeFinishedSemaphores;
-		IS std::vector<VkFence> computeInFlightFences;
+		IS std::vector<uint64_t> computeTimelineValues;
+		// Timeline value of the last dispatch field that the next graphics submission must wait on
+		IS uint64_t pendingTimelineValue = 0;
 		IS bool AreComputeShadersUsed=false;
 		IS bool ObjectsCreated = false;
 
@@ -582,7 +1287,7 @@ public:
 
 		VkDescriptorSetLayout setLayout;
 		std::vector<VkBuffer> buffers;
-		std::vector<VkDeviceMemory> bufferMemory;
+		std::vector<aglAllocation> bufferMemory;
 		std::vector<void*> mappedBuffers;
 
 		VkDescriptorSetLayoutBinding binding;
@@ -596,6 +1301,102 @@ public:
 
 	};
 
+	constexpr u32 AGL_HIZ_MAX_LEVELS = 16;
+
+	// Culls the indirect draws of a render queue on the GPU. Every instance is tested against the
+	// camera frustum and against a max-depth pyramid built from the previous frame's depth buffer,
+	// and the survivors are compacted into the buffer the queue draws from with
+	// vkCmdDrawIndexedIndirectCount. Without drawIndirectCount, culled commands keep their slot
+	// with zero instances instead. Compaction does not keep the order within a group.
+	// Occlusion is tested with the previous frame's camera, so something that was hidden last
+	// frame shows up a frame late. Assumes depth is cleared to 1 and compared with LESS.
+	struct AURORA_API aglGpuCuller
+	{
+		aglGpuCuller(aglFramebuffer* framebuffer, u32 maxObjects = 16384);
+
+		void Destroy();
+
+		// Copies a group of objects into this frame's input and records its indirect draw, with
+		// the group's pipeline and arena page already bound. False once the frame's capacity is
+		// used up, the group has to be drawn without culling then.
+		bool Draw(VkCommandBuffer cmdBuf, aglCullObject* objects, u32 count);
+		// Builds the pyramid and culls everything drawn since the last call. The next graphics
+		// submission waits for it.
+		void Dispatch();
+
+		bool occlusion = true;
+
+		IS std::string cullShaderPath = "resources/shaders/agl/cull.comp";
+		IS std::string pyramidShaderPath = "resources/shaders/agl/hiz.comp";
+
+		// Timeline value of the last dispatch, waited on before any graphics stage
+		IS uint64_t pendingTimelineValue = 0;
+
+	private:
+		// Laid out like CullParams in cull.comp
+		struct Params
+		{
+			glm::mat4 previousViewProjection;
+			glm::vec4 planes[6];
+			glm::vec2 pyramidSize;
+			u32 pyramidLevels;
+			u32 objectCount;
+			u32 occlusion;
+			u32 compact;
+			u32 padding[2];
+		};
+
+		struct Reduce
+		{
+			glm::ivec2 sourceSize;
+			glm::ivec2 targetSize;
+			int level;
+		};
+
+		void CreatePyramid();
+		void DestroyPyramid();
+		// Points both shaders at the current depth buffer and pyramid
+		void GetImageWrites(VkWriteDescriptorSet writes[3]);
+		void BuildPyramid(VkCommandBuffer cmdBuf);
+
+		aglFramebuffer* framebuffer;
+		u32 maxObjects;
+		u32 objectCount = 0;
+		u32 groupCount = 0;
+
+		aglComputeShader* cullShader;
+		aglComputeShader* pyramidShader;
+		aglStorageBuffer* paramsBuffer;
+		aglStorageBuffer* objectBuffer;
+		aglStorageBuffer* drawBuffer;
+		aglStorageBuffer* countBuffer;
+		aglPushConstant reducePushConstant;
+
+		VkSampler sampler = VK_NULL_HANDLE;
+		VkImage pyramid = VK_NULL_HANDLE;
+		aglAllocation pyramidMemory;
+		VkImageView pyramidView = VK_NULL_HANDLE;
+		VkImageView levelViews[AGL_HIZ_MAX_LEVELS] = {};
+		VkExtent2D pyramidExtent{};
+		u32 pyramidLevels = 0;
+
+		// A different depth image means the surface was resized
+		VkImage sourceDepth = VK_NULL_HANDLE;
+		VkExtent2D sourceExtent{};
+		bool depthValid = false;
+
+		VkDescriptorImageInfo depthInfo{};
+		VkDescriptorImageInfo pyramidInfo{};
+		VkDescriptorImageInfo levelInfos[AGL_HIZ_MAX_LEVELS] = {};
+		// Descriptor sets are only rewritten once their frame slot is free again
+		u32 pyramidVersion = 0;
+		u32 descriptorVersions[MAX_FRAMES_IN_FLIGHT] = {};
+
+		std::vector<VkCommandBuffer> commandBuffers;
+		std::vector<uint64_t> timelineValues;
+		glm::mat4 previousViewProjection = glm::mat4(0.0f);
+	};
+
 	// Combined variables
 
 	inline static SDL_Window* window = nullptr;
@@ -686,26 +1487,28 @@ public:
 
 	struct AURORA_API aglTexture
 	{
-		aglTexture(std::string path, VkFormat format);
+		// Without a batch the upload is submitted and waited on before returning
+		aglTexture(std::string path, VkFormat format, aglUploadBatch* batch = nullptr);
 		aglTexture(aglShader* shader, aglTextureCreationInfo info);
-		aglTexture(aglTextureCreationInfo info);
+		aglTexture(aglTextureCreationInfo info, aglUploadBatch* batch = nullptr);
 
-		aglTexture(aglTextureRef ref) : aglTexture(ref.path, VK_FORMAT_R8G8B8A8_SRGB)
+		aglTexture(aglTextureRef ref, aglUploadBatch* batch = nullptr) : aglTexture(ref.path, VK_FORMAT_R8G8B8A8_SRGB, batch)
 		{
 		}
 
-		void Create(std::string path, VkFormat format);
+		void Create(std::string path, VkFormat format, aglUploadBatch* batch = nullptr);
 		void Create(aglShader* shader, aglTextureCreationInfo info);
 
 		static VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
 		                                   bool IsCubemap=false, u32 mipCount=1);
 		static void CreateVulkanImage(u32 width, u32 height, VkFormat format, VkImageTiling tiling,
 		                              VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image,
-		                              VkDeviceMemory& imageMemory, bool IsCubemap=false, u32 mipCount=1);
+		                              aglAllocation& imageMemory, bool IsCubemap=false, u32 mipCount=1,
+		                              aglMemoryCategory category = AGL_MEMORY_TEXTURE, const void* owner = nullptr);
 		void CreateTextureSampler(float numMips = 0);
 
 		VkImage textureImage;
-		VkDeviceMemory textureImageMemory;
+		aglAllocation textureImageMemory;
 		VkImageView textureImageView;
 		VkSampler textureSampler;
 
@@ -724,9 +1527,15 @@ public:
 
 		aglTextureCreationInfo info;
 
+		// False while a streamed texture still shows the placeholder
+		bool resident = true;
+
 	private:
 
 		friend aglShader;
+		friend aglStreamingLoader;
+
+		aglTexture() = default;
 
 		aglShader* sourceShader = nullptr;
 	};
@@ -744,43 +1553,185 @@ public:
 		aglShader* shader=nullptr;
 	};
 
+	// Shared device local vertex and index buffers all aglMesh geometry is sub-allocated from.
+	// Meshes only keep ranges, so every mesh on the same page draws after a single bind.
+	// A new page is added when the current ones are full.
+	struct AURORA_API aglMeshArena
+	{
+		struct Range
+		{
+			u32 page = 0;
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+		};
+
+		static void Create(VkDeviceSize vertexPageSize, VkDeviceSize indexPageSize);
+		static void Destroy();
+
+		// All ranges land on the same page. Offsets are aligned to the stream strides and index
+		// size, so they can be passed to draws as vertexOffset and firstIndex.
+		static void Allocate(u32 streamCount, const VkDeviceSize* streamSizes, const VkDeviceSize* streamStrides,
+		                     Range* streams, VkDeviceSize indexSize, VkDeviceSize indexStride, Range& indices);
+		static void Free(u32 streamCount, const Range* streams, const Range& indices);
+
+		static VkBuffer GetVertexBuffer(u32 page);
+		static VkBuffer GetIndexBuffer(u32 page);
+		static void Bind(VkCommandBuffer commandBuffer, u32 page, VkIndexType indexType = VK_INDEX_TYPE_UINT32);
+
+	private:
+		struct Page
+		{
+			VkBuffer vertexBuffer;
+			VkBuffer indexBuffer;
+			aglAllocation vertexMemory;
+			aglAllocation indexMemory;
+			aglFreeList vertexRanges;
+			aglFreeList indexRanges;
+		};
+
+		static void AddPage(VkDeviceSize vertexSize, VkDeviceSize indexSize);
+
+		IS std::mutex mutex;
+		IS std::vector<Page> pages;
+		IS VkDeviceSize vertexPageSize = 64ull * 1024 * 1024;
+		IS VkDeviceSize indexPageSize = 32ull * 1024 * 1024;
+	};
+
+	// What an aglMesh keeps in system memory once its geometry is on the GPU
+	enum aglMeshCpuData
+	{
+		AGL_MESH_CPU_KEEP = 0,
+		// Geometry is released, bounds and the LOD table stay for culling and LOD selection
+		AGL_MESH_CPU_BOUNDS,
+		// Bounds are released too, LOD selection treats the mesh as a point at its origin
+		AGL_MESH_CPU_DROP
+	};
+
 	struct aglMeshCreationData
 	{
 		std::vector<aglVertex> vertices;
 		std::vector<unsigned> indices;
+
+		// Optional, only uploaded when the format stores them
+		std::vector<vec4> tangents;
+		std::vector<vec4> colors;
+		aglVertexFormat format;
 	};
 
 	struct AURORA_API  aglMesh
 	{
 		std::vector<aglVertex> vertices;
 		std::vector<unsigned> indices;
+		// Tangent w holds the bitangent sign
+		std::vector<vec4> tangents;
+		std::vector<vec4> colors;
+
+		aglVertexFormat format = defaultFormat;
+		// Used by meshes that aren't given a format, e.g. imported models
+		IS aglVertexFormat defaultFormat;
+
+		// Where the geometry lives in aglMeshArena, all ranges are on the same page. The
+		// attribute range is only used when the format splits positions out.
+		aglMeshArena::Range vertexRange;
+		aglMeshArena::Range attributeRange;
+		aglMeshArena::Range indexRange;
+		// 16-bit whenever the vertex count allows, indices stay 32-bit on the CPU
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+		struct Lod
+		{
+			// Into indices and the index range
+			u32 firstIndex = 0;
+			u32 indexCount = 0;
+			// Largest distance the surface moved from the full mesh, in object space units
+			float error = 0.0f;
+		};
+
+		// lods[0] is the full mesh. Every level draws from the same vertices, their indices
+		// follow each other in indices.
+		std::vector<Lod> lods;
+
+		// Object space bounding sphere and box
+		vec3 boundsCenter = vec3(0.0f);
+		float boundsRadius = 0.0f;
+		vec3 boundsMin = vec3(0.0f);
+		vec3 boundsMax = vec3(0.0f);
+
+		// World space bounding sphere, radius in w. Scaled by the largest axis of transform, and
+		// never culled when the bounds were dropped with the CPU data.
+		glm::vec4 GetBoundingSphere(const glm::mat4& transform) const;
+
+		// Applied to model meshes once a mesh cache entry backs them. Standalone meshes have
+		// nothing to bring released data back from, they keep it until ReleaseCpuData is called.
+		IS aglMeshCpuData defaultCpuData = AGL_MESH_CPU_KEEP;
+		// What is currently resident
+		aglMeshCpuData cpuData = AGL_MESH_CPU_KEEP;
 
-		VkBuffer vertexBuffer;
-		VkDeviceMemory vertexBufferMemory;
-		VkBuffer indexBuffer;
-		VkDeviceMemory indexBufferMemory;
+		// Levels generated for imported meshes, including the full mesh
+		IS u32 importLodCount = 4;
+
+		// Imported meshes run Optimize before uploading
+		IS bool optimizeOnImport = true;
+		// ACMR of the last Optimize, for a 16 entry FIFO cache
+		float acmrBefore = 0.0f, acmrAfter = 0.0f;
 
 
 		u32 materialIndex;
 
 		static aglMesh* GrabMesh(std::string path, int idx);
-		aglMesh(aiMesh* mesh, std::string path, int idx);
-		aglMesh(aglMeshCreationData data);
+		// Without a batch the upload is submitted and waited on before returning
+		aglMesh(aiMesh* mesh, std::string path, int idx, aglUploadBatch* batch = nullptr);
+		aglMesh(aglMeshCreationData data, aglUploadBatch* batch = nullptr);
+
+		void Draw(VkCommandBuffer commandBuffer, u32 imageIndex, u32 lod = 0);
+		// Assumes the mesh's arena page is already bound. Split formats bind their own streams,
+		// leaving binding 0 pointing at this mesh afterwards.
+		void DrawBound(VkCommandBuffer commandBuffer, u32 lod = 0, u32 instanceCount = 1, u32 firstInstance = 0);
+		// The same draw as DrawBound, for non-split formats where no per-mesh binds are needed
+		VkDrawIndexedIndirectCommand GetDrawCommand(u32 lod = 0, u32 instanceCount = 1, u32 firstInstance = 0) const;
+
+		// The arena ranges are released once no submitted frame can use them
+		void Destroy();
+
+		// Reorders triangles for the vertex cache and overdraw, then vertices for fetch locality.
+		// Only affects the CPU copy, call before the mesh is uploaded and before GenerateLods.
+		void Optimize();
+
+		// Replaces any existing levels with lodCount - 1 simplified ones, each aiming for reduction
+		// times the previous level's triangles. Stops early once a level would move the surface by
+		// more than maxError of the mesh extent, or when simplification stalls.
+		void GenerateLods(u32 lodCount, float reduction = 0.5f, float maxError = 0.05f);
 
-		void Draw(VkCommandBuffer commandBuffer, u32 imageIndex);
+		// Frees vertices, indices, tangents and colors, plus the bounds for AGL_MESH_CPU_DROP.
+		// The GPU copy is untouched. Without a mesh cache entry the data is gone for good.
+		void ReleaseCpuData(aglMeshCpuData policy);
+		// Brings released geometry back from the mesh cache, false when the mesh didn't come from
+		// a cached model. Anything reading vertices or indices after upload should call this first.
+		bool RequireCpuData();
 
 		static void ExportAsCode(aglMesh* mesh, std::string path);
 
 
 		std::vector<aglTexture> textures;
 
-		friend class aglModel;
+		friend struct aglModel;
 
 		std::string path;
 		int meshIndex;
 
 	private:
-		void Setup();
+		aglMesh() = default;
+
+		// CPU side only, safe to run for several meshes at once
+		void Convert(aiMesh* mesh);
+		void Setup(aglUploadBatch* batch);
+		void ComputeBounds();
+		void ComputeBounds(const aglVertex* source, size_t count);
+		// Stages already encoded streams and indexCount indices packed as indexType into the
+		// arena. Also fills in a single LOD when none were generated.
+		void Upload(aglUploadBatch* batch, const uint8_t* const* streamData, const VkDeviceSize* streamSizes, const void* indexData, u32 indexCount);
+
+		friend struct aglMeshCache;
 	};
 
 	struct aglModel
@@ -788,12 +1739,126 @@ public:
 		std::vector<aglMesh*> meshes;
 		std::vector<aglMaterial*> materials;
 
-		aglModel(std::string path);
+		aglModel() = default;
+		// Meshes and materials are converted on the worker pool, then all meshes are uploaded in a
+		// single submission, into batch if one is given
+		aglModel(std::string path, aglUploadBatch* batch = nullptr);
+
+		// aiPostProcessSteps used for every import. CalcTangentSpace is added by GetImportFlags
+		// only when aglMesh::defaultFormat stores tangents.
+		static u32 importFlags;
+		static u32 GetImportFlags();
+
+		// False while a streamed model has no meshes yet
+		bool resident = true;
 
-		void Draw(aglCommandBuffer* commandBuffer, u32 imageIndex);
+		// Meshes outside the camera frustum are skipped in Draw. Opt-in, it culls by the transform
+		// passed to Draw, which callers keeping the model matrix in their own uniforms don't pass
+		bool frustumCulling = false;
+
+		// The transform only picks each mesh's LOD and culls it
+		void Draw(aglCommandBuffer* commandBuffer, u32 imageIndex, const glm::mat4& transform = glm::mat4(1.0f));
+		void DrawMeshes(VkCommandBuffer cmdBuf, const glm::mat4& transform = glm::mat4(1.0f));
+		// One LOD per mesh, CULLED skips it
+		void DrawMeshes(VkCommandBuffer cmdBuf, const u32* meshLods);
+
+		static constexpr u32 CULLED = UINT32_MAX;
 
 
 		std::vector<aglTextureRef> LoadMaterialTextures(aiMaterial* material, aiTextureType type, std::string path);
+
+	private:
+		void SelectMeshLods(const glm::mat4& transform, std::vector<u32>& meshLods);
+		static void DrawMeshes(VkCommandBuffer cmdBuf, const std::vector<aglMesh*>& drawn, const u32* meshLods);
+	};
+
+	// Cooked copies of imported models under compiled/meshes/, keyed by source path and checked
+	// against the source's size, mtime and content hash. Warm loads map the file and stage the
+	// encoded vertex streams and packed indices directly, without running Assimp.
+	struct AURORA_API aglMeshCache
+	{
+		IS bool enabled = true;
+
+		// False when there is no valid entry for path, model is left untouched then. Geometry the
+		// cpuData policy would release is never copied out of the file.
+		static bool Load(const std::string& path, aglModel& model, aglUploadBatch* batch, aglMeshCpuData cpuData = AGL_MESH_CPU_KEEP);
+		// False when no entry could be written
+		static bool Save(const std::string& path, const aglModel& model);
+		// Geometry of a single mesh, for aglMesh::RequireCpuData
+		static bool LoadMeshData(aglMesh& mesh);
+
+		static std::string GetCachePath(const std::string& path);
+		// 64-bit FNV-1a
+		static uint64_t Hash(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+	};
+
+	// Fixed set of threads running background jobs in submission order
+	struct AURORA_API aglWorkerPool
+	{
+		static void Start(u32 threadCount);
+		static void Stop();
+
+		static void Submit(std::function<void()> job);
+		// Runs fn for every index in [0, count) on the pool and the calling thread, returns once
+		// all have finished. Safe to call from a job, the caller works through whatever is left.
+		static void ParallelFor(u32 count, const std::function<void(u32)>& fn);
+
+	private:
+		static void Run();
+
+		IS std::vector<std::thread> threads;
+		IS std::mutex mutex;
+		IS std::condition_variable condition;
+		IS std::deque<std::function<void()>> jobs;
+		IS bool stopping = false;
+	};
+
+	// Decodes and imports on the worker pool and uploads through upload batches, so loads never
+	// block the frame loop. The returned handles are usable right away: textures show a 1x1
+	// placeholder and models have no meshes until their data is resident.
+	struct AURORA_API aglStreamingLoader
+	{
+		static aglTexture* LoadTexture(std::string path, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);
+		static aglModel* LoadModel(std::string path);
+
+		// Called by the application thread at frame start: makes finished loads resident
+		static void Update();
+		// Called once the current frame slot is free: rewrites the slot's descriptor sets that
+		// still point at the placeholder
+		static void RefreshFrame();
+
+		static void Destroy();
+
+	private:
+		struct CompletedTexture
+		{
+			aglTexture* handle;
+			aglTexture* loaded;
+			aglUploadBatch* batch;
+		};
+
+		struct CompletedModel
+		{
+			aglModel* handle;
+			aglModel* loaded;
+			aglUploadBatch* batch;
+		};
+
+		struct DescriptorRefresh
+		{
+			aglTexture* texture;
+			// Frame slots whose descriptor sets still reference the placeholder
+			u32 slotMask;
+		};
+
+		static aglTexture* GetPlaceholder();
+		static void RefreshDescriptors(aglTexture* texture, u32 slot);
+
+		IS aglTexture* placeholder = nullptr;
+		IS std::mutex mutex;
+		IS std::vector<CompletedTexture> completedTextures;
+		IS std::vector<CompletedModel> completedModels;
+		IS std::vector<DescriptorRefresh> refreshes;
 	};
 
 	struct AURORA_API aglUniformBuffer
@@ -818,7 +1883,7 @@ public:
 
 		VkDescriptorSetLayout setLayout;
 		std::vector<VkBuffer> uniformBuffers;
-		std::vector<VkDeviceMemory> ubMemory;
+		std::vector<aglAllocation> ubMemory;
 		std::vector<void*> mappedUbs;
 
 		VkDescriptorSetLayoutBinding binding;
@@ -6,6 +6,9 @@
 
 #include "aurora/utils/fs.hpp"
 
+#include <algorithm>
+#include <memory>
+
 #include "imgui/imgui.h"
 #include "imgui/backends/imgui_impl_sdl2.h"
 #include "imgui/backends/imgui_impl_vulkan.h"
@@ -79,8 +82,9 @@ void aglImGuiExtension::Install()
 	init_info.Device = agl::device;
 	init_info.Queue = agl::graphicsQueue;
 	init_info.DescriptorPool = imguiPool;
-	init_info.MinImageCount = MAX_FRAMES_IN_FLIGHT;
-	init_info.ImageCount = MAX_FRAMES_IN_FLIGHT;
+	// The backend requires at least two
+	init_info.MinImageCount = std::max<u32>(agl::GetFramesInFlight(), 2);
+	init_info.ImageCount = std::max<u32>(agl::GetFramesInFlight(), 2);
 	init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
 
 	ImGui_ImplVulkan_Init(&init_info, agl::GetSurfaceDetails()->framebuffer->renderPass->renderPass);
@@ -110,8 +114,33 @@ void aglImGuiExtension::Uninstall()
 void aglImGuiExtension::LateRefresh()
 {
 	ImGui::Render();
-	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), agl::GetSurfaceDetails()->commandBuffer->commandBuffers[agl::GetCurrentImage()]);
 
+	if (!agl::aglRenderThread::IsActive())
+	{
+		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), agl::GetSurfaceDetails()->commandBuffer->GetCommandBuffer(agl::currentFrame));
+		return;
+	}
+
+	// The draw lists are rebuilt by the next NewFrame, so the render thread gets its own copy
+	ImDrawData* source = ImGui::GetDrawData();
+	std::shared_ptr<ImDrawData> drawData(IM_NEW(ImDrawData)(*source), [](ImDrawData* data)
+	{
+		for (ImDrawList* list : data->CmdLists)
+		{
+			IM_DELETE(list);
+		}
+		IM_DELETE(data);
+	});
+
+	for (int i = 0; i < drawData->CmdLists.Size; ++i)
+	{
+		drawData->CmdLists[i] = source->CmdLists[i]->CloneOutput();
+	}
+
+	agl::Record([drawData](VkCommandBuffer cmdBuf)
+	{
+		ImGui_ImplVulkan_RenderDrawData(drawData.get(), cmdBuf);
+	});
 }
 
 void aglImGuiExtension::DragVec3(string text,vec3& v)
@@ -210,6 +239,60 @@ void aglImGuiExtension::Dockspace()
 
 }
 
+void aglImGuiExtension::MemoryPanel(bool* open)
+{
+	constexpr float mib = 1024.0f * 1024.0f;
+
+	if (!ImGui::Begin("GPU Memory", open))
+	{
+		ImGui::End();
+		return;
+	}
+
+	agl::aglMemoryStats stats = agl::aglAllocator::GetMemoryStats();
+
+	ImGui::Text(stats.budgetFromDriver ? "Budget: VK_EXT_memory_budget" : "Budget: heap size (VK_EXT_memory_budget unavailable)");
+	ImGui::Separator();
+
+	for (u32 i = 0; i < stats.heaps.size(); ++i)
+	{
+		const agl::aglMemoryHeapStats& heap = stats.heaps[i];
+
+		ImGui::Text("Heap %u (%s)", i, heap.deviceLocal ? "device local" : "host");
+
+		float fraction = heap.budget > 0 ? static_cast<float>(heap.usage) / static_cast<float>(heap.budget) : 0.0f;
+		string overlay = std::to_string(static_cast<int>(heap.usage / mib)) + " / " + std::to_string(static_cast<int>(heap.budget / mib)) + " MiB";
+		ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay.c_str());
+
+		ImGui::Text("agl blocks: %.1f MiB, in use: %.1f MiB", heap.blockBytes / mib, heap.allocatedBytes / mib);
+	}
+
+	ImGui::Separator();
+
+	if (ImGui::BeginTable("categories", 3))
+	{
+		ImGui::TableSetupColumn("Category");
+		ImGui::TableSetupColumn("Allocations");
+		ImGui::TableSetupColumn("MiB");
+		ImGui::TableHeadersRow();
+
+		for (u32 i = 0; i < agl::AGL_MEMORY_CATEGORY_COUNT; ++i)
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(agl::aglAllocator::GetCategoryName(static_cast<agl::aglMemoryCategory>(i)));
+			ImGui::TableNextColumn();
+			ImGui::Text("%u", stats.categoryAllocations[i]);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", stats.categoryBytes[i] / mib);
+		}
+
+		ImGui::EndTable();
+	}
+
+	ImGui::End();
+}
+
 ImGuiContext* aglImGuiExtension::GetContext()
 {
 	return ImGui::GetCurrentContext();
@@ -64,6 +64,8 @@ struct AURORA_API aglImGuiExtension : agl_ext::aglExtension
 	static void DragVec3(std::string text,vec3& v);
 	static void ColorEditVec3(std::string text, vec3& v);
 	static void Dockspace();
+	// Per-heap budget and per-category usage from agl::aglAllocator
+	static void MemoryPanel(bool* open = nullptr);
 
 	static ImGuiContext* GetContext();
 	static void ProcessSDLEvent(SDL_Event* event);
@@ -0,0 +1,597 @@
+#include "agl.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define AGL_CULL_AVX
+#define AGL_CULL_SSE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AGL_CULL_SSE
+#endif
+
+using namespace std;
+
+namespace
+{
+	u32 PreviousPowerOfTwo(u32 value)
+	{
+		u32 result = 1;
+
+		while (result * 2 <= value)
+		{
+			result *= 2;
+		}
+
+		return result;
+	}
+}
+
+void agl::aglCullingArray::Clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	radius.clear();
+}
+
+void agl::aglCullingArray::Add(const glm::vec4& sphere)
+{
+	centerX.push_back(sphere.x);
+	centerY.push_back(sphere.y);
+	centerZ.push_back(sphere.z);
+	radius.push_back(sphere.w);
+}
+
+void agl::aglCullingArray::Cull(const glm::vec4 planes[6], std::vector<uint8_t>& visible) const
+{
+	size_t count = Size();
+	size_t i = 0;
+
+	visible.resize(count);
+
+	// A sphere is outside once its center is further than its radius behind any plane
+#if defined(AGL_CULL_AVX)
+	{
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+
+		for (int p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm256_set1_ps(planes[p].x);
+			planeY[p] = _mm256_set1_ps(planes[p].y);
+			planeZ[p] = _mm256_set1_ps(planes[p].z);
+			planeW[p] = _mm256_set1_ps(planes[p].w);
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(&centerX[i]);
+			__m256 y = _mm256_loadu_ps(&centerY[i]);
+			__m256 z = _mm256_loadu_ps(&centerZ[i]);
+			__m256 r = _mm256_loadu_ps(&radius[i]);
+
+			int inside = 0xFF;
+
+			for (int p = 0; p < 6 && inside != 0; ++p)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])),
+				                                _mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), _mm256_add_ps(planeW[p], r)));
+
+				inside &= _mm256_movemask_ps(_mm256_cmp_ps(distance, zero, _CMP_GT_OQ));
+			}
+
+			for (int k = 0; k < 8; ++k)
+			{
+				visible[i + k] = static_cast<uint8_t>((inside >> k) & 1);
+			}
+		}
+	}
+#endif
+
+#if defined(AGL_CULL_SSE)
+	{
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+
+		for (int p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm_set1_ps(planes[p].x);
+			planeY[p] = _mm_set1_ps(planes[p].y);
+			planeZ[p] = _mm_set1_ps(planes[p].z);
+			planeW[p] = _mm_set1_ps(planes[p].w);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&centerX[i]);
+			__m128 y = _mm_loadu_ps(&centerY[i]);
+			__m128 z = _mm_loadu_ps(&centerZ[i]);
+			__m128 r = _mm_loadu_ps(&radius[i]);
+
+			int inside = 0xF;
+
+			for (int p = 0; p < 6 && inside != 0; ++p)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])),
+				                             _mm_add_ps(_mm_mul_ps(z, planeZ[p]), _mm_add_ps(planeW[p], r)));
+
+				inside &= _mm_movemask_ps(_mm_cmpgt_ps(distance, zero));
+			}
+
+			for (int k = 0; k < 4; ++k)
+			{
+				visible[i + k] = static_cast<uint8_t>((inside >> k) & 1);
+			}
+		}
+	}
+#endif
+
+	// Whatever is left over, or everything without SSE
+	for (; i < count; ++i)
+	{
+		bool inside = true;
+
+		for (int p = 0; p < 6 && inside; ++p)
+		{
+			inside = centerX[i] * planes[p].x + centerY[i] * planes[p].y + centerZ[i] * planes[p].z + (planes[p].w + radius[i]) > 0.0f;
+		}
+
+		visible[i] = inside ? 1 : 0;
+	}
+}
+
+void agl::aglCullingArray::ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	// Gribb-Hartmann, from the rows of the matrix
+	glm::vec4 rows[4];
+
+	for (int i = 0; i < 4; ++i)
+	{
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	for (int i = 0; i < 6; ++i)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+agl::aglGpuCuller::aglGpuCuller(aglFramebuffer* framebuffer, u32 maxObjects)
+{
+	this->framebuffer = framebuffer;
+	this->maxObjects = maxObjects;
+
+	aglShaderSettings settings;
+
+	settings.paths.computePath = cullShaderPath;
+	cullShader = new aglComputeShader(settings);
+
+	settings.paths.computePath = pyramidShaderPath;
+	pyramidShader = new aglComputeShader(settings);
+
+	reducePushConstant = { nullptr, sizeof(Reduce), VK_SHADER_STAGE_COMPUTE_BIT };
+	pyramidShader->pushConstant = &reducePushConstant;
+
+	paramsBuffer = new aglStorageBuffer({ VK_SHADER_STAGE_COMPUTE_BIT, static_cast<int>(sizeof(Params)) });
+	objectBuffer = new aglStorageBuffer({ VK_SHADER_STAGE_COMPUTE_BIT, static_cast<int>(sizeof(aglCullObject) * maxObjects) });
+	drawBuffer = new aglStorageBuffer({ VK_SHADER_STAGE_COMPUTE_BIT, static_cast<int>(sizeof(VkDrawIndexedIndirectCommand) * maxObjects) });
+	countBuffer = new aglStorageBuffer({ VK_SHADER_STAGE_COMPUTE_BIT, static_cast<int>(sizeof(u32) * maxObjects) });
+
+	paramsBuffer->AttachToShader(cullShader, 0);
+	objectBuffer->AttachToShader(cullShader, 1);
+	drawBuffer->AttachToShader(cullShader, 2);
+	countBuffer->AttachToShader(cullShader, 3);
+
+	VkSamplerCreateInfo samplerInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create culling sampler.");
+	}
+
+	CreatePyramid();
+
+	// Image bindings, in the order GetImageWrites returns them
+	struct ImageBinding
+	{
+		aglShader* shader;
+		u32 binding;
+		VkDescriptorType type;
+		u32 count;
+	};
+
+	ImageBinding imageBindings[3] = {
+		{ pyramidShader, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+		{ pyramidShader, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, AGL_HIZ_MAX_LEVELS },
+		{ cullShader, 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+	};
+
+	VkWriteDescriptorSet writes[3];
+	GetImageWrites(writes);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		const ImageBinding& imageBinding = imageBindings[i];
+
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = imageBinding.binding;
+		layoutBinding.descriptorType = imageBinding.type;
+		layoutBinding.descriptorCount = imageBinding.count;
+		layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorPoolSize poolSize{};
+		poolSize.type = imageBinding.type;
+		poolSize.descriptorCount = imageBinding.count * framesInFlight;
+
+		imageBinding.shader->AttachDescriptorSetLayout(layoutBinding, imageBinding.binding);
+		imageBinding.shader->AttachDescriptorPool(poolSize, imageBinding.binding);
+
+		for (u32 frame = 0; frame < framesInFlight; ++frame)
+		{
+			imageBinding.shader->AttachDescriptorWrite(&writes[i], frame, imageBinding.binding);
+		}
+	}
+
+	cullShader->Setup();
+	pyramidShader->Setup();
+
+	for (u32 frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+	{
+		descriptorVersions[frame] = pyramidVersion;
+	}
+
+	commandBuffers.resize(framesInFlight);
+	timelineValues.assign(framesInFlight, 0);
+
+	VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	allocInfo.commandPool = baseSurface->commandBuffer->commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = static_cast<u32>(commandBuffers.size());
+
+	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate culling command buffers.");
+	}
+}
+
+void agl::aglGpuCuller::Destroy()
+{
+	for (uint64_t value : timelineValues)
+	{
+		timeline->Wait(value);
+	}
+
+	vkFreeCommandBuffers(device, baseSurface->commandBuffer->commandPool, static_cast<u32>(commandBuffers.size()), commandBuffers.data());
+	commandBuffers.clear();
+
+	for (aglStorageBuffer* buffer : { paramsBuffer, objectBuffer, drawBuffer, countBuffer })
+	{
+		buffer->Destroy();
+		delete buffer;
+	}
+
+	cullShader->Destroy();
+	pyramidShader->Destroy();
+
+	DestroyPyramid();
+
+	aglDeletionQueue::Push([sampler = sampler]()
+	{
+		vkDestroySampler(device, sampler, nullptr);
+	});
+	sampler = VK_NULL_HANDLE;
+}
+
+bool agl::aglGpuCuller::Draw(VkCommandBuffer cmdBuf, aglCullObject* objects, u32 count)
+{
+	if (objectCount + count > maxObjects)
+	{
+		return false;
+	}
+
+	u32 groupBase = objectCount;
+	u32 countIndex = groupCount++;
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		objects[i].groupBase = groupBase;
+		objects[i].groupSlot = i;
+		objects[i].countIndex = countIndex;
+	}
+
+	// The frame slot is free by the time the queue is pushed, so its buffers can be written directly
+	memcpy(static_cast<aglCullObject*>(objectBuffer->GetData()) + groupBase, objects, sizeof(aglCullObject) * count);
+	static_cast<u32*>(countBuffer->GetData())[countIndex] = 0;
+
+	objectCount += count;
+
+	VkBuffer commands = drawBuffer->GetBuffer(currentFrame);
+	VkDeviceSize offset = sizeof(VkDrawIndexedIndirectCommand) * groupBase;
+	u32 stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	if (drawIndirectCountSupported)
+	{
+		vkCmdDrawIndexedIndirectCount(cmdBuf, commands, offset, countBuffer->GetBuffer(currentFrame), sizeof(u32) * countIndex, count, stride);
+	}
+	else if (multiDrawIndirectSupported)
+	{
+		vkCmdDrawIndexedIndirect(cmdBuf, commands, offset, count, stride);
+	}
+	else
+	{
+		for (u32 i = 0; i < count; ++i)
+		{
+			vkCmdDrawIndexedIndirect(cmdBuf, commands, offset + stride * i, 1, 0);
+		}
+	}
+
+	return true;
+}
+
+void agl::aglGpuCuller::Dispatch()
+{
+	const glm::mat4 viewProjection = aglRenderQueue::cullViewProjection;
+	bool hasCamera = viewProjection != glm::mat4(0.0f);
+
+	if (framebuffer->depthImage != sourceDepth)
+	{
+		DestroyPyramid();
+		CreatePyramid();
+	}
+
+	if (objectCount == 0)
+	{
+		previousViewProjection = viewProjection;
+		depthValid = true;
+		return;
+	}
+
+	if (descriptorVersions[currentFrame] != pyramidVersion)
+	{
+		VkWriteDescriptorSet writes[3];
+		GetImageWrites(writes);
+
+		writes[0].dstSet = pyramidShader->descriptorSets[currentFrame];
+		writes[1].dstSet = pyramidShader->descriptorSets[currentFrame];
+		writes[2].dstSet = cullShader->descriptorSets[currentFrame];
+
+		vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+		descriptorVersions[currentFrame] = pyramidVersion;
+	}
+
+	// The previous frame's depth has to have been drawn with a known camera
+	bool testOcclusion = occlusion && depthValid && hasCamera && previousViewProjection != glm::mat4(0.0f) &&
+		storageImageArrayDynamicIndexingSupported;
+
+	Params params{};
+	params.previousViewProjection = previousViewProjection;
+	params.pyramidSize = vec2(pyramidExtent.width, pyramidExtent.height);
+	params.pyramidLevels = pyramidLevels;
+	params.objectCount = objectCount;
+	params.occlusion = testOcclusion ? 1 : 0;
+	params.compact = drawIndirectCountSupported ? 1 : 0;
+
+	if (hasCamera)
+	{
+		aglCullingArray::ExtractFrustumPlanes(viewProjection, params.planes);
+	}
+	else
+	{
+		// Nothing to test against, every plane passes
+		for (int i = 0; i < 6; ++i)
+		{
+			params.planes[i] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+	}
+
+	memcpy(paramsBuffer->GetData(), &params, sizeof(params));
+
+	VkCommandBuffer cmdBuf = commandBuffers[currentFrame];
+
+	timeline->Wait(timelineValues[currentFrame]);
+	vkResetCommandBuffer(cmdBuf, 0);
+
+	VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(cmdBuf, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to begin recording culling command buffer.");
+	}
+
+	if (testOcclusion)
+	{
+		BuildPyramid(cmdBuf);
+	}
+
+	vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, cullShader->mainPipeline);
+	vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, cullShader->pipelineLayout, 0, 1, &cullShader->descriptorSets[currentFrame], 0, nullptr);
+	vkCmdDispatch(cmdBuf, (objectCount + 63) / 64, 1, 1);
+
+	if (vkEndCommandBuffer(cmdBuf) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record culling command buffer.");
+	}
+
+	uint64_t value = timeline->Submit(aglComputeShader::computeQueue, cmdBuf);
+
+	timelineValues[currentFrame] = value;
+	pendingTimelineValue = value;
+
+	previousViewProjection = viewProjection;
+	depthValid = true;
+	objectCount = 0;
+	groupCount = 0;
+}
+
+void agl::aglGpuCuller::CreatePyramid()
+{
+	sourceDepth = framebuffer->depthImage;
+	sourceExtent = framebuffer->extent;
+
+	// Level 0 is at most the depth buffer's size, so each of its texels covers under 2x2 of it
+	pyramidExtent.width = PreviousPowerOfTwo(std::max(sourceExtent.width, 1u));
+	pyramidExtent.height = PreviousPowerOfTwo(std::max(sourceExtent.height, 1u));
+	pyramidLevels = std::min(static_cast<u32>(std::log2(std::max(pyramidExtent.width, pyramidExtent.height))) + 1, AGL_HIZ_MAX_LEVELS);
+
+	aglTexture::CreateVulkanImage(pyramidExtent.width, pyramidExtent.height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+	                              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	                              pyramid, pyramidMemory, false, pyramidLevels, AGL_MEMORY_FRAMEBUFFER, this);
+
+	pyramidView = aglTexture::CreateImageView(pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, false, pyramidLevels);
+
+	for (u32 level = 0; level < pyramidLevels; ++level)
+	{
+		VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+		viewInfo.image = pyramid;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = VK_FORMAT_R32_SFLOAT;
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+		if (vkCreateImageView(device, &viewInfo, nullptr, &levelViews[level]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create depth pyramid view.");
+		}
+	}
+
+	depthInfo = { sampler, framebuffer->depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+	pyramidInfo = { sampler, pyramidView, VK_IMAGE_LAYOUT_GENERAL };
+
+	// Levels past the last one are never written, they only have to be valid
+	for (u32 level = 0; level < AGL_HIZ_MAX_LEVELS; ++level)
+	{
+		levelInfos[level] = { VK_NULL_HANDLE, levelViews[std::min(level, pyramidLevels - 1)], VK_IMAGE_LAYOUT_GENERAL };
+	}
+
+	pyramidVersion++;
+	depthValid = false;
+}
+
+void agl::aglGpuCuller::DestroyPyramid()
+{
+	if (pyramid == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vector<VkImageView> views(levelViews, levelViews + pyramidLevels);
+	views.push_back(pyramidView);
+
+	// Frames still in flight may be reading it
+	aglDeletionQueue::Push([image = pyramid, memory = pyramidMemory, views = std::move(views)]() mutable
+	{
+		for (VkImageView view : views)
+		{
+			vkDestroyImageView(device, view, nullptr);
+		}
+
+		vkDestroyImage(device, image, nullptr);
+		aglAllocator::Free(memory);
+	});
+
+	pyramid = VK_NULL_HANDLE;
+	pyramidView = VK_NULL_HANDLE;
+	memset(levelViews, 0, sizeof(levelViews));
+}
+
+void agl::aglGpuCuller::GetImageWrites(VkWriteDescriptorSet writes[3])
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	}
+
+	writes[0].dstBinding = 0;
+	writes[0].pImageInfo = &depthInfo;
+
+	writes[1].dstBinding = 1;
+	writes[1].descriptorCount = AGL_HIZ_MAX_LEVELS;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].pImageInfo = levelInfos;
+
+	writes[2].dstBinding = 4;
+	writes[2].pImageInfo = &pyramidInfo;
+}
+
+void agl::aglGpuCuller::BuildPyramid(VkCommandBuffer cmdBuf)
+{
+	VkFormat depthFormat = FindDepthFormat();
+
+	VkImageMemoryBarrier barriers[2] = {};
+
+	// Left in attachment layout by the previous frame's render pass, which clears it on load
+	barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].image = sourceDepth;
+	barriers[0].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	if (HasStencilComponent(depthFormat))
+	{
+		barriers[0].subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+
+	// Rebuilt from scratch, the last cull pass only has to be done reading it
+	barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[1].image = pyramid;
+	barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels, 0, 1 };
+
+	vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+	vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidShader->mainPipeline);
+	vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidShader->pipelineLayout, 0, 1, &pyramidShader->descriptorSets[currentFrame], 0, nullptr);
+
+	Reduce reduce{};
+	reduce.sourceSize = glm::ivec2(sourceExtent.width, sourceExtent.height);
+
+	VkMemoryBarrier levelBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	for (u32 level = 0; level < pyramidLevels; ++level)
+	{
+		reduce.targetSize = glm::max(glm::ivec2(pyramidExtent.width >> level, pyramidExtent.height >> level), glm::ivec2(1));
+		reduce.level = static_cast<int>(level);
+
+		vkCmdPushConstants(cmdBuf, pyramidShader->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Reduce), &reduce);
+		vkCmdDispatch(cmdBuf, (reduce.targetSize.x + 7) / 8, (reduce.targetSize.y + 7) / 8, 1);
+
+		// Also orders the last level before the cull pass
+		vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		                     1, &levelBarrier, 0, nullptr, 0, nullptr);
+
+		reduce.sourceSize = reduce.targetSize;
+	}
+}
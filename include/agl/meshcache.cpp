@@ -0,0 +1,678 @@
+#include "agl.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	constexpr char CACHE_MAGIC[4] = { 'A', 'G', 'L', 'M' };
+	constexpr u32 CACHE_VERSION = 3;
+	constexpr size_t CACHE_ALIGNMENT = 16;
+
+	// Keeps temp files apart when several loads import the same model at once
+	atomic<u32> tempCounter = 0;
+
+	struct CacheHeader
+	{
+		char magic[4];
+		u32 version;
+
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sourceHash;
+
+		u32 meshCount;
+		u32 materialCount;
+		u32 importFlags;
+		u32 lodCount;
+
+		uint8_t encodings[agl::AGL_VERTEX_ATTRIBUTE_COUNT];
+		uint8_t splitPosition;
+		uint8_t optimized;
+
+		uint64_t meshesOffset;
+		uint64_t materialsOffset;
+		uint64_t materialsSize;
+	};
+
+	// All offsets are from the start of the file and CACHE_ALIGNMENT aligned
+	struct CacheMesh
+	{
+		u32 materialIndex;
+		u32 vertexCount;
+		u32 indexCount;
+		u32 indexType;
+		u32 tangentCount;
+		u32 colorCount;
+		float acmrBefore;
+		float acmrAfter;
+		u32 lodCount;
+
+		uint64_t verticesOffset;
+		uint64_t tangentsOffset;
+		uint64_t colorsOffset;
+		uint64_t indicesOffset;
+		uint64_t lodsOffset;
+
+		// Ready to be staged as they are
+		uint64_t streamOffsets[2];
+		uint64_t streamSizes[2];
+		uint64_t packedIndicesOffset;
+		uint64_t packedIndicesSize;
+	};
+
+	struct MappedFile
+	{
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int file = -1;
+#endif
+
+		~MappedFile()
+		{
+			Close();
+		}
+
+		bool Open(const string& path)
+		{
+#if defined(_WIN32)
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				return false;
+			}
+			size = static_cast<size_t>(fileSize.QuadPart);
+
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping == nullptr)
+			{
+				return false;
+			}
+
+			data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+			file = open(path.c_str(), O_RDONLY);
+			if (file < 0)
+			{
+				return false;
+			}
+
+			struct stat info;
+			if (fstat(file, &info) != 0 || info.st_size == 0)
+			{
+				return false;
+			}
+			size = static_cast<size_t>(info.st_size);
+
+			void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+			data = view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+#endif
+			return data != nullptr;
+		}
+
+		void Close()
+		{
+#if defined(_WIN32)
+			if (data)
+			{
+				UnmapViewOfFile(data);
+			}
+			if (mapping)
+			{
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+			}
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (data)
+			{
+				munmap(const_cast<uint8_t*>(data), size);
+			}
+			if (file >= 0)
+			{
+				close(file);
+			}
+			file = -1;
+#endif
+			data = nullptr;
+			size = 0;
+		}
+
+		// Null when the range doesn't fit in the file
+		const uint8_t* At(uint64_t offset, uint64_t length) const
+		{
+			if (offset > size || length > size - offset)
+			{
+				return nullptr;
+			}
+
+			return data + offset;
+		}
+	};
+
+	uint64_t Append(vector<uint8_t>& blob, const void* data, size_t size)
+	{
+		blob.resize((blob.size() + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1));
+
+		uint64_t offset = blob.size();
+		blob.insert(blob.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+
+		return offset;
+	}
+
+	void AppendString(vector<uint8_t>& blob, const string& value)
+	{
+		u32 length = static_cast<u32>(value.size());
+		blob.insert(blob.end(), reinterpret_cast<const uint8_t*>(&length), reinterpret_cast<const uint8_t*>(&length) + sizeof(length));
+		blob.insert(blob.end(), value.begin(), value.end());
+	}
+
+	struct Reader
+	{
+		const uint8_t* cursor;
+		const uint8_t* end;
+
+		bool Read(void* out, size_t size)
+		{
+			if (static_cast<size_t>(end - cursor) < size)
+			{
+				return false;
+			}
+
+			memcpy(out, cursor, size);
+			cursor += size;
+			return true;
+		}
+
+		bool ReadString(string& out)
+		{
+			u32 length;
+			if (!Read(&length, sizeof(length)) || static_cast<size_t>(end - cursor) < length)
+			{
+				return false;
+			}
+
+			out.assign(reinterpret_cast<const char*>(cursor), length);
+			cursor += length;
+			return true;
+		}
+	};
+
+	int64_t GetSourceTime(const string& path)
+	{
+		return static_cast<int64_t>(filesystem::last_write_time(path).time_since_epoch().count());
+	}
+
+	template <typename T>
+	bool CopyArray(const MappedFile& file, uint64_t offset, u32 count, vector<T>& out)
+	{
+		const uint8_t* data = file.At(offset, sizeof(T) * uint64_t(count));
+		if (data == nullptr)
+		{
+			return false;
+		}
+
+		out.resize(count);
+		memcpy(out.data(), data, sizeof(T) * count);
+		return true;
+	}
+
+	// Maps the cache entry for path, null unless it is still valid for the source and the current import settings
+	const CacheHeader* MapEntry(const string& path, MappedFile& file, bool refreshTime = true)
+	{
+		error_code error;
+		uint64_t sourceSize = filesystem::file_size(path, error);
+		if (error)
+		{
+			return nullptr;
+		}
+
+		if (!file.Open(agl::aglMeshCache::GetCachePath(path)))
+		{
+			return nullptr;
+		}
+
+		const CacheHeader* header = reinterpret_cast<const CacheHeader*>(file.At(0, sizeof(CacheHeader)));
+		if (header == nullptr || memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header->version != CACHE_VERSION)
+		{
+			return nullptr;
+		}
+
+		if (header->sourceSize != sourceSize || header->importFlags != agl::aglModel::GetImportFlags() ||
+			header->optimized != uint8_t(agl::aglMesh::optimizeOnImport) || header->lodCount != agl::aglMesh::importLodCount)
+		{
+			return nullptr;
+		}
+
+		agl::aglVertexFormat format = agl::aglMesh::defaultFormat;
+		for (u32 i = 0; i < agl::AGL_VERTEX_ATTRIBUTE_COUNT; ++i)
+		{
+			if (header->encodings[i] != uint8_t(format.encodings[i]))
+			{
+				return nullptr;
+			}
+		}
+		if (header->splitPosition != uint8_t(format.splitPosition))
+		{
+			return nullptr;
+		}
+
+		// A touched but unchanged source (e.g. a fresh checkout) still hits, it just costs a hash
+		int64_t sourceTime = GetSourceTime(path);
+		if (header->sourceTime != sourceTime)
+		{
+			uint64_t sourceHash = header->sourceHash;
+
+			MappedFile source;
+			if (!source.Open(path) || agl::aglMeshCache::Hash(source.data, source.size) != sourceHash)
+			{
+				return nullptr;
+			}
+
+			// Already the second pass, the write didn't go through (e.g. a read only cache)
+			if (!refreshTime)
+			{
+				return header;
+			}
+
+			// The new time is stored so later loads skip the hash. The mapping is read only and
+			// blocks writers on Windows, so the entry is patched in between and mapped again.
+			string cachePath = agl::aglMeshCache::GetCachePath(path);
+			file.Close();
+
+			{
+				fstream out(cachePath, ios::binary | ios::in | ios::out);
+				out.seekp(offsetof(CacheHeader, sourceTime));
+				out.write(reinterpret_cast<const char*>(&sourceTime), sizeof(sourceTime));
+			}
+
+			// Checked again in full, the entry may have been replaced meanwhile
+			return MapEntry(path, file, false);
+		}
+
+		return header;
+	}
+}
+
+uint64_t agl::aglMeshCache::Hash(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+std::string agl::aglMeshCache::GetCachePath(const std::string& path)
+{
+	string key = filesystem::path(path).lexically_normal().generic_string();
+
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(Hash(key.data(), key.size())));
+
+	return "compiled/meshes/" + string(name) + ".aglmesh";
+}
+
+bool agl::aglMeshCache::Load(const std::string& path, aglModel& model, aglUploadBatch* batch, aglMeshCpuData cpuData)
+{
+	MappedFile file;
+	const CacheHeader* header = MapEntry(path, file);
+	if (header == nullptr)
+	{
+		return false;
+	}
+
+	aglVertexFormat format = aglMesh::defaultFormat;
+
+	const CacheMesh* entries = reinterpret_cast<const CacheMesh*>(file.At(header->meshesOffset, sizeof(CacheMesh) * uint64_t(header->meshCount)));
+	const uint8_t* materialData = file.At(header->materialsOffset, header->materialsSize);
+	if (entries == nullptr || materialData == nullptr)
+	{
+		return false;
+	}
+
+	// Everything is read before anything is uploaded, so a damaged file never leaves a half built model
+	vector<aglMesh*> meshes;
+
+	auto abort = [&meshes]()
+	{
+		for (aglMesh* mesh : meshes)
+		{
+			delete mesh;
+		}
+		return false;
+	};
+
+	for (u32 i = 0; i < header->meshCount; ++i)
+	{
+		const CacheMesh& entry = entries[i];
+
+		aglMesh* mesh = new aglMesh();
+		meshes.push_back(mesh);
+
+		mesh->path = path;
+		mesh->meshIndex = static_cast<int>(i);
+		mesh->materialIndex = entry.materialIndex;
+		mesh->format = format;
+		mesh->indexType = static_cast<VkIndexType>(entry.indexType);
+		mesh->acmrBefore = entry.acmrBefore;
+		mesh->acmrAfter = entry.acmrAfter;
+
+		if (!CopyArray(file, entry.lodsOffset, entry.lodCount, mesh->lods))
+		{
+			return abort();
+		}
+
+		if (cpuData == AGL_MESH_CPU_KEEP)
+		{
+			if (!CopyArray(file, entry.verticesOffset, entry.vertexCount, mesh->vertices) ||
+				!CopyArray(file, entry.tangentsOffset, entry.tangentCount, mesh->tangents) ||
+				!CopyArray(file, entry.colorsOffset, entry.colorCount, mesh->colors) ||
+				!CopyArray(file, entry.indicesOffset, entry.indexCount, mesh->indices))
+			{
+				return abort();
+			}
+
+			mesh->ComputeBounds();
+		}
+		else
+		{
+			// The geometry would be released right after the upload, so it's only checked and
+			// the bounds are read straight from the mapping
+			const aglVertex* vertices = reinterpret_cast<const aglVertex*>(file.At(entry.verticesOffset, sizeof(aglVertex) * uint64_t(entry.vertexCount)));
+			if (vertices == nullptr ||
+				file.At(entry.tangentsOffset, sizeof(vec4) * uint64_t(entry.tangentCount)) == nullptr ||
+				file.At(entry.colorsOffset, sizeof(vec4) * uint64_t(entry.colorCount)) == nullptr ||
+				file.At(entry.indicesOffset, sizeof(unsigned) * uint64_t(entry.indexCount)) == nullptr)
+			{
+				return abort();
+			}
+
+			if (cpuData == AGL_MESH_CPU_BOUNDS)
+			{
+				mesh->ComputeBounds(vertices, entry.vertexCount);
+			}
+		}
+
+		for (const aglMesh::Lod& lod : mesh->lods)
+		{
+			if (uint64_t(lod.firstIndex) + lod.indexCount > entry.indexCount)
+			{
+				return abort();
+			}
+		}
+
+		for (u32 stream = 0; stream < format.GetStreamCount(); ++stream)
+		{
+			if (file.At(entry.streamOffsets[stream], entry.streamSizes[stream]) == nullptr)
+			{
+				return abort();
+			}
+		}
+
+		if (file.At(entry.packedIndicesOffset, entry.packedIndicesSize) == nullptr)
+		{
+			return abort();
+		}
+	}
+
+	vector<aglMaterial*> materials;
+	Reader reader = { materialData, materialData + header->materialsSize };
+
+	for (u32 i = 0; i < header->materialCount; ++i)
+	{
+		aglMaterial* material = new aglMaterial;
+		materials.push_back(material);
+
+		u32 typeCount = 0;
+		bool valid = reader.Read(&typeCount, sizeof(typeCount));
+
+		for (u32 t = 0; valid && t < typeCount; ++t)
+		{
+			u32 type = 0, refCount = 0;
+			valid = reader.Read(&type, sizeof(type)) && reader.Read(&refCount, sizeof(refCount));
+
+			vector<aglTextureRef> refs(valid ? refCount : 0);
+			for (u32 r = 0; valid && r < refCount; ++r)
+			{
+				valid = reader.ReadString(refs[r].path);
+			}
+
+			material->textures.insert({ static_cast<aglMaterial::TextureType>(type), refs });
+		}
+
+		if (!valid)
+		{
+			for (aglMaterial* loaded : materials)
+			{
+				delete loaded;
+			}
+			return abort();
+		}
+	}
+
+	aglUploadBatch localBatch;
+	aglUploadBatch* upload = batch ? batch : &localBatch;
+
+	for (u32 i = 0; i < header->meshCount; ++i)
+	{
+		const CacheMesh& entry = entries[i];
+
+		const uint8_t* streamData[2] = {};
+		for (u32 stream = 0; stream < format.GetStreamCount(); ++stream)
+		{
+			streamData[stream] = file.At(entry.streamOffsets[stream], entry.streamSizes[stream]);
+		}
+
+		meshes[i]->Upload(upload, streamData, entry.streamSizes, file.At(entry.packedIndicesOffset, entry.packedIndicesSize), entry.indexCount);
+		meshes[i]->ReleaseCpuData(cpuData);
+	}
+
+	// Staging holds its own copy, the mapping can go before the upload completes
+	localBatch.Destroy();
+
+	model.meshes = std::move(meshes);
+	model.materials = std::move(materials);
+
+	return true;
+}
+
+bool agl::aglMeshCache::LoadMeshData(aglMesh& mesh)
+{
+	MappedFile file;
+	const CacheHeader* header = MapEntry(mesh.path, file);
+	if (header == nullptr || mesh.meshIndex < 0 || static_cast<u32>(mesh.meshIndex) >= header->meshCount)
+	{
+		return false;
+	}
+
+	const CacheMesh* entry = reinterpret_cast<const CacheMesh*>(file.At(header->meshesOffset + sizeof(CacheMesh) * mesh.meshIndex, sizeof(CacheMesh)));
+	if (entry == nullptr)
+	{
+		return false;
+	}
+
+	aglMesh loaded;
+	if (!CopyArray(file, entry->verticesOffset, entry->vertexCount, loaded.vertices) ||
+		!CopyArray(file, entry->tangentsOffset, entry->tangentCount, loaded.tangents) ||
+		!CopyArray(file, entry->colorsOffset, entry->colorCount, loaded.colors) ||
+		!CopyArray(file, entry->indicesOffset, entry->indexCount, loaded.indices))
+	{
+		return false;
+	}
+
+	mesh.vertices = std::move(loaded.vertices);
+	mesh.tangents = std::move(loaded.tangents);
+	mesh.colors = std::move(loaded.colors);
+	mesh.indices = std::move(loaded.indices);
+
+	return true;
+}
+
+bool agl::aglMeshCache::Save(const std::string& path, const aglModel& model)
+{
+	MappedFile source;
+	if (!source.Open(path))
+	{
+		return false;
+	}
+
+	vector<uint8_t> blob(sizeof(CacheHeader));
+	vector<CacheMesh> entries(model.meshes.size());
+
+	for (size_t i = 0; i < model.meshes.size(); ++i)
+	{
+		const aglMesh* mesh = model.meshes[i];
+		CacheMesh& entry = entries[i];
+		entry = {};
+
+		entry.materialIndex = mesh->materialIndex;
+		entry.vertexCount = static_cast<u32>(mesh->vertices.size());
+		entry.indexCount = static_cast<u32>(mesh->indices.size());
+		entry.indexType = static_cast<u32>(mesh->indexType);
+		entry.tangentCount = static_cast<u32>(mesh->tangents.size());
+		entry.colorCount = static_cast<u32>(mesh->colors.size());
+		entry.acmrBefore = mesh->acmrBefore;
+		entry.acmrAfter = mesh->acmrAfter;
+		entry.lodCount = static_cast<u32>(mesh->lods.size());
+
+		entry.verticesOffset = Append(blob, mesh->vertices.data(), sizeof(aglVertex) * mesh->vertices.size());
+		entry.tangentsOffset = Append(blob, mesh->tangents.data(), sizeof(vec4) * mesh->tangents.size());
+		entry.colorsOffset = Append(blob, mesh->colors.data(), sizeof(vec4) * mesh->colors.size());
+		entry.indicesOffset = Append(blob, mesh->indices.data(), sizeof(unsigned) * mesh->indices.size());
+		entry.lodsOffset = Append(blob, mesh->lods.data(), sizeof(aglMesh::Lod) * mesh->lods.size());
+
+		vector<vector<uint8_t>> streams;
+		mesh->format.Encode(mesh->vertices, mesh->tangents, mesh->colors, streams);
+
+		for (u32 stream = 0; stream < mesh->format.GetStreamCount(); ++stream)
+		{
+			entry.streamOffsets[stream] = Append(blob, streams[stream].data(), streams[stream].size());
+			entry.streamSizes[stream] = streams[stream].size();
+		}
+
+		if (mesh->indexType == VK_INDEX_TYPE_UINT16)
+		{
+			vector<uint16_t> shortIndices(mesh->indices.begin(), mesh->indices.end());
+			entry.packedIndicesOffset = Append(blob, shortIndices.data(), sizeof(uint16_t) * shortIndices.size());
+			entry.packedIndicesSize = sizeof(uint16_t) * shortIndices.size();
+		}
+		else
+		{
+			entry.packedIndicesOffset = entry.indicesOffset;
+			entry.packedIndicesSize = sizeof(unsigned) * mesh->indices.size();
+		}
+	}
+
+	vector<uint8_t> materialData;
+	for (const aglMaterial* material : model.materials)
+	{
+		u32 typeCount = static_cast<u32>(material->textures.size());
+		materialData.insert(materialData.end(), reinterpret_cast<const uint8_t*>(&typeCount), reinterpret_cast<const uint8_t*>(&typeCount) + sizeof(typeCount));
+
+		for (const auto& [type, refs] : material->textures)
+		{
+			u32 values[2] = { static_cast<u32>(type), static_cast<u32>(refs.size()) };
+			materialData.insert(materialData.end(), reinterpret_cast<const uint8_t*>(values), reinterpret_cast<const uint8_t*>(values) + sizeof(values));
+
+			for (const aglTextureRef& ref : refs)
+			{
+				AppendString(materialData, ref.path);
+			}
+		}
+	}
+
+	CacheHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.sourceSize = source.size;
+	header.sourceTime = GetSourceTime(path);
+	header.sourceHash = Hash(source.data, source.size);
+	header.meshCount = static_cast<u32>(entries.size());
+	header.materialCount = static_cast<u32>(model.materials.size());
+	header.importFlags = aglModel::GetImportFlags();
+	header.lodCount = aglMesh::importLodCount;
+
+	aglVertexFormat format = model.meshes.empty() ? aglMesh::defaultFormat : model.meshes[0]->format;
+	for (u32 i = 0; i < AGL_VERTEX_ATTRIBUTE_COUNT; ++i)
+	{
+		header.encodings[i] = static_cast<uint8_t>(format.encodings[i]);
+	}
+	header.splitPosition = format.splitPosition;
+	header.optimized = aglMesh::optimizeOnImport;
+
+	header.meshesOffset = Append(blob, entries.data(), sizeof(CacheMesh) * entries.size());
+	header.materialsOffset = Append(blob, materialData.data(), materialData.size());
+	header.materialsSize = materialData.size();
+
+	memcpy(blob.data(), &header, sizeof(header));
+
+	source.Close();
+
+	string cachePath = GetCachePath(path);
+	string tempPath = cachePath + "." + to_string(hash<thread::id>{}(this_thread::get_id())) + "." + to_string(tempCounter++) + ".tmp";
+
+	filesystem::create_directories("compiled/meshes/");
+
+	{
+		ofstream out(tempPath, ios::binary | ios::trunc);
+		out.write(reinterpret_cast<const char*>(blob.data()), static_cast<streamsize>(blob.size()));
+
+		if (!out)
+		{
+			cout << "Failed to write mesh cache: " << cachePath << endl;
+			out.close();
+
+			error_code error;
+			filesystem::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	// Written aside and renamed over, so a reader never maps a partial file
+	error_code error;
+	filesystem::rename(tempPath, cachePath, error);
+	if (error)
+	{
+		filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,648 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+	constexpr int FORSYTH_CACHE_SIZE = 32;
+
+	float CacheScore(int position)
+	{
+		if (position < 0)
+		{
+			return 0.0f;
+		}
+
+		// The triangle just emitted, using its vertices again is worth less than staying close
+		if (position < 3)
+		{
+			return 0.75f;
+		}
+
+		const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+		return std::pow(1.0f - (position - 3) * scaler, 1.5f);
+	}
+
+	float ValenceScore(u32 remaining)
+	{
+		// Finishing off vertices with few triangles left frees cache slots sooner
+		return remaining == 0 ? 0.0f : 2.0f * std::pow(static_cast<float>(remaining), -0.5f);
+	}
+
+	// Symmetric 4x4 matrix of the summed squared plane distances
+	struct Quadric
+	{
+		float a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		float a11 = 0, a12 = 0, a13 = 0;
+		float a22 = 0, a23 = 0;
+		float a33 = 0;
+		float weight = 0;
+
+		void AddPlane(const vec3& n, float d, float w)
+		{
+			a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+			a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+			a22 += w * n.z * n.z; a23 += w * n.z * d;
+			a33 += w * d * d;
+			weight += w;
+		}
+
+		void Add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			weight += q.weight;
+		}
+
+		float Evaluate(const vec3& p) const
+		{
+			float result = a00 * p.x * p.x + 2.0f * a01 * p.x * p.y + 2.0f * a02 * p.x * p.z + 2.0f * a03 * p.x
+				+ a11 * p.y * p.y + 2.0f * a12 * p.y * p.z + 2.0f * a13 * p.y
+				+ a22 * p.z * p.z + 2.0f * a23 * p.z
+				+ a33;
+
+			// Averaged over the planes' weights, so it stays a squared distance
+			return weight > 0.0f ? std::abs(result) / weight : 0.0f;
+		}
+	};
+
+	uint64_t HashPosition(const vec3& p)
+	{
+		uint32_t bits[3];
+		memcpy(bits, &p, sizeof(bits));
+
+		return (uint64_t(bits[0]) * 73856093ull) ^ (uint64_t(bits[1]) * 19349663ull << 16) ^ (uint64_t(bits[2]) * 83492791ull << 32);
+	}
+
+	struct Collapse
+	{
+		unsigned from;
+		unsigned to;
+		float cost;
+	};
+}
+
+void agl::aglMeshOptimizer::OptimizeVertexCache(std::vector<unsigned>& indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles using each vertex, as one flat list with per-vertex offsets
+	std::vector<u32> remaining(vertexCount, 0);
+	for (unsigned index : indices)
+	{
+		remaining[index]++;
+	}
+
+	std::vector<u32> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		offsets[v + 1] = offsets[v] + remaining[v];
+	}
+
+	std::vector<u32> adjacency(indices.size());
+	std::vector<u32> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			adjacency[fill[indices[t * 3 + k]]++] = static_cast<u32>(t);
+		}
+	}
+
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		vertexScore[v] = ValenceScore(remaining[v]);
+	}
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+	}
+
+	std::vector<unsigned> result;
+	result.reserve(indices.size());
+
+	std::vector<unsigned> cache;
+	std::vector<unsigned> nextCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	int best = static_cast<int>(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+	size_t scanCursor = 0;
+
+	for (size_t n = 0; n < triangleCount; ++n)
+	{
+		if (best < 0)
+		{
+			// Nothing in the cache has triangles left, continue with the next unemitted one
+			while (emitted[scanCursor])
+			{
+				scanCursor++;
+			}
+			best = static_cast<int>(scanCursor);
+		}
+
+		emitted[best] = true;
+
+		const unsigned* triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned v = triangle[k];
+
+			u32* begin = &adjacency[offsets[v]];
+			u32* end = begin + remaining[v];
+			std::iter_swap(std::find(begin, end, static_cast<u32>(best)), end - 1);
+			remaining[v]--;
+		}
+
+		nextCache.assign(triangle, triangle + 3);
+		for (unsigned v : cache)
+		{
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				nextCache.push_back(v);
+			}
+		}
+
+		std::swap(cache, nextCache);
+
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			unsigned v = cache[i];
+			// Vertices pushed past the end still get rescored, they're evicted below
+			int position = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+
+			vertexScore[v] = CacheScore(position) + ValenceScore(remaining[v]);
+		}
+
+		best = -1;
+		float bestScore = -1.0f;
+
+		for (unsigned v : cache)
+		{
+			for (u32 a = offsets[v]; a < offsets[v] + remaining[v]; ++a)
+			{
+				u32 t = adjacency[a];
+
+				triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = static_cast<int>(t);
+				}
+			}
+		}
+
+		if (cache.size() > FORSYTH_CACHE_SIZE)
+		{
+			cache.resize(FORSYTH_CACHE_SIZE);
+		}
+	}
+
+	indices = std::move(result);
+}
+
+void agl::aglMeshOptimizer::OptimizeOverdraw(std::vector<unsigned>& indices, const std::vector<agl::aglVertex>& vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Cluster boundaries fall where the cache simulation misses all three vertices, cutting
+	// there costs next to nothing in cache efficiency
+	std::vector<size_t> clusterStarts;
+	{
+		const u32 cacheSize = 16;
+		std::vector<u32> timestamps(vertices.size(), 0);
+		u32 time = cacheSize + 1;
+
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			u32 misses = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned v = indices[t * 3 + k];
+				if (time - timestamps[v] > cacheSize)
+				{
+					timestamps[v] = time++;
+					misses++;
+				}
+			}
+
+			if (misses == 3 || t == 0)
+			{
+				clusterStarts.push_back(t);
+			}
+		}
+	}
+
+	vec3 meshCenter(0.0f);
+	for (const agl::aglVertex& vertex : vertices)
+	{
+		meshCenter += vertex.position;
+	}
+	meshCenter /= static_cast<float>(std::max<size_t>(vertices.size(), 1));
+
+	std::vector<float> sortKeys(clusterStarts.size());
+
+	for (size_t c = 0; c < clusterStarts.size(); ++c)
+	{
+		size_t begin = clusterStarts[c];
+		size_t end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount;
+
+		vec3 center(0.0f);
+		vec3 normal(0.0f);
+		float totalArea = 0.0f;
+
+		for (size_t t = begin; t < end; ++t)
+		{
+			vec3 a = vertices[indices[t * 3]].position;
+			vec3 b = vertices[indices[t * 3 + 1]].position;
+			vec3 d = vertices[indices[t * 3 + 2]].position;
+
+			// Area weighted, the cross product length is twice the area
+			vec3 faceNormal = glm::cross(b - a, d - a);
+			float area = glm::length(faceNormal);
+
+			center += (a + b + d) * (area / 3.0f);
+			normal += faceNormal;
+			totalArea += area;
+		}
+
+		if (totalArea > 0.0f)
+		{
+			center /= totalArea;
+		}
+
+		float normalLength = glm::length(normal);
+		if (normalLength > 0.0f)
+		{
+			normal /= normalLength;
+		}
+
+		sortKeys[c] = glm::dot(center - meshCenter, normal);
+	}
+
+	std::vector<size_t> order(clusterStarts.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<unsigned> result;
+	result.reserve(indices.size());
+
+	for (size_t c : order)
+	{
+		size_t begin = clusterStarts[c];
+		size_t end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount;
+
+		result.insert(result.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+	}
+
+	indices = std::move(result);
+}
+
+std::vector<uint32_t> agl::aglMeshOptimizer::OptimizeVertexFetch(std::vector<unsigned>& indices, size_t vertexCount)
+{
+	std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+	uint32_t next = 0;
+
+	for (unsigned& index : indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = next++;
+		}
+
+		index = remap[index];
+	}
+
+	return remap;
+}
+
+std::vector<unsigned> agl::aglMeshOptimizer::Simplify(const std::vector<unsigned>& indices, const std::vector<agl::aglVertex>& vertices,
+	size_t targetIndexCount, float targetError, float* resultError)
+{
+	std::vector<unsigned> result = indices;
+	size_t vertexCount = vertices.size();
+	float maxError = 0.0f;
+
+	if (resultError)
+	{
+		*resultError = 0.0f;
+	}
+
+	if (result.size() <= targetIndexCount || vertexCount == 0)
+	{
+		return result;
+	}
+
+	// Errors are measured on positions scaled to a unit extent
+	vec3 minimum = vertices[0].position;
+	vec3 maximum = vertices[0].position;
+	for (const agl::aglVertex& vertex : vertices)
+	{
+		minimum = glm::min(minimum, vertex.position);
+		maximum = glm::max(maximum, vertex.position);
+	}
+
+	vec3 extents = maximum - minimum;
+	float extent = std::max(extents.x, std::max(extents.y, extents.z));
+	float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+	std::vector<vec3> positions(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		positions[v] = (vertices[v].position - minimum) * scale;
+	}
+
+	std::vector<bool> locked(vertexCount, false);
+
+	// Vertices sharing a position are split by normals or texcoords, moving one would tear the seam
+	{
+		std::unordered_map<uint64_t, unsigned> firstAtPosition;
+		firstAtPosition.reserve(vertexCount);
+
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			const vec3& p = vertices[v].position;
+			uint64_t key = HashPosition(p);
+
+			auto [it, inserted] = firstAtPosition.insert({ key, static_cast<unsigned>(v) });
+			if (!inserted && vertices[it->second].position == p)
+			{
+				locked[v] = true;
+				locked[it->second] = true;
+			}
+		}
+	}
+
+	// Edges used by a single triangle are on an open border
+	{
+		std::unordered_map<uint64_t, int> edgeUses;
+		edgeUses.reserve(result.size());
+
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned a = result[i + k];
+				unsigned b = result[i + (k + 1) % 3];
+				edgeUses[(uint64_t(std::min(a, b)) << 32) | std::max(a, b)]++;
+			}
+		}
+
+		for (const auto& [edge, uses] : edgeUses)
+		{
+			if (uses == 1)
+			{
+				locked[edge >> 32] = true;
+				locked[edge & 0xffffffffu] = true;
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const vec3& p0 = positions[result[i]];
+		const vec3& p1 = positions[result[i + 1]];
+		const vec3& p2 = positions[result[i + 2]];
+
+		vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+
+		if (area <= 0.0f)
+		{
+			continue;
+		}
+
+		normal /= area;
+
+		Quadric q;
+		q.AddPlane(normal, -glm::dot(normal, p0), area);
+
+		quadrics[result[i]].Add(q);
+		quadrics[result[i + 1]].Add(q);
+		quadrics[result[i + 2]].Add(q);
+	}
+
+	// Quadrics hold area-weighted squared distances, they only rank the collapses
+	float errorLimit = targetError * targetError;
+
+	// Largest distance each vertex has moved off the surface it started on, what gets reported
+	std::vector<float> vertexErrors(vertexCount, 0.0f);
+
+	std::vector<unsigned> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<u32> triangleOffsets(vertexCount + 1);
+	std::vector<u32> triangleList;
+	std::vector<Collapse> collapses;
+
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3;
+
+		// Triangles around each vertex, for the flip check
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (unsigned index : result)
+		{
+			triangleOffsets[index + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+
+		triangleList.resize(result.size());
+		std::vector<u32> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			triangleList[fill[result[i]]++] = static_cast<u32>(i / 3);
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned a = result[i + k];
+				unsigned b = result[i + (k + 1) % 3];
+
+				// Both directions are tried, each edge shows up from both its triangles
+				if (!locked[a])
+				{
+					Quadric q = quadrics[a];
+					q.Add(quadrics[b]);
+					collapses.push_back({ a, b, q.Evaluate(positions[b]) });
+				}
+			}
+		}
+
+		if (collapses.empty())
+		{
+			break;
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		if (collapses[0].cost > errorLimit)
+		{
+			break;
+		}
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t removedTriangles = 0;
+		size_t wantedTriangles = triangleCount - targetIndexCount / 3;
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.cost > errorLimit || removedTriangles >= wantedTriangles)
+			{
+				break;
+			}
+
+			unsigned from = collapse.from;
+			unsigned to = collapse.to;
+
+			if (touched[from] || touched[to])
+			{
+				continue;
+			}
+
+			// Reject collapses that would turn a triangle around, and measure how far the
+			// moved triangles end up from the planes they had
+			bool flips = false;
+			size_t collapsed = 0;
+			float distance = 0.0f;
+
+			for (u32 t = triangleOffsets[from]; t < triangleOffsets[from + 1] && !flips; ++t)
+			{
+				const unsigned* triangle = &result[triangleList[t] * 3];
+
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				{
+					collapsed++;
+					continue;
+				}
+
+				vec3 before = glm::cross(positions[triangle[1]] - positions[triangle[0]], positions[triangle[2]] - positions[triangle[0]]);
+
+				vec3 moved[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					moved[k] = positions[triangle[k] == from ? to : triangle[k]];
+				}
+
+				vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+
+				flips = glm::dot(before, after) <= 0.0f;
+
+				float beforeLength = glm::length(before);
+				if (beforeLength > 0.0f)
+				{
+					distance = std::max(distance, std::abs(glm::dot(before / beforeLength, positions[to] - positions[triangle[0]])));
+				}
+			}
+
+			if (flips)
+			{
+				continue;
+			}
+
+			float error = std::max(vertexErrors[to], vertexErrors[from] + distance);
+			if (error > targetError)
+			{
+				continue;
+			}
+
+			remap[from] = to;
+			quadrics[to].Add(quadrics[from]);
+			removedTriangles += collapsed;
+			vertexErrors[to] = error;
+			maxError = std::max(maxError, error);
+
+			// Neighbourhoods changed this pass are left for the next one, keeping the flip checks valid
+			for (u32 t = triangleOffsets[from]; t < triangleOffsets[from + 1]; ++t)
+			{
+				const unsigned* triangle = &result[triangleList[t] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+			}
+		}
+
+		if (removedTriangles == 0)
+		{
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			unsigned a = remap[result[i]];
+			unsigned b = remap[result[i + 1]];
+			unsigned c = remap[result[i + 2]];
+
+			if (a != b && b != c && a != c)
+			{
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+
+		result.resize(write);
+	}
+
+	if (resultError)
+	{
+		*resultError = maxError;
+	}
+
+	return result;
+}
+
+float agl::aglMeshOptimizer::ComputeACMR(const std::vector<unsigned>& indices, size_t vertexCount, u32 cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	if (triangleCount == 0)
+	{
+		return 0.0f;
+	}
+
+	std::vector<u32> timestamps(vertexCount, 0);
+	u32 time = cacheSize + 1;
+	size_t misses = 0;
+
+	for (unsigned index : indices)
+	{
+		if (time - timestamps[index] > cacheSize)
+		{
+			timestamps[index] = time++;
+			misses++;
+		}
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
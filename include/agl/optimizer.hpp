@@ -0,0 +1,55 @@
+#if !defined(OPTIMIZER_HPP)
+#define OPTIMIZER_HPP
+
+#include <vector>
+
+#include "agl.hpp"
+
+// Import-time index and vertex reordering. Every pass works on triangle lists.
+struct AURORA_API agl::aglMeshOptimizer
+{
+	// Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+	static void OptimizeVertexCache(std::vector<unsigned>& indices, size_t vertexCount);
+
+	// Splits a cache-optimized index buffer into clusters at cache resets and sorts the clusters
+	// so outward-facing ones on the outside of the mesh are drawn first, reducing overdraw
+	// while keeping most of the cache locality
+	static void OptimizeOverdraw(std::vector<unsigned>& indices, const std::vector<aglVertex>& vertices);
+
+	// Renumbers vertices in first-use order and rewrites the indices. Returns the old to new
+	// index table, unreferenced vertices map to UINT32_MAX and are dropped by Remap.
+	static std::vector<uint32_t> OptimizeVertexFetch(std::vector<unsigned>& indices, size_t vertexCount);
+
+	template <typename T>
+	static void Remap(std::vector<T>& data, const std::vector<uint32_t>& remap, size_t newCount)
+	{
+		if (data.empty())
+		{
+			return;
+		}
+
+		std::vector<T> remapped(newCount);
+
+		for (size_t i = 0; i < data.size() && i < remap.size(); ++i)
+		{
+			if (remap[i] != UINT32_MAX)
+			{
+				remapped[remap[i]] = data[i];
+			}
+		}
+
+		data = std::move(remapped);
+	}
+
+	// Quadric error edge collapse towards targetIndexCount, stopping early once a collapse would
+	// move the surface further than targetError (relative to the mesh extent). Only the indices
+	// change, so the result draws with the source's vertex buffer. Open borders and vertices
+	// split at attribute seams are never moved. resultError receives the largest error reached.
+	static std::vector<unsigned> Simplify(const std::vector<unsigned>& indices, const std::vector<aglVertex>& vertices,
+		size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+	// Average cache misses per triangle for a FIFO cache, 0.5 is the practical best
+	static float ComputeACMR(const std::vector<unsigned>& indices, size_t vertexCount, u32 cacheSize = 16);
+};
+
+#endif // OPTIMIZER_HPP
@@ -11,6 +11,7 @@
 
 #include "aurora/utils/utils.hpp"
 
-constexpr int MAX_FRAMES_IN_FLIGHT = 3;
+// Upper bound for agl_details::framesInFlight, the actual count is chosen at agl_init
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
 
 #endif
@@ -118,6 +118,8 @@ int main(void) {
 	    while (!glfwWindowShouldClose(agl::window))
 	    {
 
+			agl::BeginFrame();
+
 			agl_ext::installedExtensions[AGL_EXTENSION_IMGUI_LAYER_NAME]->Refresh();
 
 			static auto startTime = std::chrono::high_resolution_clock::now();
@@ -176,8 +178,6 @@ int main(void) {
 
 #ifdef GRAPHICS_VULKAN
   
-			agl::record_command_buffer(agl::currentFrame);
-
 			model->Draw(agl::baseSurface->commandBuffer, agl::currentFrame);
 
 			//aglImGuiExtension::Dockspace();
@@ -226,8 +226,6 @@ int main(void) {
 			//ImGui::End();
 
 			agl_ext::installedExtensions[AGL_EXTENSION_IMGUI_LAYER_NAME]->LateRefresh();
-
-			agl::FinishRecordingCommandBuffer(agl::currentFrame);
 #endif
 
 #ifdef GRAPHICS_OPENGL
@@ -239,7 +237,7 @@ int main(void) {
 			model->Draw();
 #endif
 				
-			agl::UpdateFrame();
+			agl::EndFrame();
 	    }
 
 		agl_ext::UninstallAll();